@@ -0,0 +1,34 @@
+# Stages data/ into the build directory for the filesystem image (pio run -t buildfs/uploadfs). Static assets of the
+# allowlisted types are stored only gzip compressed, serveStaticFile() sends them with Content-Encoding: gzip.
+# Everything else (html templates rendered on the device, certificates, keys) is copied unchanged. data/ is not modified.
+import gzip
+import os
+import shutil
+
+Import("env")
+
+GZIP_EXTENSIONS = (".css", ".js")
+
+def stage_data_files():
+    data_dir = env.subst("$PROJECT_DATA_DIR")
+    stage_dir = os.path.join(env.subst("$BUILD_DIR"), "data")
+    if os.path.isdir(stage_dir):
+        shutil.rmtree(stage_dir)
+    os.makedirs(stage_dir)
+    for name in sorted(os.listdir(data_dir)):
+        path = os.path.join(data_dir, name)
+        if os.path.isdir(path):
+            shutil.copytree(path, os.path.join(stage_dir, name))
+        elif name.endswith(".gz") and name[:-3].endswith(GZIP_EXTENSIONS):
+            continue # left in data/ by earlier builds, compressed again below
+        elif name.endswith(GZIP_EXTENSIONS):
+            gz_path = os.path.join(stage_dir, name + ".gz")
+            with open(path, "rb") as source, gzip.GzipFile(gz_path, "wb", compresslevel=9, mtime=0) as target:
+                shutil.copyfileobj(source, target)
+            print("Compressed %s: %d -> %d bytes" % (name, os.path.getsize(path), os.path.getsize(gz_path)))
+        else:
+            shutil.copy2(path, stage_dir)
+    env.Replace(PROJECT_DATA_DIR=stage_dir)
+
+if any(target in COMMAND_LINE_TARGETS for target in ("buildfs", "uploadfs", "uploadfsota")):
+    stage_data_files()
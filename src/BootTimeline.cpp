@@ -0,0 +1,28 @@
+#include "BootTimeline.h"
+
+void BootTimeline::mark(const char *milestone) {
+  uint32_t now = esp_timer_get_time() / 1000;
+  portENTER_CRITICAL(&lock);
+  if (count < maxMilestones) {
+    names[count] = milestone;
+    millisSinceReset[count] = now;
+    count++;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+/* milestones in order of arrival, e.g. {"setup":312,"sensorsReady":1450,...} */
+String BootTimeline::toJson() {
+  portENTER_CRITICAL(&lock);
+  int snapshotCount = count;
+  portEXIT_CRITICAL(&lock);
+
+  // entries below count are never changed again, so no lock needed for formatting
+  String json = "{";
+  for (int i=0; i<snapshotCount; i++) {
+    if (i > 0)
+      json += ",";
+    json += String("\"") + names[i] + "\":" + millisSinceReset[i];
+  }
+  return json + "}";
+}
@@ -0,0 +1,23 @@
+#ifndef BOOTTIMELINE_H
+#define BOOTTIMELINE_H
+
+#include <Arduino.h>
+
+/*
+  Milestones of the startup (milliseconds since reset). The boot steps run as concurrent tasks, so marks may arrive from
+  any task in any order. Names must be string literals, they are stored as pointers.
+*/
+class BootTimeline {
+  public:
+    void mark(const char *milestone);
+    String toJson();
+
+  private:
+    static const int maxMilestones = 20;
+    const char *names[maxMilestones];
+    uint32_t millisSinceReset[maxMilestones];
+    int count = 0;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif
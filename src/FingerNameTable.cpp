@@ -0,0 +1,391 @@
+#include "FingerNameTable.h"
+#include <algorithm>
+#include "nvs.h"
+#include "rom/crc.h"
+
+FingerNameTable::~FingerNameTable() {
+  free(arena);
+}
+
+/* index of the first entry with an id >= id (binary search) */
+size_t FingerNameTable::lowerBound(uint16_t id) {
+  size_t low = 0;
+  size_t high = entries.size();
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (entries[mid].id < id)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/* copies the name to the end of the arena, grows the arena in steps to keep reallocations rare */
+bool FingerNameTable::appendName(const char *name, uint16_t length, uint16_t &offset) {
+  size_t needed = arenaUsed + length + 1;
+  if (needed > UINT16_MAX)
+    return false;
+  if (needed > arenaSize) {
+    size_t newSize = ((needed + arenaGrowth - 1) / arenaGrowth) * arenaGrowth;
+    char *newArena = (char*)realloc(arena, newSize);
+    if (newArena == NULL)
+      return false;
+    arena = newArena;
+    arenaSize = newSize;
+  }
+  offset = arenaUsed;
+  memcpy(arena + arenaUsed, name, length);
+  arena[arenaUsed + length] = 0;
+  arenaUsed += length + 1;
+  return true;
+}
+
+/* removes the name from the arena and moves all following names down */
+void FingerNameTable::eraseName(const Entry &entry) {
+  uint16_t erased = entry.length + 1;
+  uint16_t offset = entry.offset;
+  memmove(arena + offset, arena + offset + erased, arenaUsed - offset - erased);
+  arenaUsed -= erased;
+  for (size_t i=0; i<entries.size(); i++) {
+    if (entries[i].offset > offset)
+      entries[i].offset -= erased;
+  }
+}
+
+void FingerNameTable::set(uint16_t id, const char *name) {
+  generation++;
+  dirtyChunks.set(id / slotsPerChunk);
+  size_t length = strlen(name);
+  if (length > 255)
+    length = 255;
+  size_t pos = lowerBound(id);
+  bool exists = (pos < entries.size() && entries[pos].id == id);
+
+  if (exists && entries[pos].length == length) {
+    memcpy(arena + entries[pos].offset, name, length); // same size, no need to move anything
+    return;
+  }
+  if (exists)
+    eraseName(entries[pos]);
+
+  Entry entry;
+  entry.id = id;
+  entry.length = length;
+  if (!appendName(name, length, entry.offset)) {
+    if (exists)
+      entries.erase(entries.begin() + pos);
+    return;
+  }
+  if (exists)
+    entries[pos] = entry;
+  else
+    entries.insert(entries.begin() + pos, entry);
+}
+
+bool FingerNameTable::remove(uint16_t id) {
+  size_t pos = lowerBound(id);
+  if (pos >= entries.size() || entries[pos].id != id)
+    return false;
+  eraseName(entries[pos]);
+  entries.erase(entries.begin() + pos);
+  generation++;
+  dirtyChunks.set(id / slotsPerChunk);
+  return true;
+}
+
+void FingerNameTable::clear() {
+  generation++;
+  for (size_t i=0; i<entries.size(); i++)
+    dirtyChunks.set(entries[i].id / slotsPerChunk);
+  entries.clear();
+  entries.shrink_to_fit();
+  free(arena);
+  arena = NULL;
+  arenaUsed = 0;
+  arenaSize = 0;
+}
+
+bool FingerNameTable::contains(uint16_t id) {
+  size_t pos = lowerBound(id);
+  return pos < entries.size() && entries[pos].id == id;
+}
+
+const char* FingerNameTable::find(uint16_t id) {
+  size_t pos = lowerBound(id);
+  if (pos < entries.size() && entries[pos].id == id)
+    return arena + entries[pos].offset;
+  return NULL;
+}
+
+size_t FingerNameTable::size() {
+  return entries.size();
+}
+
+uint16_t FingerNameTable::idAt(size_t index) {
+  return entries[index].id;
+}
+
+const char* FingerNameTable::nameAt(size_t index) {
+  return arena + entries[index].offset;
+}
+
+uint32_t FingerNameTable::getGeneration() {
+  return generation;
+}
+
+/* bytes allocated for entries and arena */
+size_t FingerNameTable::getMemoryUsage() {
+  return entries.capacity() * sizeof(Entry) + arenaSize;
+}
+
+String FingerNameTable::getChunkKey(size_t chunk) {
+  return String(blobKey) + chunk;
+}
+
+/*
+  Chunk: header, entries and names of the slots of the chunk, followed by a CRC32 of all preceding bytes. Chunks are loaded in
+  ascending order, so the entries are appended sorted.
+*/
+bool FingerNameTable::loadChunk(Preferences &preferences, size_t chunk) {
+  String key = getChunkKey(chunk);
+  size_t chunkSize = preferences.getBytesLength(key.c_str());
+  if (chunkSize < sizeof(ChunkHeader) + sizeof(uint32_t))
+    return false;
+  uint8_t *data = (uint8_t*)malloc(chunkSize);
+  if (data == NULL)
+    return false;
+
+  bool ok = (preferences.getBytes(key.c_str(), data, chunkSize) == chunkSize);
+  ChunkHeader header;
+  memcpy(&header, data, sizeof(header));
+  size_t entriesSize = header.count * sizeof(Entry);
+  ok = ok && header.version == chunkVersion && header.chunk == chunk
+    && chunkSize == sizeof(header) + entriesSize + header.namesSize + sizeof(uint32_t);
+  if (ok) {
+    uint32_t crc;
+    memcpy(&crc, data + chunkSize - sizeof(crc), sizeof(crc));
+    ok = (crc == crc32_le(0, data, chunkSize - sizeof(crc)));
+  }
+  const char *names = (const char*)data + sizeof(header) + entriesSize;
+  std::vector<Entry> chunkEntries(ok ? header.count : 0);
+  if (ok)
+    memcpy(chunkEntries.data(), data + sizeof(header), entriesSize);
+  for (size_t i=0; i<chunkEntries.size() && ok; i++) {
+    const Entry &entry = chunkEntries[i];
+    ok = (entry.id / slotsPerChunk == chunk) && (entry.offset + entry.length < header.namesSize)
+      && (i == 0 || chunkEntries[i-1].id < entry.id) && names[entry.offset + entry.length] == 0;
+  }
+  for (size_t i=0; i<chunkEntries.size() && ok; i++) {
+    Entry entry = chunkEntries[i];
+    ok = appendName(names + entry.offset, entry.length, entry.offset);
+    if (ok)
+      entries.push_back(entry);
+  }
+  free(data);
+  return ok;
+}
+
+/* writes the chunk, or removes it if none of its slots has a name */
+bool FingerNameTable::saveChunk(Preferences &preferences, size_t chunk) {
+  String key = getChunkKey(chunk);
+  size_t first = lowerBound(chunk * slotsPerChunk);
+  size_t last = (chunk + 1 < maxChunks) ? lowerBound((chunk + 1) * slotsPerChunk) : entries.size();
+  if (first == last) {
+    if (preferences.isKey(key.c_str()))
+      return preferences.remove(key.c_str());
+    return true;
+  }
+
+  ChunkHeader header;
+  header.version = chunkVersion;
+  header.chunk = chunk;
+  header.count = last - first;
+  size_t namesSize = 0;
+  for (size_t i=first; i<last; i++)
+    namesSize += entries[i].length + 1;
+  header.namesSize = namesSize;
+  size_t entriesSize = header.count * sizeof(Entry);
+  size_t chunkSize = sizeof(header) + entriesSize + namesSize + sizeof(uint32_t);
+  uint8_t *data = (uint8_t*)malloc(chunkSize);
+  if (data == NULL)
+    return false;
+
+  memcpy(data, &header, sizeof(header));
+  uint16_t offset = 0;
+  for (size_t i=first; i<last; i++) {
+    Entry entry = entries[i];
+    entry.offset = offset; // within the names of the chunk
+    memcpy(data + sizeof(header) + sizeof(Entry) * (i - first), &entry, sizeof(entry));
+    memcpy(data + sizeof(header) + entriesSize + offset, arena + entries[i].offset, entry.length + 1);
+    offset += entry.length + 1;
+  }
+  uint32_t crc = crc32_le(0, data, chunkSize - sizeof(crc));
+  memcpy(data + chunkSize - sizeof(crc), &crc, sizeof(crc));
+
+  bool ok = (preferences.putBytes(key.c_str(), data, chunkSize) == chunkSize);
+  free(data);
+  return ok;
+}
+
+bool FingerNameTable::saveToPrefs(const char *prefsNamespace) {
+  if (!chunksNamespace.equals(prefsNamespace)) {
+    dirtyChunks.set(); // chunks of another table might be stored there
+    chunksNamespace = prefsNamespace;
+  }
+  if (dirtyChunks.none())
+    return true;
+
+  Preferences preferences;
+  if (!preferences.begin(prefsNamespace, false))
+    return false;
+  bool ok = true;
+  for (size_t chunk=0; chunk<maxChunks; chunk++) {
+    if (!dirtyChunks.test(chunk))
+      continue;
+    if (saveChunk(preferences, chunk))
+      dirtyChunks.reset(chunk);
+    else
+      ok = false; // NVS full: the chunk stays dirty, the next save tries again
+  }
+  preferences.end();
+  return ok;
+}
+
+/* single blob "names" of earlier versions: header, entries and arena as they were in RAM, followed by a CRC32 of all preceding bytes */
+bool FingerNameTable::loadBlob(Preferences &preferences) {
+  size_t blobSize = preferences.getBytesLength(blobKey);
+  if (blobSize < sizeof(BlobHeader) + sizeof(uint32_t))
+    return false;
+  uint8_t *blob = (uint8_t*)malloc(blobSize);
+  if (blob == NULL)
+    return false;
+
+  bool ok = (preferences.getBytes(blobKey, blob, blobSize) == blobSize);
+  BlobHeader header;
+  memcpy(&header, blob, sizeof(header));
+  size_t entriesSize = header.count * sizeof(Entry);
+  ok = ok && header.version == blobVersion && blobSize == sizeof(header) + entriesSize + header.arenaUsed + sizeof(uint32_t);
+  if (ok) {
+    uint32_t crc;
+    memcpy(&crc, blob + blobSize - sizeof(crc), sizeof(crc));
+    ok = (crc == crc32_le(0, blob, blobSize - sizeof(crc)));
+  }
+  if (ok) {
+    entries.resize(header.count);
+    memcpy(entries.data(), blob + sizeof(header), entriesSize);
+    for (size_t i=0; i<entries.size() && ok; i++) {
+      ok = (entries[i].offset + entries[i].length < header.arenaUsed) && (i == 0 || entries[i-1].id < entries[i].id)
+        && blob[sizeof(header) + entriesSize + entries[i].offset + entries[i].length] == 0;
+    }
+  }
+  if (ok && header.arenaUsed > 0) {
+    size_t newSize = ((header.arenaUsed + arenaGrowth - 1) / arenaGrowth) * arenaGrowth;
+    arena = (char*)malloc(newSize);
+    if (arena != NULL) {
+      memcpy(arena, blob + sizeof(header) + entriesSize, header.arenaUsed);
+      arenaUsed = header.arenaUsed;
+      arenaSize = newSize;
+    } else
+      ok = false;
+  }
+  free(blob);
+  if (!ok)
+    clear();
+  return ok;
+}
+
+/* names stored by earlier versions as one string per finger (key = slot id), read in a single iterator pass */
+void FingerNameTable::loadLegacyKeys(Preferences &preferences, const char *prefsNamespace) {
+  nvs_iterator_t it = nvs_entry_find("nvs", prefsNamespace, NVS_TYPE_STR);
+  while (it != NULL) {
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    int id = atoi(info.key);
+    if (id > 0 && id <= UINT16_MAX) {
+      char name[256];
+      if (preferences.getString(info.key, name, sizeof(name)) > 0)
+        set((uint16_t)id, name);
+    }
+    it = nvs_entry_next(it);
+  }
+  nvs_release_iterator(it);
+}
+
+/* stores a table loaded from the format of an earlier version as chunks, the old keys are removed only when that worked */
+FingerNameTable::LoadResult FingerNameTable::migrate(const char *prefsNamespace, bool fromBlob) {
+  for (size_t i=0; i<entries.size(); i++)
+    dirtyChunks.set(entries[i].id / slotsPerChunk);
+  if (!saveToPrefs(prefsNamespace))
+    return LoadResult::legacy;
+  Preferences preferences;
+  preferences.begin(prefsNamespace, false);
+  if (fromBlob) {
+    preferences.remove(blobKey);
+  } else {
+    for (size_t i=0; i<entries.size(); i++)
+      preferences.remove(String(entries[i].id).c_str());
+  }
+  preferences.end();
+  return LoadResult::migrated;
+}
+
+FingerNameTable::LoadResult FingerNameTable::loadFromPrefs(const char *prefsNamespace) {
+  clear();
+  dirtyChunks.reset();
+  chunksNamespace = prefsNamespace;
+  Preferences preferences;
+  if (!preferences.begin(prefsNamespace, true))
+    return LoadResult::empty; // namespace does not exist yet (no finger enrolled so far)
+
+  // chunk numbers from the keys, one iterator pass instead of a lookup per possible chunk
+  std::vector<size_t> chunks;
+  nvs_iterator_t it = nvs_entry_find("nvs", prefsNamespace, NVS_TYPE_BLOB);
+  while (it != NULL) {
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    size_t prefixLength = strlen(blobKey);
+    if (strncmp(info.key, blobKey, prefixLength) == 0 && isdigit((unsigned char)info.key[prefixLength])) {
+      size_t chunk = atoi(info.key + prefixLength);
+      if (chunk < maxChunks)
+        chunks.push_back(chunk);
+    }
+    it = nvs_entry_next(it);
+  }
+  nvs_release_iterator(it);
+  if (!chunks.empty()) {
+    std::sort(chunks.begin(), chunks.end());
+    bool ok = true;
+    for (size_t chunk : chunks) {
+      if (!loadChunk(preferences, chunk)) {
+        ok = false;
+        dirtyChunks.set(chunk); // rewritten (or removed) by the next save
+      }
+    }
+    preferences.end();
+    return ok ? LoadResult::chunks : LoadResult::corrupt;
+  }
+
+  bool blobFound = preferences.isKey(blobKey);
+  if (blobFound && loadBlob(preferences)) {
+    preferences.end();
+    return migrate(prefsNamespace, true);
+  }
+  loadLegacyKeys(preferences, prefsNamespace);
+  preferences.end();
+  if (entries.empty())
+    return blobFound ? LoadResult::corrupt : LoadResult::empty;
+  return migrate(prefsNamespace, false);
+}
+
+const char* FingerNameTable::getLoadResultName(LoadResult result) {
+  switch (result)
+  {
+  case LoadResult::empty: return "empty";
+  case LoadResult::chunks: return "chunks";
+  case LoadResult::migrated: return "migrated from an earlier version";
+  case LoadResult::legacy: return "format of an earlier version (migration failed)";
+  case LoadResult::corrupt: return "corrupt chunk";
+  }
+  return "unknown";
+}
@@ -0,0 +1,82 @@
+#ifndef FINGERNAMETABLE_H
+#define FINGERNAMETABLE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <bitset>
+#include <vector>
+
+/*
+  Names of the enrolled fingers by slot id. Only enrolled slots have an entry (sorted by id), so memory and iteration scale
+  with the number of fingers and not with the capacity of the sensor (up to 3000 slots).
+  All names live null-terminated in one contiguous arena, entries refer to them by offset. Renames and deletes compact the
+  arena, so months of renaming don't fragment the heap with lots of small String buffers.
+  Persisted in NVS as one CRC checked blob per 256 slots ("names0", "names1", ...). Saving rewrites only the chunks changed
+  since the last load or save, so renaming a finger of a large sensor doesn't rewrite the names of all others. The single
+  blob and the one key per finger of earlier versions are migrated on first load.
+*/
+class FingerNameTable {
+  public:
+    ~FingerNameTable();
+
+    void set(uint16_t id, const char *name);
+    bool remove(uint16_t id);
+    void clear();
+    bool contains(uint16_t id);
+    const char* find(uint16_t id); // view into the arena, NULL if not enrolled. Valid until the next change of the table
+    size_t size();
+    uint16_t idAt(size_t index); // entries sorted by id
+    const char* nameAt(size_t index);
+    size_t getMemoryUsage();
+    uint32_t getGeneration(); // incremented on every change
+
+    enum class LoadResult { empty, chunks, migrated, legacy, corrupt };
+    LoadResult loadFromPrefs(const char *prefsNamespace);
+    bool saveToPrefs(const char *prefsNamespace); // changed chunks, false if one did not fit into NVS (it is retried by the next save)
+    static const char* getLoadResultName(LoadResult result);
+
+  private:
+    struct Entry {
+      uint16_t id;
+      uint16_t offset; // of the name in the arena
+      uint16_t length; // without null termination
+    };
+    struct BlobHeader {
+      uint8_t version;
+      uint8_t reserved;
+      uint16_t count;     // number of entries
+      uint16_t arenaUsed; // bytes of names
+    };
+    struct ChunkHeader {
+      uint8_t version;
+      uint8_t chunk;      // slots chunk * slotsPerChunk ... (chunk + 1) * slotsPerChunk - 1
+      uint16_t count;     // number of entries
+      uint16_t namesSize; // bytes of names, entry offsets are relative to the first one
+    };
+    static const size_t arenaGrowth = 256;
+    static const uint8_t blobVersion = 1; // single blob of earlier versions
+    static const uint8_t chunkVersion = 2;
+    static const uint16_t slotsPerChunk = 256;
+    static const size_t maxChunks = 65536 / slotsPerChunk;
+    static constexpr const char *blobKey = "names"; // chunk keys are blobKey followed by the chunk number
+
+    std::vector<Entry> entries;
+    char *arena = NULL;
+    size_t arenaUsed = 0;
+    size_t arenaSize = 0;
+    uint32_t generation = 0;
+    std::bitset<maxChunks> dirtyChunks;
+    String chunksNamespace; // NVS namespace dirtyChunks refers to, a save to another one writes all chunks
+
+    size_t lowerBound(uint16_t id);
+    bool appendName(const char *name, uint16_t length, uint16_t &offset);
+    void eraseName(const Entry &entry);
+    static String getChunkKey(size_t chunk);
+    bool loadChunk(Preferences &preferences, size_t chunk);
+    bool saveChunk(Preferences &preferences, size_t chunk);
+    bool loadBlob(Preferences &preferences);
+    void loadLegacyKeys(Preferences &preferences, const char *prefsNamespace);
+    LoadResult migrate(const char *prefsNamespace, bool fromBlob);
+};
+
+#endif
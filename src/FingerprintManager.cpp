@@ -2,6 +2,40 @@
 #include "global.h"
 
 #include <Adafruit_Fingerprint.h>
+#include <LittleFS.h>
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+#include "esp_heap_caps.h"
+
+const uint32_t touchNotifyBit = (1 << 0);   // task notification bit: touch ring was touched
+const uint32_t commandNotifyBit = (1 << 1); // task notification bit: new command in queue
+
+// baud rates supported by R503-class sensors, fastest first. Sensor default is 57600.
+const uint32_t sensorBaudRates[] = { 115200, 57600, 38400, 19200, 9600 };
+const int sensorBaudRatesCount = sizeof(sensorBaudRates) / sizeof(sensorBaudRates[0]);
+
+/*
+  Sensor DB export file: "FPDB" + version byte, followed by one record per stored template:
+  id (uint16), name length (uint8, 0 = no name), name, template data as chunks of [length (uint16), data], terminated by a chunk of length 0.
+  All numbers little endian. Chunks are written as they arrive from the sensor, so a template is never completely in RAM.
+*/
+/*
+  Timeouts per command type (processing time of the sensor + transfer). The library uses 1s for every command, but LED and
+  notepad commands are answered immediately, so a lost packet is detected much earlier.
+*/
+const uint32_t ledCommandTimeoutMs = 200;
+const uint32_t notepadCommandTimeoutMs = 300;
+const uint32_t indexTableCommandTimeoutMs = 300;
+const uint32_t imageCommandTimeoutMs = 800;   // getImage, image2Tz
+const uint32_t searchCommandTimeoutMs = 1500; // search of the whole library
+
+const char* sensorDbFileName = "/sensordb"; // + prefs suffix + ".bin"
+const uint8_t sensorDbVersion = 1;
+
+FingerprintManager::FingerprintManager(HardwareSerial &sensorSerial, int touchRingPin, int rxPin, int txPin, const String &prefsSuffix)
+  : sensorSerial(sensorSerial), touchRingPin(touchRingPin), rxPin(rxPin), txPin(txPin), prefsSuffix(prefsSuffix), finger(&sensorSerial) {
+}
 
 bool FingerprintManager::connect() {
   
@@ -10,22 +44,46 @@ bool FingerprintManager::connect() {
 
     Serial.println("\n\nAdafruit finger detect test");
 
-    // set the data rate for the sensor serial port
-    finger.begin(57600);
-    delay(50);
-    if (finger.verifyPassword()) {
-        Serial.println("Found fingerprint sensor!");
+    // template transfers (sensor DB export) arrive faster than LittleFS can write them sometimes, so give the UART some more buffer
+    sensorSerial.setRxBufferSize(2048);
+
+    // set the data rate for the sensor serial port, start with the rate that was negotiated last time
+    Preferences preferences;
+    preferences.begin(getPrefsNamespace("sensor").c_str(), true);
+    uint32_t storedBaudRate = preferences.getUInt("baudRate", 57600);
+    preferences.end();
+    if (rxPin >= 0) {
+      // finger.begin() would start the UART on its default pins (which are flash pins for Serial1)
+      delay(1000);
+      sensorSerial.begin(storedBaudRate, SERIAL_8N1, rxPin, txPin);
     } else {
+      finger.begin(storedBaudRate);
+    }
+    delay(50);
+    baudRate = findSensorBaudRate(storedBaudRate);
+    if (baudRate == 0) {
         delay(5000); // wait a bit longer for sensor to start before 2nd try (usually after a OTA-Update the esp32 is faster with startup than the fingerprint sensor)
-        if (finger.verifyPassword()) { 
-          Serial.println("Found fingerprint sensor!");
-        } else {
-          Serial.println("Did not find fingerprint sensor :(");
-          this->connected = false;
-          return this->connected;
-        }
+        baudRate = findSensorBaudRate(storedBaudRate);
+    }
+    if (baudRate != 0) {
+        Serial.println(String("Found fingerprint sensor at ") + baudRate + " baud!");
+    } else {
+        Serial.println("Did not find fingerprint sensor :(");
+        this->connected = false;
+        return this->connected;
     }
-    finger.LEDcontrol(colorSettings.connectSequence, 100, colorSettings.connectColor, 0); // sensor connected signal
+
+    // switch to the fastest supported data rate, every packet (and especially template transfers) will benefit
+    if (baudRate != sensorBaudRates[0])
+      switchBaudRate(sensorBaudRates[0]);
+    if (baudRate != storedBaudRate) {
+      preferences.begin(getPrefsNamespace("sensor").c_str(), false);
+      preferences.putUInt("baudRate", baudRate);
+      preferences.end();
+    }
+
+    ledStateKnown = false; // ring state of a (re)started sensor is unknown
+    ledControl(colorSettings.connectSequence, 100, colorSettings.connectColor, 0); // sensor connected signal
 
     Serial.println(F("Reading sensor parameters"));
     finger.getParameters();
@@ -41,6 +99,7 @@ bool FingerprintManager::connect() {
     Serial.print("Sensor contains "); Serial.print(finger.templateCount); Serial.println(" templates");
 
     loadFingerListFromPrefs();
+    startReconciliation(false); // runs in the background as soon as the sensor task is started
 
     this->connected = true;
     return this->connected;
@@ -48,13 +107,134 @@ bool FingerprintManager::connect() {
     //updateTouchState(false);
 }
 
-void FingerprintManager::updateTouchState(bool touched)
+/* probe for the sensor, first at the preferred rate, then at all other supported rates. Returns the rate found or 0 */
+uint32_t FingerprintManager::findSensorBaudRate(uint32_t preferredBaudRate) {
+  setSerialBaudRate(preferredBaudRate);
+  if (finger.verifyPassword())
+    return preferredBaudRate;
+
+  for (int i=0; i<sensorBaudRatesCount; i++) {
+    if (sensorBaudRates[i] == preferredBaudRate)
+      continue;
+    setSerialBaudRate(sensorBaudRates[i]);
+    if (finger.verifyPassword())
+      return sensorBaudRates[i];
+  }
+  return 0;
+}
+
+
+void FingerprintManager::setSerialBaudRate(uint32_t rate) {
+  sensorSerial.updateBaudRate(rate);
+  while (sensorSerial.available()) // drop garbage received at the old rate
+    sensorSerial.read();
+}
+
+
+/* tell the sensor to use a new data rate and follow it. Falls back to the current rate if the sensor does not answer at the new rate. */
+bool FingerprintManager::switchBaudRate(uint32_t newBaudRate) {
+  uint32_t oldBaudRate = baudRate;
+  if (finger.setBaudRate((uint8_t)(newBaudRate / 9600)) != FINGERPRINT_OK) { // sensor expects the rate as multiple of 9600
+    Serial.println(String("Sensor does not support ") + newBaudRate + " baud");
+    return false;
+  }
+  sensorSerial.flush();
+  delay(50);
+  setSerialBaudRate(newBaudRate);
+  if (finger.verifyPassword()) {
+    baudRate = newBaudRate;
+    Serial.println(String("Switched sensor to ") + newBaudRate + " baud");
+    return true;
+  }
+
+  // sensor did not follow (some modules only apply the new rate after power cycle), find out where it is now
+  uint32_t foundBaudRate = findSensorBaudRate(oldBaudRate);
+  if (foundBaudRate != 0)
+    baudRate = foundBaudRate;
+  Serial.println(String("Switching sensor to ") + newBaudRate + " baud failed, using " + baudRate + " baud");
+  return false;
+}
+
+
+/*
+  Measures round trip times of typical commands at each supported data rate, sensor is left at the fastest working rate.
+  Takes a few seconds, so it is queued asynchronously and the report is sent to the log line by line.
+*/
+void FingerprintManager::benchmarkBaudRates() {
+  if (!isSensorTask()) {
+    SensorCommand *command = new SensorCommand();
+    command->type = SensorCommandType::benchmark;
+    queueCommand(command);
+    return;
+  }
+  notifyClients("Sensor benchmark started, scanning is paused meanwhile...");
+
+  const int repetitions = 10;
+  String report = "baud rate; verifyPassword [us]; getTemplateCount [us]; getImage [us]; LEDcontrol [us]; readNotepad [us]\n";
+  uint32_t fastestWorkingBaudRate = baudRate;
+  char notepad[32];
+
+  for (int i=sensorBaudRatesCount-1; i>=0; i--) {
+    if ((sensorBaudRates[i] != baudRate) && !switchBaudRate(sensorBaudRates[i])) {
+      report += String(sensorBaudRates[i]) + "; not supported\n";
+      continue;
+    }
+    fastestWorkingBaudRate = sensorBaudRates[i];
+
+    int64_t durations[5] = { 0, 0, 0, 0, 0 };
+    for (int n=0; n<repetitions; n++) {
+      int64_t start = esp_timer_get_time();
+      finger.verifyPassword();
+      durations[0] += esp_timer_get_time() - start;
+      start = esp_timer_get_time();
+      finger.getTemplateCount();
+      durations[1] += esp_timer_get_time() - start;
+      start = esp_timer_get_time();
+      getImage();
+      durations[2] += esp_timer_get_time() - start;
+      start = esp_timer_get_time();
+      ledStateKnown = false; // measure the real round trip, not the cache
+      setLedRingReady();
+      durations[3] += esp_timer_get_time() - start;
+      start = esp_timer_get_time();
+      readNotepad(0, notepad, sizeof(notepad));
+      durations[4] += esp_timer_get_time() - start;
+    }
+    report += String(sensorBaudRates[i]);
+    for (int d=0; d<5; d++)
+      report += String("; ") + (long)(durations[d] / repetitions);
+    report += "\n";
+  }
+
+  if (baudRate != fastestWorkingBaudRate)
+    switchBaudRate(fastestWorkingBaudRate);
+  Preferences preferences;
+  preferences.begin(getPrefsNamespace("sensor").c_str(), false);
+  preferences.putUInt("baudRate", baudRate);
+  preferences.end();
+  report += String("Sensor is now running at ") + baudRate + " baud";
+  int start = 0;
+  while (start < (int)report.length()) {
+    int end = report.indexOf('\n', start);
+    if (end < 0)
+      end = report.length();
+    notifyClients(report.substring(start, end));
+    start = end + 1;
+  }
+}
+
+
+/* deferLed: the touch indicator is not urgent (e.g. a search follows anyway), send it with the next flushLedControl() */
+void FingerprintManager::updateTouchState(bool touched, bool deferLed)
 {
   if ((touched != lastTouchState) || (ignoreTouchRing != lastIgnoreTouchRing)) {
       // check if sensor or ring is touched
       if (touched) {
         // turn touch indicator on:
-        finger.LEDcontrol(colorSettings.scanSequence, 100, colorSettings.scanColor, 0);
+        if (deferLed)
+          deferLedControl(colorSettings.scanSequence, 100, colorSettings.scanColor, 0);
+        else
+          ledControl(colorSettings.scanSequence, 100, colorSettings.scanColor, 0);
       } else {
         // turn touch indicator off:
         setLedRingReady();
@@ -70,6 +250,7 @@ Match FingerprintManager::scanFingerprint() {
   
   Match match;
   match.scanResult = ScanResult::error;
+  match.touchMicros = (touchDetectedMicros != 0) ? touchDetectedMicros : esp_timer_get_time();
 
   if (!connected) {
       return match;
@@ -91,6 +272,8 @@ Match FingerprintManager::scanFingerprint() {
         return match;
     }
 
+  } else {
+    touchEdgePending = false; // edges are only used as wakeup when ring is ignored, never as ring event
   }
   
 
@@ -111,7 +294,15 @@ Match FingerprintManager::scanFingerprint() {
       doImaging = false;
       imagingPass++;
       //Serial.println(String("Get Image try ") + imagingPass);
-      match.returnCode = finger.getImage();
+      if (touchDetectedMicros != 0) {
+        // first image after a touch ring edge, remember how long it took us to get here
+        lastTouchLatencyMicros = esp_timer_get_time() - touchDetectedMicros;
+        touchDetectedMicros = 0;
+        metrics.record(ScanStage::touchDetect, lastTouchLatencyMicros);
+      }
+      int64_t stageStart = esp_timer_get_time();
+      match.returnCode = getImage();
+      metrics.record(ScanStage::getImage, esp_timer_get_time() - stageStart);
       switch (match.returnCode) {
         case FINGERPRINT_OK:
           // Important: do net set touch state to true yet! Reason:
@@ -129,6 +320,7 @@ Match FingerprintManager::scanFingerprint() {
             if (imagingPass < 15) // up to x image passes in a row are taken after touch ring was touched until noFinger will raise a noMatchFound event
             {
               doImaging = true; // scan another image
+              metrics.countImagingRetry();
               //delay(50);
               break;
             } else {
@@ -160,11 +352,13 @@ Match FingerprintManager::scanFingerprint() {
     ///////////////////////////////////////////////////////////
     // STEP 2: Convert Image to feature map
     ///////////////////////////////////////////////////////////
-    match.returnCode = finger.image2Tz();
+    int64_t stageStart = esp_timer_get_time();
+    match.returnCode = image2Tz(1);
+    metrics.record(ScanStage::image2Tz, esp_timer_get_time() - stageStart);
     switch (match.returnCode) {
       case FINGERPRINT_OK:
         //Serial.println("Image converted");
-        updateTouchState(true);
+        updateTouchState(true, true); // LED is set after the search, a match replaces the touch indicator without an extra round trip
         break;
       case FINGERPRINT_IMAGEMESS:
         Serial.println("Image too messy");
@@ -186,15 +380,22 @@ Match FingerprintManager::scanFingerprint() {
     ///////////////////////////////////////////////////////////
     // STEP 3: Search DB for matching features
     ///////////////////////////////////////////////////////////
-    match.returnCode = finger.fingerSearch();
+    stageStart = esp_timer_get_time();
+    match.returnCode = searchFingerprint();
+    metrics.record(ScanStage::search, esp_timer_get_time() - stageStart);
     if (match.returnCode == FINGERPRINT_OK) {
         // found a match!
-        finger.LEDcontrol(colorSettings.matchSequence, 100, colorSettings.matchColor);
+        ledControl(colorSettings.matchSequence, 100, colorSettings.matchColor);
         
         match.scanResult = ScanResult::matchFound;
         match.matchId = finger.fingerID;
         match.matchConfidence = finger.confidence;
-        match.matchName = fingerList[finger.fingerID];
+        const char *name = fingerNames.find(finger.fingerID);
+        match.matchName = name ? name : "@empty";
+
+        stageStart = esp_timer_get_time();
+        match.pairingCode = getPairingCode();
+        metrics.record(ScanStage::pairingCheck, esp_timer_get_time() - stageStart);
       
     } else if (match.returnCode == FINGERPRINT_PACKETRECIEVEERR) {
         Serial.println("Communication error");
@@ -202,12 +403,15 @@ Match FingerprintManager::scanFingerprint() {
     } else if (match.returnCode == FINGERPRINT_NOTFOUND) {
         Serial.println(String("Did not find a match. (Scan #") + scanPass + String(" of 5)"));
         match.scanResult = ScanResult::noMatchFound;
-        if (scanPass < 5) // max 5 Scans until no match found is given back as result
+        if (scanPass < 5) { // max 5 Scans until no match found is given back as result
           doAnotherScan = true;
+          metrics.countScanRetry();
+        }
 
     } else {
         Serial.println("Unknown error");
     }
+    flushLedControl(); // no match -> show the deferred touch indicator now
 
   } //while
 
@@ -217,203 +421,707 @@ Match FingerprintManager::scanFingerprint() {
 
 
 
-// Preferences
-void FingerprintManager::loadFingerListFromPrefs() {
-  Preferences preferences;
-  preferences.begin("fingerList", true); 
-  int counter = 0;
-  for (int i=1; i<=200; i++) {
-    String key = String(i);
-    if (preferences.isKey(key.c_str())) {
-      fingerList[i] = preferences.getString(key.c_str(), String("@empty"));
-      counter++;
+/*
+  Search the fingers matched most recently first. In a typical household a few fingers account for almost all matches,
+  and searching only their slots is much faster than searching the whole library. Full search is done only on a miss.
+  The recent fingers are searched by one ranged search over the smallest range covering all of them, so a miss costs
+  at most one extra round trip. If that range is not much smaller than the library, the full search is done right away.
+*/
+uint8_t FingerprintManager::searchFingerprint() {
+  int64_t start = esp_timer_get_time();
+  uint8_t returnCode = FINGERPRINT_NOTFOUND;
+
+  uint16_t first = UINT16_MAX;
+  uint16_t last = 0;
+  for (int i=0; i<hotFingerCount && hotFingers[i] != 0; i++) {
+    first = min(first, hotFingers[i]);
+    last = max(last, hotFingers[i]);
+  }
+  bool hotSearch = (last >= first) && (last - first + 1 <= finger.capacity / 4);
+  if (hotSearch)
+    returnCode = searchRange(first, last - first + 1);
+
+  if (returnCode == FINGERPRINT_OK) {
+    searchStats.hotHits++;
+    searchStats.hotHitMicros += esp_timer_get_time() - start;
+  } else {
+    // miss (or communication error) -> search the whole library
+    if (hotSearch) {
+      searchStats.hotMisses++;
+      searchStats.hotMissMicros += esp_timer_get_time() - start; // time lost before the full search
     }
-    else
-      fingerList[i] = String("@empty");
+    int64_t fullStart = esp_timer_get_time();
+    returnCode = searchRange(0, finger.capacity);
+    searchStats.fullSearches++;
+    searchStats.fullSearchMicros += esp_timer_get_time() - fullStart;
+  }
+
+  if (returnCode == FINGERPRINT_OK) {
+    setHotFinger(finger.fingerID);
+    Serial.println(String("Search took ") + (long)((esp_timer_get_time() - start) / 1000) + " ms. " + getSearchStats());
+  }
+  return returnCode;
+}
+
+
+/* ranged search for the feature map in char buffer 1, sets fingerID and confidence like fingerSearch() does */
+uint8_t FingerprintManager::searchRange(uint16_t startId, uint16_t count) {
+  uint8_t data[6];
+  data[0] = FINGERPRINT_SEARCH;
+  data[1] = 0x01; // char buffer
+  data[2] = (uint8_t)(startId >> 8);
+  data[3] = (uint8_t)(startId & 0xFF);
+  data[4] = (uint8_t)(count >> 8);
+  data[5] = (uint8_t)(count & 0xFF);
+
+  uint8_t returnCode = sendCommand(data, sizeof(data), searchCommandTimeoutMs);
+  if (returnCode == FINGERPRINT_OK && replyLength >= 5) {
+    finger.fingerID = ((uint16_t)reply[1] << 8) | reply[2];
+    finger.confidence = ((uint16_t)reply[3] << 8) | reply[4];
   }
-  Serial.println(String(counter) + " fingers loaded from preferences.");
+  return returnCode;
+}
+
+
+uint8_t FingerprintManager::getImage() {
+  uint8_t data[1] = { FINGERPRINT_GETIMAGE };
+  return sendCommand(data, sizeof(data), imageCommandTimeoutMs);
+}
+
+
+/* convert image to feature map in char buffer "slot" */
+uint8_t FingerprintManager::image2Tz(uint8_t slot) {
+  uint8_t data[2] = { FINGERPRINT_IMAGE2TZ, slot };
+  return sendCommand(data, sizeof(data), imageCommandTimeoutMs);
+}
+
+
+/* move finger to the front of the recently matched list */
+void FingerprintManager::setHotFinger(uint16_t id) {
+  int pos = hotFingerCount - 1;
+  for (int i=0; i<hotFingerCount; i++) {
+    if (hotFingers[i] == id) {
+      pos = i;
+      break;
+    }
+  }
+  for (int i=pos; i>0; i--)
+    hotFingers[i] = hotFingers[i-1];
+  hotFingers[0] = id;
+}
+
+
+void FingerprintManager::removeHotFinger(uint16_t id) {
+  for (int i=0; i<hotFingerCount; i++) {
+    if (hotFingers[i] == id) {
+      for (int j=i; j<hotFingerCount-1; j++)
+        hotFingers[j] = hotFingers[j+1];
+      hotFingers[hotFingerCount-1] = 0;
+      return;
+    }
+  }
+}
+
+
+String FingerprintManager::getSearchStats() {
+  uint32_t searches = searchStats.hotHits + searchStats.fullSearches;
+  if (searches == 0)
+    return "No searches yet.";
+  String stats = String("Recent finger hit rate: ") + (searchStats.hotHits * 100 / searches) + "% of " + searches + " searches";
+  if (searchStats.hotHits > 0)
+    stats += String(", avg hit ") + (long)(searchStats.hotHitMicros / searchStats.hotHits / 1000) + " ms";
+  if (searchStats.hotMisses > 0)
+    stats += String(", avg miss penalty ") + (long)(searchStats.hotMissMicros / searchStats.hotMisses / 1000) + " ms";
+  if (searchStats.fullSearches > 0)
+    stats += String(", avg full search ") + (long)(searchStats.fullSearchMicros / searchStats.fullSearches / 1000) + " ms";
+  return stats;
+}
+
+
+
+// Preferences
+void FingerprintManager::loadFingerListFromPrefs() {
+  uint32_t freeHeapBefore = ESP.getFreeHeap();
+  uint32_t largestBlockBefore = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  int64_t startMicros = esp_timer_get_time();
+  FingerNameTable::LoadResult result = fingerNames.loadFromPrefs(getPrefsNamespace("fingerList").c_str());
+  publishFingerListState();
+  int64_t loadMicros = esp_timer_get_time() - startMicros;
+  int counter = fingerNames.size();
+  Serial.println(String(counter) + " fingers loaded from preferences in " + (long)loadMicros + " us (" + FingerNameTable::getLoadResultName(result)
+    + ", " + fingerNames.getMemoryUsage() + " bytes). Free heap "
+    + freeHeapBefore + " -> " + ESP.getFreeHeap() + ", largest free block " + largestBlockBefore + " -> " + heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  if (result == FingerNameTable::LoadResult::corrupt)
+    notifyClients("Warning: Finger names in preferences are corrupt, please rename your fingers.");
   if (counter != finger.templateCount)
     notifyClients(String("Warning: Fingerprint count mismatch! ") + finger.templateCount + " fingerprints stored on sensor, but we are aware of " + counter + " fingerprints.");
-  preferences.end();
+}
+
+
+/* only the changed chunks of the names are written, a failure means NVS is full and must not go unnoticed */
+bool FingerprintManager::saveFingerListToPrefs() {
+  publishFingerListState(); // the names in RAM changed, even if saving fails
+  if (fingerNames.saveToPrefs(getPrefsNamespace("fingerList").c_str()))
+    return true;
+  notifyClients("Error: Saving the finger names failed, the preferences partition is full. Changed names are lost on reboot.");
+  return false;
+}
+
+
+/*
+  Reconciliation compares the index table of the sensor (one bit per slot) with the finger names. The table is read one page
+  (256 slots) per tick of the sensor task between scans, so a sensor with thousands of slots is checked without probing every slot.
+  With repair, names without template are deleted and templates without name get "#<id>" as name (like on import).
+*/
+void FingerprintManager::startReconciliation(bool repair) {
+  if (!isSensorTask()) {
+    SensorCommand *command = new SensorCommand();
+    command->type = SensorCommandType::startReconciliation;
+    command->resume = repair;
+    queueCommand(command);
+    return;
+  }
+
+  reconcilePage = 0;
+  reconcileRepair = repair;
+  reconcileStartMillis = millis();
+  reconcileReport = ReconcileReport();
+  reconcileReport.state = ReconcileState::running;
+}
+
+
+void FingerprintManager::reconcileTick() {
+  if (reconcilePage < 0)
+    return;
+
+  int pages = getIndexTablePageCount();
+  uint8_t returnCode = readIndexTablePage(reconcilePage);
+  if (returnCode != FINGERPRINT_OK) {
+    reconcileReport.state = ReconcileState::failed;
+    reconcileReport.returnCode = returnCode;
+    reconcilePage = -1;
+    notifyClients(String("Reading the index table of the sensor failed (") + returnCode + ").");
+    return;
+  }
+
+  reconcilePage++;
+  if (reconcilePage >= pages) {
+    reconcilePage = -1;
+    diffIndexTable(pages);
+  }
+}
+
+
+/* number of index table pages covering slot 0 .. capacity */
+int FingerprintManager::getIndexTablePageCount() {
+  int pages = (finger.capacity + 256) / 256;
+  return (pages > maxIndexTablePages) ? maxIndexTablePages : pages;
+}
+
+
+/* reads one page of the index table into indexTable */
+uint8_t FingerprintManager::readIndexTablePage(int page) {
+  uint8_t data[2] = { FINGERPRINT_READINDEXTABLE, (uint8_t)page };
+  uint8_t returnCode = sendCommand(data, sizeof(data), indexTableCommandTimeoutMs);
+  if (returnCode == FINGERPRINT_OK && replyLength < 1 + indexTablePageSize)
+    returnCode = FINGERPRINT_PACKETRECIEVEERR;
+  if (returnCode == FINGERPRINT_OK)
+    memcpy(indexTable + page * indexTablePageSize, reply + 1, indexTablePageSize);
+  return returnCode;
+}
+
+
+bool FingerprintManager::isSlotOccupied(uint16_t id) {
+  return indexTable[id / 8] & (1 << (id % 8));
+}
+
+/* reads the index table page of the slot from the sensor, so the answer does not depend on the last reconciliation */
+uint8_t FingerprintManager::readSlotOccupied(uint16_t id, bool &occupied) {
+  occupied = false;
+  uint8_t returnCode = readIndexTablePage(id / (indexTablePageSize * 8));
+  if (returnCode == FINGERPRINT_OK)
+    occupied = isSlotOccupied(id);
+  return returnCode;
+}
+
+
+void FingerprintManager::diffIndexTable(int pages) {
+  uint16_t slots = pages * indexTablePageSize * 8;
+  for (uint16_t id=0; id<slots && id<=finger.capacity; id++) {
+    if (isSlotOccupied(id)) {
+      reconcileReport.templateCount++;
+      if (!fingerNames.contains(id))
+        reconcileReport.unnamed.push_back(id);
+    }
+  }
+  for (size_t i=0; i<fingerNames.size(); i++) {
+    uint16_t id = fingerNames.idAt(i);
+    if (id >= slots || !isSlotOccupied(id))
+      reconcileReport.ghosts.push_back(id);
+  }
+
+  bool differences = !reconcileReport.unnamed.empty() || !reconcileReport.ghosts.empty();
+  if (differences && reconcileRepair) {
+    for (uint16_t id : reconcileReport.ghosts) {
+      fingerNames.remove(id);
+      removeHotFinger(id);
+    }
+    for (uint16_t id : reconcileReport.unnamed)
+      fingerNames.set(id, (String("#") + id).c_str());
+    reconcileReport.repaired = saveFingerListToPrefs();
+  }
+  reconcileReport.state = ReconcileState::done;
+  reconcileReport.durationMillis = millis() - reconcileStartMillis;
+
+  if (differences)
+    notifyClients(String("Finger list ") + (reconcileReport.repaired ? "repaired" : "differs from sensor") + ": " + reconcileReport.unnamed.size()
+      + " templates without name, " + reconcileReport.ghosts.size() + " names without template.");
+}
+
+
+/* result of the last reconciliation as JSON */
+String FingerprintManager::getReconcileReport() {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::getReconcileReport;
+    runOnSensorTask(command);
+    return command.resultText; // empty if the sensor task is busy
+  }
+
+  const char *states[] = { "idle", "running", "done", "failed" };
+  String json = String("{\"state\":\"") + states[(int)reconcileReport.state] + "\",\"capacity\":" + finger.capacity
+    + ",\"templatesOnSensor\":" + reconcileReport.templateCount + ",\"named\":" + fingerNames.size() + ",\"unnamed\":[";
+  for (size_t i=0; i<reconcileReport.unnamed.size(); i++)
+    json += String((i > 0) ? "," : "") + reconcileReport.unnamed[i];
+  json += "],\"ghosts\":[";
+  for (size_t i=0; i<reconcileReport.ghosts.size(); i++)
+    json += String((i > 0) ? "," : "") + reconcileReport.ghosts[i];
+  json += String("],\"repaired\":") + (reconcileReport.repaired ? "true" : "false") + ",\"returnCode\":" + reconcileReport.returnCode
+    + ",\"durationMillis\":" + reconcileReport.durationMillis + "}";
+  return json;
+}
+
+
+/* number of template slots reported by the sensor (200 for the R503, up to 3000 for other modules) */
+uint16_t FingerprintManager::getCapacity() {
+  return finger.capacity;
+}
+
+
+bool FingerprintManager::isValidId(int id) {
+  return (id > 0) && (id <= finger.capacity);
 }
 
 
 // Add/Enroll fingerprint
-NewFinger FingerprintManager::enrollFinger(int id, String name) {
+/*
+  Enrollment is a state machine driven by the sensor task: every tick takes one image (or does one other step), so commands
+  like cancel are served in between and a missing finger runs into a timeout instead of blocking forever.
+  Repeat n times to get better resulting templates (as stated in R503 documentation up to 6 combined image samples possible,
+  but I got an communication error when trying more than 5 samples, so dont go >5)
+*/
+const int enrollSamples = 5;
+const unsigned long enrollStepTimeoutMillis = 30000; // max. time to wait for placing or lifting the finger
+
+/* start enrollment without waiting for it, onDone is called by the sensor task when enrollment has finished */
+void FingerprintManager::startEnrollment(int id, String name, std::function<void(NewFinger)> onDone) {
+  if (!isSensorTask()) {
+    SensorCommand *command = new SensorCommand();
+    command->type = SensorCommandType::enroll;
+    command->id = id;
+    command->text = name;
+    command->onEnrollDone = onDone;
+    queueCommand(command);
+    return;
+  }
 
-  NewFinger newFinger;
-  newFinger.enrollResult = EnrollResult::error;
+  if (enrollStep != EnrollStep::idle) {
+    notifyClients(String("Enrollment for id #") + enrollment.id + " is still running. Cancel it first.");
+    NewFinger newFinger;
+    newFinger.returnCode = FINGERPRINT_BADLOCATION;
+    onDone(newFinger);
+    return;
+  }
 
+  enrollment.id = id;
+  enrollment.sample = 1;
+  enrollment.samples = enrollSamples;
+  enrollName = name;
+  enrollDone = onDone;
   lastTouchState = true; // after enrollment, scan mode kicks in again. Force update of the ring light back to normal on first iteration of scan mode.
 
-  
-  notifyClients(String("Enrollment for id #") + id + " started. We need to scan your finger 5 times until enrollment is completed.");
+  notifyClients(String("Enrollment for id #") + id + " started. We need to scan your finger " + enrollSamples + " times until enrollment is completed.");
+  setEnrollStep(EnrollStep::waitForFinger);
+}
 
-  
-  // Repeat n times to get better resulting templates (as stated in R503 documentation up to 6 combined image samples possible, but I got an communication error when trying more than 5 samples, so dont go >5)
-  for (int nTimes=1; nTimes<=5; nTimes++)
-  {
-      notifyClients(String("Take #" + String(nTimes))+ " (place your finger on the sensor until led ring stops flashing, then remove it).");
-
-      if (nTimes != 1) // not on first run
-      {
-        //delay(2000);
-        newFinger.returnCode = 0xFF;
-        while (newFinger.returnCode != FINGERPRINT_NOFINGER) {
-          newFinger.returnCode = finger.getImage();
-        }
-      }
-      
-      Serial.print("Taking image sample "); Serial.print(nTimes); Serial.print(": ");
-      finger.LEDcontrol(colorSettings.enrollSequence, 100, colorSettings.enrollColor, 0);
-      newFinger.returnCode = 0xFF;
-      while (newFinger.returnCode != FINGERPRINT_OK) {
-        newFinger.returnCode = finger.getImage();
-        switch (newFinger.returnCode) {
-        case FINGERPRINT_OK:
-          Serial.print("taken, ");
-          break;
-        case FINGERPRINT_NOFINGER:
-          break;
-        case FINGERPRINT_PACKETRECIEVEERR:
-          Serial.print("Communication error, ");
-          break;
-        case FINGERPRINT_IMAGEFAIL:
-          Serial.print("Imaging error, ");
-          break;
-        default:
-          Serial.print("Unknown error, ");
-          break;
-        }
-      }
-    
-      // OK success!
-    
-      newFinger.returnCode = finger.image2Tz(nTimes);
-      switch (newFinger.returnCode) {
-        case FINGERPRINT_OK:
-          Serial.print("converted");
-          break;
-        case FINGERPRINT_IMAGEMESS:
-          Serial.print("too messy");
-          return newFinger;
-        case FINGERPRINT_PACKETRECIEVEERR:
-          Serial.print("Communication error");
-          return newFinger;
-        case FINGERPRINT_FEATUREFAIL:
-          Serial.print("Could not find fingerprint features");
-          return newFinger;
-        case FINGERPRINT_INVALIDIMAGE:
-          Serial.print("Could not find fingerprint features");
-          return newFinger;
-        default:
-          Serial.print("Unknown error");
-          return newFinger;
-      }
-      finger.LEDcontrol(colorSettings.enrollSequence, 0, colorSettings.enrollColor);
 
+void FingerprintManager::cancelEnrollment() {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::cancelEnrollment;
+    runOnSensorTask(command);
+    return;
   }
 
-  
-
-  // OK converted!
-  Serial.println();
-  Serial.print("Creating model for #");  Serial.println(id);
-
-  newFinger.returnCode = finger.createModel();
-  if (newFinger.returnCode == FINGERPRINT_OK) {
-    Serial.println("Prints matched!");
-  } else if (newFinger.returnCode == FINGERPRINT_PACKETRECIEVEERR) {
-    Serial.println("Communication error");
-    return newFinger;
-  } else if (newFinger.returnCode == FINGERPRINT_ENROLLMISMATCH) {
-    Serial.println("Fingerprints did not match");
-    return newFinger;
-  } else {
-    Serial.println("Unknown error");
-    return newFinger;
+  if (enrollStep != EnrollStep::idle) {
+    NewFinger newFinger;
+    newFinger.returnCode = FINGERPRINT_TIMEOUT;
+    finishEnrollment(newFinger, EnrollStatus::cancelled);
   }
+}
 
-  Serial.print("ID "); Serial.println(id);
-  newFinger.returnCode = finger.storeModel(id);
-  if (newFinger.returnCode == FINGERPRINT_OK) {
-    Serial.println("Stored!");
-    newFinger.enrollResult = EnrollResult::ok;
-    // save to prefs
-    fingerList[id] = name;
-    Preferences preferences;
-    preferences.begin("fingerList", false); 
-    preferences.putString(String(id).c_str(), name);
-    preferences.end();
 
-  } else if (newFinger.returnCode == FINGERPRINT_PACKETRECIEVEERR) {
-    Serial.println("Communication error");
-    return newFinger;
-  } else if (newFinger.returnCode == FINGERPRINT_BADLOCATION) {
-    Serial.println("Could not store in that location");
-    return newFinger;
-  } else if (newFinger.returnCode == FINGERPRINT_FLASHERR) {
-    Serial.println("Error writing to flash");
-    return newFinger;
-  } else {
-    Serial.println("Unknown error");
-    return newFinger;
+bool FingerprintManager::isEnrolling() {
+  return enrollStep != EnrollStep::idle;
+}
+
+
+void FingerprintManager::setEnrollProgressCallback(std::function<void(const EnrollProgress&)> onProgress) {
+  enrollProgress = onProgress;
+}
+
+
+void FingerprintManager::setEnrollStep(EnrollStep step) {
+  enrollStep = step;
+  enrollStepStartMillis = millis();
+  if (step == EnrollStep::waitForFinger) {
+    notifyClients(String("Take #" + String(enrollment.sample))+ " (place your finger on the sensor until led ring stops flashing, then remove it).");
+    Serial.print("Taking image sample "); Serial.print(enrollment.sample); Serial.print(": ");
+    ledControl(colorSettings.enrollSequence, 100, colorSettings.enrollColor, 0);
+    reportEnrollProgress(EnrollStatus::waitForFinger, FINGERPRINT_OK);
+  } else if (step == EnrollStep::waitForRelease) {
+    reportEnrollProgress(EnrollStatus::liftFinger, FINGERPRINT_OK);
   }
+}
 
-  return newFinger;
+
+void FingerprintManager::reportEnrollProgress(EnrollStatus status, uint8_t returnCode) {
+  enrollment.status = status;
+  enrollment.returnCode = returnCode;
+  if (enrollProgress)
+    enrollProgress(enrollment);
 }
 
 
-void FingerprintManager::deleteFinger(int id) {
-          
-  if ((id > 0) && (id <= 200)) {
-    int8_t result = finger.deleteModel(id);
-    if (result != FINGERPRINT_OK) {
-      notifyClients(String("Delete of finger template #") + id + " from sensor failed with code " + result);
-      return;
+void FingerprintManager::finishEnrollment(NewFinger newFinger, EnrollStatus status) {
+  enrollStep = EnrollStep::idle;
+  reportEnrollProgress(status, newFinger.returnCode);
+  if (status == EnrollStatus::cancelled)
+    notifyClients(String("Enrollment for id #") + enrollment.id + " cancelled.");
+  else if (status == EnrollStatus::timeout)
+    notifyClients(String("Enrollment for id #") + enrollment.id + " timed out.");
+  if (enrollDone)
+    enrollDone(newFinger);
+  enrollDone = nullptr;
+}
+
 
+/* one step of the enrollment, called repeatedly by the sensor task */
+void FingerprintManager::enrollTick() {
+  NewFinger newFinger;
+  newFinger.enrollResult = EnrollResult::error;
+
+  if (millis() - enrollStepStartMillis > enrollStepTimeoutMillis) {
+    Serial.println("timeout");
+    newFinger.returnCode = FINGERPRINT_TIMEOUT;
+    finishEnrollment(newFinger, EnrollStatus::timeout);
+    return;
+  }
+
+  switch (enrollStep)
+  {
+  case EnrollStep::waitForRelease:
+    if (getImage() == FINGERPRINT_NOFINGER)
+      setEnrollStep(EnrollStep::waitForFinger);
+    break;
+
+  case EnrollStep::waitForFinger:
+    newFinger.returnCode = getImage();
+    switch (newFinger.returnCode) {
+      case FINGERPRINT_OK:
+        Serial.print("taken, ");
+        break;
+      case FINGERPRINT_NOFINGER:
+        return;
+      case FINGERPRINT_PACKETRECIEVEERR:
+        Serial.print("Communication error, ");
+        return;
+      case FINGERPRINT_IMAGEFAIL:
+        Serial.print("Imaging error, ");
+        return;
+      default:
+        Serial.print("Unknown error, ");
+        return;
+    }
+
+    // OK success!
+
+    newFinger.returnCode = image2Tz(enrollment.sample);
+    switch (newFinger.returnCode) {
+      case FINGERPRINT_OK:
+        Serial.print("converted");
+        break;
+      case FINGERPRINT_IMAGEMESS:
+        Serial.print("too messy");
+        finishEnrollment(newFinger, EnrollStatus::failed);
+        return;
+      case FINGERPRINT_PACKETRECIEVEERR:
+        Serial.print("Communication error");
+        finishEnrollment(newFinger, EnrollStatus::failed);
+        return;
+      case FINGERPRINT_FEATUREFAIL:
+        Serial.print("Could not find fingerprint features");
+        finishEnrollment(newFinger, EnrollStatus::failed);
+        return;
+      case FINGERPRINT_INVALIDIMAGE:
+        Serial.print("Could not find fingerprint features");
+        finishEnrollment(newFinger, EnrollStatus::failed);
+        return;
+      default:
+        Serial.print("Unknown error");
+        finishEnrollment(newFinger, EnrollStatus::failed);
+        return;
+    }
+    ledControl(colorSettings.enrollSequence, 0, colorSettings.enrollColor);
+    reportEnrollProgress(EnrollStatus::sampleTaken, FINGERPRINT_OK);
+
+    if (enrollment.sample < enrollment.samples) {
+      enrollment.sample++;
+      setEnrollStep(EnrollStep::waitForRelease);
     } else {
-      fingerList[id] = "@empty";
-      Preferences preferences;
-      preferences.begin("fingerList", false); 
-      preferences.remove (String(id).c_str());
-      preferences.end();
-      Serial.println(String("Finger template #") + id + " deleted from sensor and prefs.");
+      enrollStep = EnrollStep::storeModel;
+    }
+    break;
+
+  case EnrollStep::storeModel:
+    // OK converted!
+    Serial.println();
+    Serial.print("Creating model for #");  Serial.println(enrollment.id);
+
+    newFinger.returnCode = finger.createModel();
+    if (newFinger.returnCode == FINGERPRINT_OK) {
+      Serial.println("Prints matched!");
+    } else {
+      if (newFinger.returnCode == FINGERPRINT_PACKETRECIEVEERR)
+        Serial.println("Communication error");
+      else if (newFinger.returnCode == FINGERPRINT_ENROLLMISMATCH)
+        Serial.println("Fingerprints did not match");
+      else
+        Serial.println("Unknown error");
+      finishEnrollment(newFinger, EnrollStatus::failed);
+      return;
+    }
 
+    Serial.print("ID "); Serial.println(enrollment.id);
+    newFinger.returnCode = finger.storeModel(enrollment.id);
+    if (newFinger.returnCode == FINGERPRINT_OK) {
+      Serial.println("Stored!");
+      newFinger.enrollResult = EnrollResult::ok;
+      // save to prefs
+      fingerNames.set(enrollment.id, enrollName.c_str());
+      saveFingerListToPrefs();
+      finishEnrollment(newFinger, EnrollStatus::done);
+    } else {
+      if (newFinger.returnCode == FINGERPRINT_PACKETRECIEVEERR)
+        Serial.println("Communication error");
+      else if (newFinger.returnCode == FINGERPRINT_BADLOCATION)
+        Serial.println("Could not store in that location");
+      else if (newFinger.returnCode == FINGERPRINT_FLASHERR)
+        Serial.println("Error writing to flash");
+      else
+        Serial.println("Unknown error");
+      finishEnrollment(newFinger, EnrollStatus::failed);
     }
+    break;
+
+  case EnrollStep::idle:
+    break;
+  }
+}
+
+
+/* a template without name is deleted as well as a name without template (ghost) */
+FingerUpdateResult FingerprintManager::deleteFinger(int id) {
+
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::deleteFinger;
+    command.id = id;
+    if (!runOnSensorTask(command))
+      return FingerUpdateResult::busy;
+    return command.updateResult;
   }
 
+  if (!isValidId(id))
+    return FingerUpdateResult::notEnrolled;
+  bool occupied;
+  uint8_t result = readSlotOccupied(id, occupied);
+  if (result != FINGERPRINT_OK) {
+    notifyClients(String("Delete of finger #") + id + " failed, reading the index table of the sensor failed with code " + result);
+    return FingerUpdateResult::sensorError;
+  }
+  if (!occupied && !fingerNames.contains(id))
+    return FingerUpdateResult::notEnrolled;
+
+  if (occupied) {
+    result = finger.deleteModel(id);
+    if (result != FINGERPRINT_OK) {
+      notifyClients(String("Delete of finger template #") + id + " from sensor failed with code " + result);
+      return FingerUpdateResult::sensorError;
+    }
+  }
+  fingerNames.remove(id);
+  removeHotFinger(id);
+  if (!saveFingerListToPrefs())
+    return FingerUpdateResult::saveFailed;
+  Serial.println(String("Finger template #") + id + " deleted from sensor and prefs.");
+  return FingerUpdateResult::ok;
 }
 
 
-void FingerprintManager::renameFinger(int id, String newName) {
-  if ((id > 0) && (id <= 200)) {
-    Preferences preferences;
-    preferences.begin("fingerList", false); 
-    preferences.putString(String(id).c_str(), newName);
-    preferences.end();
-    Serial.println(String("Finger template #") + id + " renamed from " + fingerList[id] + " to " + newName);
-    fingerList[id] = newName;
+FingerUpdateResult FingerprintManager::renameFinger(int id, String newName) {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::renameFinger;
+    command.id = id;
+    command.text = newName;
+    if (!runOnSensorTask(command))
+      return FingerUpdateResult::busy;
+    return command.updateResult;
+  }
+
+  if (!isValidId(id))
+    return FingerUpdateResult::notEnrolled;
+  bool occupied;
+  uint8_t result = readSlotOccupied(id, occupied);
+  if (result != FINGERPRINT_OK) {
+    notifyClients(String("Rename of finger #") + id + " failed, reading the index table of the sensor failed with code " + result);
+    return FingerUpdateResult::sensorError;
   }
+  if (!occupied)
+    return FingerUpdateResult::notEnrolled; // a name without template would be a ghost
+
+  const char *oldName = fingerNames.find(id);
+  Serial.println(String("Finger template #") + id + " renamed from " + (oldName ? oldName : "@empty") + " to " + newName);
+  fingerNames.set(id, newName.c_str());
+  if (!saveFingerListToPrefs())
+    return FingerUpdateResult::saveFailed;
+  return FingerUpdateResult::ok;
 }
 
 String FingerprintManager::getFingerListAsHtmlOptionList() {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::getFingerList;
+    runOnSensorTask(command);
+    return command.resultText;
+  }
+
   String htmlOptions = "";
-  int counter = 0;
-  for (int i=1; i<=200; i++) {
-    if (fingerList[i].compareTo("@empty") != 0) {
-      String option;
-      if (counter == 0)
-        option = "<option value=\"" + String(i) + "\" selected>" + String(i) + " - " + fingerList[i] + "</option>";
-      else 
-        option = "<option value=\"" + String(i) + "\">" + String(i) + " - " + fingerList[i] + "</option>";
-      htmlOptions += option;
-      counter++;
-    }
+  htmlOptions.reserve(fingerNames.size() * 40);
+  for (size_t i=0; i<fingerNames.size(); i++) {
+    String id(fingerNames.idAt(i));
+    htmlOptions += "<option value=\"" + id + ((i == 0) ? "\" selected>" : "\">") + id + " - ";
+    htmlOptions += fingerNames.nameAt(i); // appended directly from the arena
+    htmlOptions += "</option>";
   }
   return htmlOptions;
 }
 
+/*
+  Page of the finger list as JSON objects {"id":1,"name":"..."} (array items). Stops before the first item that does not fit
+  into the writer. Returns the number of fingers written, total is the number of fingers known by name.
+*/
+int FingerprintManager::writeFingerList(JsonWriter &json, int offset, int limit, int &total) {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::writeFingerList;
+    command.json = &json;
+    command.id = offset;
+    command.limit = limit;
+    if (!runOnSensorTask(command))
+      return -1;
+    total = command.total;
+    return command.count;
+  }
+
+  total = fingerNames.size();
+  int written = 0;
+  for (int i=offset; i<total && written<limit; i++) {
+    size_t mark = json.mark();
+    json.beginObject();
+    json.key("id");
+    json.value(fingerNames.idAt(i));
+    json.key("name");
+    json.value(fingerNames.nameAt(i)); // copied from the arena straight into the response buffer
+    json.endObject();
+    if (json.hasOverflow()) {
+      json.rollback(mark);
+      break;
+    }
+    written++;
+  }
+  return written;
+}
+
+
+/*
+  Page of the finger list as html options for the pages, so the list is streamed instead of built as one String. Writes the
+  complete options from index offset on that fit into buffer (null terminated), length is set to their bytes. Returns the
+  number of options written, 0 at the end of the list.
+*/
+int FingerprintManager::writeFingerListAsHtmlOptions(char *buffer, size_t size, int offset, size_t &length) {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::writeFingerListAsHtmlOptions;
+    command.buffer = buffer;
+    command.bufferSize = size;
+    command.id = offset;
+    length = 0;
+    if (!runOnSensorTask(command))
+      return -1;
+    length = command.length;
+    return command.count;
+  }
+
+  length = 0;
+  if (size == 0)
+    return 0;
+  buffer[0] = 0;
+  int written = 0;
+  for (int i=offset; i<(int)fingerNames.size(); i++) {
+    unsigned int id = fingerNames.idAt(i);
+    int optionLength = snprintf(buffer + length, size - length, "<option value=\"%u\"%s>%u - %s</option>", id, (i == 0) ? " selected" : "",
+      id, fingerNames.nameAt(i));
+    if (optionLength < 0 || length + optionLength >= size) {
+      buffer[length] = 0; // option did not fit, it starts the next page
+      break;
+    }
+    length += optionLength;
+    written++;
+  }
+  return written;
+}
+
+
+/* fingerNames is changed by the sensor task only, it publishes count and generation for the web server and loop() */
+void FingerprintManager::publishFingerListState() {
+  fingerCount = fingerNames.size();
+  fingerListGeneration = fingerNames.getGeneration();
+}
+
+
+int FingerprintManager::getFingerCount() {
+  return fingerCount;
+}
+
+
+/* changes whenever a finger was added, renamed or deleted */
+uint32_t FingerprintManager::getFingerListGeneration() {
+  return fingerListGeneration;
+}
+
+
 void FingerprintManager::setIgnoreTouchRing(bool state) {
   if (ignoreTouchRing != state) {
     ignoreTouchRing = state;
@@ -425,7 +1133,411 @@ void FingerprintManager::setIgnoreTouchRing(bool state) {
 }
 
 
+void IRAM_ATTR FingerprintManager::onTouchRingInterrupt(void *arg) {
+  FingerprintManager *manager = (FingerprintManager*)arg;
+  manager->touchDetectedMicros = esp_timer_get_time();
+  manager->touchEdgePending = true;
+  manager->touchWakeupPending = true;
+  if (manager->powerManager != NULL) {
+    portENTER_CRITICAL_ISR(&manager->scanPowerLockMux);
+    bool acquire = !manager->scanPowerLockHeld;
+    manager->scanPowerLockHeld = true;
+    portEXIT_CRITICAL_ISR(&manager->scanPowerLockMux);
+    if (acquire)
+      manager->powerManager->acquireCpuMaxFromISR(); // scan at full speed right from the first edge
+  }
+  if (manager->lightSleepWakeup) {
+    // wakeup from light sleep is level triggered, disarm until the ring is released to avoid an interrupt storm
+    gpio_ll_set_intr_type(&GPIO, (gpio_num_t)manager->touchRingPin, GPIO_INTR_DISABLE);
+    manager->touchWakeupArmed = false;
+  }
+  if (manager->sensorTask != NULL) {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    xTaskNotifyFromISR(manager->sensorTask, touchNotifyBit, eSetBits, &higherPriorityTaskWoken);
+    if (higherPriorityTaskWoken)
+      portYIELD_FROM_ISR();
+  }
+}
+
+
+void FingerprintManager::startSensorTask(TouchWakeup mode) {
+  commandQueue = xQueueCreate(10, sizeof(SensorCommand*));
+  matchQueue = xQueueCreate(10, sizeof(Match*));
+  touchWakeup = mode;
+  xTaskCreatePinnedToCore(sensorTaskMain, ("sensorTask" + prefsSuffix).c_str(), 8192, this, 1, &sensorTask, ARDUINO_RUNNING_CORE);
+  if (touchWakeup == TouchWakeup::interrupt)
+    attachInterruptArg(touchRingPin, onTouchRingInterrupt, this, FALLING);
+}
+
+
+/* owns the sensor: scans on touch ring wakeup and executes queued commands in between */
+void FingerprintManager::sensorTaskMain(void *arg) {
+  FingerprintManager *manager = (FingerprintManager*)arg;
+  while (true) {
+    long holdOffRemaining = (long)(manager->holdOffUntilMillis - millis());
+    if (manager->enrollStep != EnrollStep::idle) {
+      manager->enrollTick(); // no scanning while enrolling
+    } else if (holdOffRemaining > 0) {
+      // LED feedback window after a match or ring: only serve commands, touches in the meantime are remembered by touchWakeupPending
+      manager->allowLightSleep(true);
+      xTaskNotifyWait(0, touchNotifyBit | commandNotifyBit, NULL, pdMS_TO_TICKS(holdOffRemaining));
+      manager->allowLightSleep(false);
+    } else if (manager->waitForTouch(1000)) {
+      manager->scanAndQueueMatch();
+      if (manager->touchWakeup == TouchWakeup::polling)
+        vTaskDelay(1); // let other tasks run in between
+    }
+    manager->processCommands();
+    if (manager->enrollStep == EnrollStep::idle && !manager->lastTouchState)
+      manager->reconcileTick(); // one index table page, only while nobody is at the sensor
+  }
+}
+
+
+/* Blocks the sensor task until the touch ring was touched, a command was queued or timeout. Returns true if a scan should be done now. */
+bool FingerprintManager::waitForTouch(uint32_t timeoutMs) {
+  if (touchWakeup == TouchWakeup::polling)
+    return true;
+
+  // finger still on the sensor or touched only recently -> continue scanning without waiting for another edge
+  if (lastTouchState || ((long)(scanActiveUntilMillis - millis()) > 0))
+    return true;
+
+  if (lightSleepWakeup && !touchWakeupArmed && digitalRead(touchRingPin) == HIGH)
+    armTouchWakeup(); // ring released
+
+  if (!touchWakeupPending) {
+    allowLightSleep(true);
+    xTaskNotifyWait(0, touchNotifyBit | commandNotifyBit, NULL, pdMS_TO_TICKS(timeoutMs));
+    allowLightSleep(false);
+  }
+
+  if (touchWakeupPending) {
+    touchWakeupPending = false;
+    scanActiveUntilMillis = millis() + 2000;
+    return true;
+  }
+  return false;
+}
+
+
+/* scan once and hand the result over to loop() */
+void FingerprintManager::scanAndQueueMatch() {
+  acquireScanPowerLock(); // usually already acquired by the touch ring ISR
+  int64_t start = esp_timer_get_time();
+  Match match = scanFingerprint();
+  if (match.scanResult != ScanResult::noFinger)
+    metrics.record(ScanStage::scan, esp_timer_get_time() - start);
+  if (match.scanResult != ScanResult::noFinger || lastQueuedResult != ScanResult::noFinger) {
+    Match *queuedMatch = new Match(match);
+    if (xQueueSend(matchQueue, &queuedMatch, 0) == pdTRUE) {
+      lastQueuedResult = match.scanResult;
+      if (matchListener != NULL)
+        xTaskNotifyGive(matchListener);
+    } else {
+      delete queuedMatch;
+    }
+  }
+  if (uxQueueMessagesWaiting(matchQueue) == 0)
+    releaseScanPowerLock(); // nothing to publish, otherwise loop() releases it after publishing
+
+  // wait some time before next scan to let the LED blink
+  if (match.scanResult == ScanResult::matchFound)
+    holdOffUntilMillis = millis() + 3000;
+  else if (match.scanResult == ScanResult::noMatchFound)
+    holdOffUntilMillis = millis() + 1000;
+}
+
+
+bool FingerprintManager::getNextMatch(Match &match) {
+  Match *queuedMatch;
+  if (matchQueue == NULL || xQueueReceive(matchQueue, &queuedMatch, 0) != pdTRUE)
+    return false;
+  match = *queuedMatch;
+  delete queuedMatch;
+  return true;
+}
+
+
+/* the task gets a notification (xTaskNotifyGive) for every queued scan result, so it can idle without polling all sensors */
+void FingerprintManager::setMatchListener(TaskHandle_t task) {
+  matchListener = task;
+}
+
+
+/*
+  Use the touch ring as wakeup source from light sleep (only in TouchWakeup::interrupt mode, call after startSensorTask).
+  GPIO wakeup is level triggered only (LOW = touched), the ISR disarms it and the sensor task re-arms it after the ring was released.
+*/
+bool FingerprintManager::enableLightSleepWakeup() {
+  if (touchWakeup != TouchWakeup::interrupt)
+    return false;
+  if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "sensorUart", &noSleepLock) != ESP_OK)
+    noSleepLock = NULL;
+  armTouchWakeup();
+  lightSleepWakeup = true;
+  return esp_sleep_enable_gpio_wakeup() == ESP_OK;
+}
+
+
+void FingerprintManager::armTouchWakeup() {
+  touchWakeupArmed = true;
+  gpio_wakeup_enable((gpio_num_t)touchRingPin, GPIO_INTR_LOW_LEVEL);
+}
+
+
+/* called by the sensor task only: light sleep is allowed while it is blocked waiting for a touch or a command */
+void FingerprintManager::allowLightSleep(bool allow) {
+  if (noSleepLock == NULL)
+    return;
+  if (allow && noSleepLockHeld) {
+    esp_pm_lock_release(noSleepLock);
+    noSleepLockHeld = false;
+  } else if (!allow && !noSleepLockHeld) {
+    esp_pm_lock_acquire(noSleepLock);
+    noSleepLockHeld = true;
+  }
+}
+
+
+void FingerprintManager::setPowerManager(PowerManager *powerManager) {
+  this->powerManager = powerManager;
+}
+
+
+void FingerprintManager::acquireScanPowerLock() {
+  if (powerManager == NULL)
+    return;
+  portENTER_CRITICAL(&scanPowerLockMux);
+  bool acquire = !scanPowerLockHeld;
+  scanPowerLockHeld = true;
+  portEXIT_CRITICAL(&scanPowerLockMux);
+  if (acquire)
+    powerManager->acquireCpuMax();
+}
+
+
+/* called by loop() after a scan result was published (or by the sensor task if there is nothing to publish) */
+void FingerprintManager::releaseScanPowerLock() {
+  if (powerManager == NULL)
+    return;
+  portENTER_CRITICAL(&scanPowerLockMux);
+  bool release = scanPowerLockHeld;
+  scanPowerLockHeld = false;
+  portEXIT_CRITICAL(&scanPowerLockMux);
+  if (release)
+    powerManager->releaseCpuMax();
+}
+
+
+/* every sensor has its own finger list and settings, NVS namespaces are limited to 15 chars */
+String FingerprintManager::getPrefsNamespace(const char *name) {
+  return String(name) + prefsSuffix;
+}
+
+
+String FingerprintManager::getSensorDbFileName() {
+  return String(sensorDbFileName) + prefsSuffix + ".bin";
+}
+
+
+bool FingerprintManager::isSensorTask() {
+  // before the sensor task is started (setup) everything is executed directly
+  return (sensorTask == NULL) || (xTaskGetCurrentTaskHandle() == sensorTask);
+}
+
+
+/* queue command for the sensor task without waiting, command will be deleted by the sensor task */
+void FingerprintManager::queueCommand(SensorCommand *command) {
+  xQueueSend(commandQueue, &command, portMAX_DELAY);
+  xTaskNotify(sensorTask, commandNotifyBit, eSetBits);
+}
+
+
+/*
+  Queue a copy of the command for the sensor task and wait until it was executed, the results are copied back. Returns
+  false (command not executed) if it did not start within commandStartTimeoutMs. The copy is cancelled then and deleted
+  by the sensor task, so the caller may return right away. A command that has started is waited for, the commands run
+  this way are short.
+*/
+bool FingerprintManager::runOnSensorTask(SensorCommand &command) {
+  SensorCommand *queuedCommand = new SensorCommand(command);
+  queuedCommand->done = xSemaphoreCreateBinary();
+  queuedCommand->state = CommandState::queued;
+  if (xQueueSend(commandQueue, &queuedCommand, pdMS_TO_TICKS(commandStartTimeoutMs)) != pdTRUE) {
+    vSemaphoreDelete(queuedCommand->done);
+    delete queuedCommand;
+    return false;
+  }
+  xTaskNotify(sensorTask, commandNotifyBit, eSetBits);
+
+  if (xSemaphoreTake(queuedCommand->done, pdMS_TO_TICKS(commandStartTimeoutMs)) != pdTRUE) {
+    portENTER_CRITICAL(&commandMux);
+    bool cancelled = (queuedCommand->state == CommandState::queued);
+    if (cancelled)
+      queuedCommand->state = CommandState::cancelled;
+    portEXIT_CRITICAL(&commandMux);
+    if (cancelled) {
+      Serial.println(String("Sensor busy, command ") + (int)command.type + " cancelled");
+      return false;
+    }
+    xSemaphoreTake(queuedCommand->done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(queuedCommand->done);
+  queuedCommand->done = NULL;
+  command = std::move(*queuedCommand);
+  delete queuedCommand;
+  return true;
+}
+
+
+void FingerprintManager::processCommands() {
+  SensorCommand *command;
+  while (xQueueReceive(commandQueue, &command, 0) == pdTRUE) {
+    if (command->done != NULL) {
+      portENTER_CRITICAL(&commandMux);
+      bool cancelled = (command->state == CommandState::cancelled);
+      command->state = CommandState::running;
+      portEXIT_CRITICAL(&commandMux);
+      if (cancelled) { // the caller gave up waiting
+        vSemaphoreDelete(command->done);
+        delete command;
+        continue;
+      }
+    }
+    executeCommand(*command);
+    if (command->done != NULL)
+      xSemaphoreGive(command->done); // sync: caller is waiting and owns the command
+    else
+      delete command; // async
+  }
+}
+
+
+void FingerprintManager::executeCommand(SensorCommand &command) {
+  switch (command.type)
+  {
+  case SensorCommandType::enroll:
+    startEnrollment(command.id, command.text, command.onEnrollDone);
+    break;
+  case SensorCommandType::cancelEnrollment:
+    cancelEnrollment();
+    break;
+  case SensorCommandType::startReconciliation:
+    startReconciliation(command.resume);
+    break;
+  case SensorCommandType::getReconcileReport:
+    command.resultText = getReconcileReport();
+    break;
+  case SensorCommandType::deleteFinger:
+    command.updateResult = deleteFinger(command.id);
+    break;
+  case SensorCommandType::renameFinger:
+    command.updateResult = renameFinger(command.id, command.text);
+    break;
+  case SensorCommandType::deleteAll:
+    command.result = deleteAll();
+    break;
+  case SensorCommandType::getFingerList:
+    command.resultText = getFingerListAsHtmlOptionList();
+    break;
+  case SensorCommandType::writeFingerList:
+    command.count = writeFingerList(*command.json, command.id, command.limit, command.total);
+    break;
+  case SensorCommandType::writeFingerListAsHtmlOptions:
+    command.count = writeFingerListAsHtmlOptions(command.buffer, command.bufferSize, command.id, command.length);
+    break;
+  case SensorCommandType::setLedRing:
+    if (command.ledRingState == LedRingState::error)
+      setLedRingError();
+    else if (command.ledRingState == LedRingState::wifiConfig)
+      setLedRingWifiConfig();
+    else
+      setLedRingReady();
+    break;
+  case SensorCommandType::getPairingCode:
+    command.resultText = getPairingCode();
+    break;
+  case SensorCommandType::setPairingCode:
+    command.result = setPairingCode(command.text);
+    break;
+  case SensorCommandType::benchmark:
+    benchmarkBaudRates();
+    break;
+  case SensorCommandType::exportSensorDB:
+    exportSensorDB();
+    break;
+  case SensorCommandType::importSensorDB:
+    importSensorDB(command.resume);
+    break;
+  }
+}
+
+
+int64_t FingerprintManager::getTouchLatencyMicros() {
+  return lastTouchLatencyMicros;
+}
+
+
+/*
+  Every LEDcontrol is a full UART round trip, so commands that would not change the ring are dropped. Only endless sequences
+  (count = 0) are cached, a sequence with a count ends by itself and has to be sent again to be shown again.
+*/
+uint8_t FingerprintManager::ledControl(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count) {
+  if (deferredLedPending) {
+    deferredLedPending = false; // replaced by this command before it was sent
+    metrics.countLedCommandSaved();
+  }
+
+  LedCommand command;
+  command.control = control;
+  command.speed = speed;
+  command.coloridx = coloridx;
+  command.count = count;
+  if (ledStateKnown && count == 0 && command == ledState) {
+    metrics.countLedCommandSaved();
+    return FINGERPRINT_OK;
+  }
+
+  uint8_t data[5] = { FINGERPRINT_AURALEDCONFIG, control, speed, coloridx, count };
+  int64_t start = esp_timer_get_time();
+  uint8_t returnCode = sendCommand(data, sizeof(data), ledCommandTimeoutMs);
+  metrics.record(ScanStage::ledControl, esp_timer_get_time() - start);
+  metrics.countLedCommandSent();
+  ledState = command;
+  ledStateKnown = (returnCode == FINGERPRINT_OK) && (count == 0);
+  return returnCode;
+}
+
+/* remember a non-urgent LED command, a burst of deferred commands ends up as a single round trip for the last one */
+void FingerprintManager::deferLedControl(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count) {
+  if (deferredLedPending)
+    metrics.countLedCommandSaved();
+  deferredLed.control = control;
+  deferredLed.speed = speed;
+  deferredLed.coloridx = coloridx;
+  deferredLed.count = count;
+  deferredLedPending = true;
+}
+
+void FingerprintManager::flushLedControl() {
+  if (!deferredLedPending)
+    return;
+  deferredLedPending = false;
+  ledControl(deferredLed.control, deferredLed.speed, deferredLed.coloridx, deferredLed.count);
+}
+
+
+ScanMetrics& FingerprintManager::getMetrics() {
+  return metrics;
+}
+
+
 bool FingerprintManager::isRingTouched() {
+  if (touchEdgePending) {
+    touchEdgePending = false;
+    return true;
+  }
   if (digitalRead(touchRingPin) == LOW) // LOW = touched. Caution: touchSignal on this pin occour only once (at beginning of touching the ring, not every iteration if you keep your finger on the ring)
       return true;
   else 
@@ -434,10 +1546,10 @@ bool FingerprintManager::isRingTouched() {
 
 bool FingerprintManager::isFingerOnSensor() {
   // get an image
-  uint8_t returnCode = finger.getImage();
+  uint8_t returnCode = getImage();
   if (returnCode == FINGERPRINT_OK) {
     // try to find fingerprint features in image, because image taken does not already means finger on sensor, could also be a raindrop
-    returnCode = finger.image2Tz();
+    returnCode = image2Tz(1);
     if (returnCode == FINGERPRINT_OK)
       return true;
   }
@@ -445,33 +1557,62 @@ bool FingerprintManager::isFingerOnSensor() {
 }
   
 void FingerprintManager::setLedRingError() {
-  finger.LEDcontrol(colorSettings.errorSequence, 0, colorSettings.errorColor);
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::setLedRing;
+    command.ledRingState = LedRingState::error;
+    runOnSensorTask(command);
+    return;
+  }
+  ledControl(colorSettings.errorSequence, 0, colorSettings.errorColor);
 }
 
 void FingerprintManager::setLedRingWifiConfig() {
-  finger.LEDcontrol(colorSettings.wifiSequence, 100, colorSettings.wifiColor);
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::setLedRing;
+    command.ledRingState = LedRingState::wifiConfig;
+    runOnSensorTask(command);
+    return;
+  }
+  ledControl(colorSettings.wifiSequence, 100, colorSettings.wifiColor);
 }
 
 void FingerprintManager::setLedRingReady() {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::setLedRing;
+    command.ledRingState = LedRingState::ready;
+    runOnSensorTask(command);
+    return;
+  }
   if (!ignoreTouchRing)
-    finger.LEDcontrol(colorSettings.activeSequence, 100, colorSettings.activeColor);
+    ledControl(colorSettings.activeSequence, 100, colorSettings.activeColor);
   else
-    finger.LEDcontrol(colorSettings.activeSequence, 0, colorSettings.activeColor); // just an indicator for me to see if touch ring is active or not
+    ledControl(colorSettings.activeSequence, 0, colorSettings.activeColor); // just an indicator for me to see if touch ring is active or not
 }
 
 bool FingerprintManager::deleteAll() {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::deleteAll;
+    runOnSensorTask(command);
+    return command.result;
+  }
+
   if (finger.emptyDatabase() == FINGERPRINT_OK)
   {
     bool rc;
     Preferences preferences;
-    rc = preferences.begin("fingerList", false); 
+    rc = preferences.begin(getPrefsNamespace("fingerList").c_str(), false); 
     if (rc)
         rc = preferences.clear();
     preferences.end();
 
-    for (int i=1; i<=200; i++) {
-        fingerList[i] = String("@empty");
-    };
+    fingerNames.clear();
+    publishFingerListState();
+    for (int i=0; i<hotFingerCount; i++)
+        hotFingers[i] = 0;
     
     return rc;
   }
@@ -493,13 +1634,7 @@ uint8_t FingerprintManager::writeNotepad(uint8_t pageNumber, const char *text, u
   for (int i=0; i<length; i++)
     data[i+2] = text[i];
 
-  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);                                    
-  finger.writeStructuredPacket(packet);
-  if (finger.getStructuredPacket(&packet) != FINGERPRINT_OK)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  if (packet.type != FINGERPRINT_ACKPACKET)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  return packet.data[0];
+  return sendCommand(data, sizeof(data), notepadCommandTimeoutMs);
 }
 
 
@@ -509,26 +1644,27 @@ uint8_t FingerprintManager::readNotepad(uint8_t pageNumber, char *text, uint8_t
   data[0] = FINGERPRINT_READNOTEPAD;
   data[1] = pageNumber;
 
-  Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);                                    
-  finger.writeStructuredPacket(packet);
-  if (finger.getStructuredPacket(&packet) != FINGERPRINT_OK)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  if (packet.type != FINGERPRINT_ACKPACKET)
-    return FINGERPRINT_PACKETRECIEVEERR;
-  
-  if (packet.data[0] == FINGERPRINT_OK) {
+  uint8_t returnCode = sendCommand(data, sizeof(data), notepadCommandTimeoutMs);
+  if (returnCode == FINGERPRINT_OK && replyLength > length) {
     // read data payload
     for (uint8_t i=0; i<length; i++) {
-      text[i] = packet.data[i+1];
+      text[i] = reply[i+1];
     }
   }
 
-  return packet.data[0];
+  return returnCode;
 
 }
 
 
 String FingerprintManager::getPairingCode() {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::getPairingCode;
+    runOnSensorTask(command);
+    return command.resultText;
+  }
+
   char buffer[33];
   buffer[32] = 0; // null termination needed for convertion to string at the end
   if (readNotepad(0, (char*)buffer, 32) == FINGERPRINT_OK)
@@ -539,6 +1675,14 @@ String FingerprintManager::getPairingCode() {
 
 
 bool FingerprintManager::setPairingCode(String pairingCode) {
+  if (!isSensorTask()) {
+    SensorCommand command;
+    command.type = SensorCommandType::setPairingCode;
+    command.text = pairingCode;
+    runOnSensorTask(command);
+    return command.result;
+  }
+
   if (writeNotepad(0, pairingCode.c_str(), 32) == FINGERPRINT_OK)
     return true;
   else
@@ -546,13 +1690,337 @@ bool FingerprintManager::setPairingCode(String pairingCode) {
 }
 
 
-// ToDo: support sensor replacement by enable transferring of sensor DB to another sensor
+/* writes a raw packet (used for template data, which is too large for Adafruit_Fingerprint_Packet) */
+void FingerprintManager::writeRawPacket(uint8_t type, const uint8_t *data, uint16_t length) {
+  uint16_t packetLength = length + 2; // length includes checksum
+  uint8_t header[9] = {
+    (uint8_t)(FINGERPRINT_STARTCODE >> 8), (uint8_t)(FINGERPRINT_STARTCODE & 0xFF),
+    (uint8_t)(finger.device_addr >> 24), (uint8_t)(finger.device_addr >> 16), (uint8_t)(finger.device_addr >> 8), (uint8_t)(finger.device_addr & 0xFF),
+    type, (uint8_t)(packetLength >> 8), (uint8_t)(packetLength & 0xFF)
+  };
+  uint16_t sum = type + (packetLength >> 8) + (packetLength & 0xFF);
+  for (uint16_t i=0; i<length; i++)
+    sum += data[i];
+
+  sensorSerial.write(header, sizeof(header));
+  sensorSerial.write(data, length);
+  sensorSerial.write((uint8_t)(sum >> 8));
+  sensorSerial.write((uint8_t)(sum & 0xFF));
+}
+
+
+/*
+  Reads a raw packet with up to bufferSize payload bytes. Returns payload length or -1 on timeout or checksum error.
+  readBytes() of the ESP32 HardwareSerial waits in uart_read_bytes() on the RX ring buffer of the IDF UART driver (filled by
+  the UART interrupt, no DMA), so the sensor task sleeps until the bytes have arrived instead of polling byte by byte with
+  delay(1) like the library does. See test_benchmark_scan_cpu_time for the CPU time per scan.
+*/
+int FingerprintManager::readRawPacket(uint8_t &type, uint8_t *buffer, uint16_t bufferSize, uint32_t timeoutMs) {
+  sensorSerial.setTimeout(timeoutMs);
+  uint8_t header[9]; // start code (2), address (4), type, length (2)
+  if (sensorSerial.readBytes(header, sizeof(header)) != sizeof(header))
+    return -1;
+  while (!((header[0] == (FINGERPRINT_STARTCODE >> 8)) && (header[1] == (FINGERPRINT_STARTCODE & 0xFF)))) {
+    // out of sync (garbage on the line), shift in the next byte
+    memmove(header, header + 1, sizeof(header) - 1);
+    if (sensorSerial.readBytes(&header[sizeof(header) - 1], 1) != 1)
+      return -1;
+  }
+  type = header[6];
+  uint16_t packetLength = ((uint16_t)header[7] << 8) | header[8];
+  if ((packetLength < 2) || (packetLength - 2 > bufferSize))
+    return -1;
+  uint16_t length = packetLength - 2;
+  if (sensorSerial.readBytes(buffer, length) != length)
+    return -1;
+
+  uint8_t checksum[2];
+  if (sensorSerial.readBytes(checksum, 2) != 2)
+    return -1;
+  uint16_t sum = type + header[7] + header[8];
+  for (uint16_t i=0; i<length; i++)
+    sum += buffer[i];
+  if (sum != (((uint16_t)checksum[0] << 8) | checksum[1]))
+    return -1;
+
+  return length;
+}
+
+
+/*
+  Sends a command packet and waits for its acknowledge, which is framed directly into "reply" (confirmation code first).
+  Returns the confirmation code, FINGERPRINT_PACKETRECIEVEERR on timeout or a corrupt packet.
+*/
+uint8_t FingerprintManager::sendCommand(const uint8_t *data, uint16_t length, uint32_t timeoutMs) {
+  while (sensorSerial.available()) // drop leftovers of an earlier timed out command
+    sensorSerial.read();
+
+  writeRawPacket(FINGERPRINT_COMMANDPACKET, data, length);
+  uint8_t type;
+  int received = readRawPacket(type, reply, sizeof(reply), timeoutMs);
+  metrics.countSensorPacket();
+  if (received < 1 || type != FINGERPRINT_ACKPACKET) {
+    replyLength = 0;
+    metrics.countSensorTimeout();
+    return FINGERPRINT_PACKETRECIEVEERR;
+  }
+  replyLength = received;
+  return reply[0];
+}
+
+
+/* sensor replacement: stream all templates and their names to a LittleFS file */
 void FingerprintManager::exportSensorDB() {
+  if (!isSensorTask()) {
+    SensorCommand *command = new SensorCommand();
+    command->type = SensorCommandType::exportSensorDB;
+    queueCommand(command);
+    return;
+  }
 
+  // every occupied slot is exported, also templates without name (e.g. names lost or enrolled by another controller)
+  int pages = getIndexTablePageCount();
+  for (int page=0; page<pages; page++) {
+    uint8_t returnCode = readIndexTablePage(page);
+    if (returnCode != FINGERPRINT_OK) {
+      notifyClients(String("Export of fingerprints failed: reading the index table of the sensor failed (") + returnCode + ").");
+      return;
+    }
+  }
+
+  File file = LittleFS.open(getSensorDbFileName().c_str(), "w");
+  if (!file) {
+    notifyClients("Export of fingerprints failed: file could not be created.");
+    return;
+  }
+  notifyClients("Export of fingerprints started, scanning is paused meanwhile...");
+
+  unsigned long startMillis = millis();
+  uint32_t bytesTransferred = 0;
+  int templateCount = 0;
+  bool ok = true;
+  uint8_t buffer[256]; // max. packet length of sensor
+
+  file.write((const uint8_t*)"FPDB", 4);
+  file.write(sensorDbVersion);
+
+  uint16_t slots = pages * indexTablePageSize * 8;
+  for (uint16_t id=0; id<slots && id<=finger.capacity && ok; id++) {
+    if (!isSlotOccupied(id))
+      continue;
+    if (finger.loadModel(id) != FINGERPRINT_OK || finger.getModel() != FINGERPRINT_OK) {
+      notifyClients(String("Export: upload of template #") + id + " failed.");
+      ok = false;
+      break;
+    }
+
+    const char *name = fingerNames.find(id);
+    if (name == NULL)
+      name = ""; // import names it "#<id>"
+    size_t nameLength = strlen(name); // table limits names to 255 characters
+    file.write((uint8_t)(id & 0xFF));
+    file.write((uint8_t)(id >> 8));
+    file.write((uint8_t)nameLength);
+    file.write((const uint8_t*)name, nameLength);
+
+    // sensor sends data packets until the end packet, write each of them as one chunk
+    uint8_t type = FINGERPRINT_DATAPACKET;
+    while (type != FINGERPRINT_ENDDATAPACKET) {
+      int length = readRawPacket(type, buffer, sizeof(buffer));
+      if (length < 0 || (type != FINGERPRINT_DATAPACKET && type != FINGERPRINT_ENDDATAPACKET)) {
+        notifyClients(String("Export: communication error while reading template #") + id + ".");
+        ok = false;
+        break;
+      }
+      file.write((uint8_t)(length & 0xFF));
+      file.write((uint8_t)(length >> 8));
+      file.write(buffer, length);
+      bytesTransferred += length;
+    }
+    file.write((uint8_t)0); // end of template
+    file.write((uint8_t)0);
+    templateCount++;
+  }
+  file.close();
+
+  unsigned long duration = millis() - startMillis;
+  if (ok)
+    notifyClients(String("Export of ") + templateCount + " fingerprints finished (" + bytesTransferred + " bytes in " + duration + " ms, "
+      + (duration > 0 ? bytesTransferred / duration : 0) + " kB/s).");
+  else
+    LittleFS.remove(getSensorDbFileName().c_str());
 }
-    
-void FingerprintManager::importSensorDB() {
 
+
+/* sensor replacement: restore templates and names from the exported file. If resume is true, templates imported by an interrupted import are skipped. */
+/* walks the records of an export after the file header, returns the first id this sensor can't store, -1 if the file is damaged, 0 if all are valid */
+int FingerprintManager::findInvalidSensorDbId(fs::File &file) {
+  size_t start = file.position();
+  int result = 0;
+  uint8_t recordHeader[3];
+  while (result == 0 && file.read(recordHeader, sizeof(recordHeader)) == sizeof(recordHeader)) {
+    uint16_t id = recordHeader[0] | ((uint16_t)recordHeader[1] << 8);
+    if (!isValidId(id)) {
+      result = id;
+      break;
+    }
+    if (!file.seek(recordHeader[2], SeekCur)) { // name
+      result = -1;
+      break;
+    }
+    uint8_t chunkHeader[2];
+    do {
+      if (file.read(chunkHeader, 2) != 2 || !file.seek(chunkHeader[0] | ((uint16_t)chunkHeader[1] << 8), SeekCur)) {
+        result = -1;
+        break;
+      }
+    } while (chunkHeader[0] != 0 || chunkHeader[1] != 0);
+  }
+  file.seek(start, SeekSet);
+  return result;
+}
+
+void FingerprintManager::importSensorDB(bool resume) {
+  if (!isSensorTask()) {
+    SensorCommand *command = new SensorCommand();
+    command->type = SensorCommandType::importSensorDB;
+    command->resume = resume;
+    queueCommand(command);
+    return;
+  }
+
+  File file = LittleFS.open(getSensorDbFileName().c_str(), "r");
+  uint8_t fileHeader[5];
+  if (!file || file.read(fileHeader, sizeof(fileHeader)) != sizeof(fileHeader) || memcmp(fileHeader, "FPDB", 4) != 0 || fileHeader[4] != sensorDbVersion) {
+    notifyClients("Import of fingerprints failed: no valid export found.");
+    return;
+  }
+
+  // an export of a larger sensor must not leave a half imported database, so all ids are checked before anything is written
+  int invalidId = findInvalidSensorDbId(file);
+  if (invalidId != 0) {
+    if (invalidId < 0)
+      notifyClients("Import of fingerprints failed: export file is damaged.");
+    else
+      notifyClients(String("Import of fingerprints failed: the export contains #") + invalidId + ", but this sensor stores only "
+        + finger.capacity + " fingerprints.");
+    file.close();
+    return;
+  }
+
+  Preferences preferences;
+  preferences.begin(getPrefsNamespace("sensorDB").c_str(), false);
+  uint16_t importedId = resume ? preferences.getUShort("importedId", 0) : 0; // last id that was completely imported
+  if (!resume)
+    preferences.remove("importedId");
+  notifyClients(String("Import of fingerprints started") + (importedId > 0 ? String(" (resuming after #") + importedId + ")" : "") + ", scanning is paused meanwhile...");
+
+  unsigned long startMillis = millis();
+  uint32_t bytesTransferred = 0;
+  int templateCount = 0;
+  bool ok = true;
+  uint16_t packetLength = finger.packet_len;
+  if (packetLength == 0 || packetLength > 256)
+    packetLength = 128;
+  uint8_t buffer[256];
+
+  uint8_t recordHeader[3];
+  while (ok && file.read(recordHeader, sizeof(recordHeader)) == sizeof(recordHeader)) {
+    uint16_t id = recordHeader[0] | ((uint16_t)recordHeader[1] << 8);
+    char name[256];
+    if (file.read((uint8_t*)name, recordHeader[2]) != recordHeader[2]) {
+      ok = false;
+      break;
+    }
+    name[recordHeader[2]] = 0;
+
+    uint8_t chunkHeader[2];
+    uint16_t chunkRemaining = 0;
+    if (file.read(chunkHeader, 2) != 2) {
+      ok = false;
+      break;
+    }
+    chunkRemaining = chunkHeader[0] | ((uint16_t)chunkHeader[1] << 8);
+
+    if (id <= importedId) { // imported before interruption
+      while (chunkRemaining > 0) {
+        file.seek(chunkRemaining, SeekCur);
+        if (file.read(chunkHeader, 2) != 2) {
+          ok = false;
+          break;
+        }
+        chunkRemaining = chunkHeader[0] | ((uint16_t)chunkHeader[1] << 8);
+      }
+      continue;
+    }
+
+    // tell the sensor to receive a template into char buffer 1
+    uint8_t data[2] = { FINGERPRINT_DOWNCHAR, 0x01 };
+    Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+    finger.writeStructuredPacket(packet);
+    if (finger.getStructuredPacket(&packet) != FINGERPRINT_OK || packet.type != FINGERPRINT_ACKPACKET || packet.data[0] != FINGERPRINT_OK) {
+      notifyClients(String("Import: sensor refused template #") + id + ".");
+      ok = false;
+      break;
+    }
+
+    // re-chunk the stored data to the packet length of this sensor, the last packet is sent as end packet
+    bool lastPacket = (chunkRemaining == 0);
+    while (!lastPacket) {
+      uint16_t length = 0;
+      while (length < packetLength && chunkRemaining > 0) {
+        uint16_t n = min((uint16_t)(packetLength - length), chunkRemaining);
+        if (file.read(buffer + length, n) != n) {
+          ok = false;
+          break;
+        }
+        length += n;
+        chunkRemaining -= n;
+        if (chunkRemaining == 0) {
+          if (file.read(chunkHeader, 2) != 2) {
+            ok = false;
+            break;
+          }
+          chunkRemaining = chunkHeader[0] | ((uint16_t)chunkHeader[1] << 8);
+        }
+      }
+      if (!ok)
+        break;
+      lastPacket = (chunkRemaining == 0);
+      writeRawPacket(lastPacket ? FINGERPRINT_ENDDATAPACKET : FINGERPRINT_DATAPACKET, buffer, length);
+      bytesTransferred += length;
+    }
+    if (!ok) {
+      notifyClients(String("Import: export file is damaged at template #") + id + ".");
+      break;
+    }
+
+    if (finger.storeModel(id) != FINGERPRINT_OK) {
+      notifyClients(String("Import: storing template #") + id + " failed.");
+      ok = false;
+      break;
+    }
+
+    String fingerName = String(name);
+    if (fingerName.isEmpty())
+      fingerName = String("#") + id; // template without name, keep it visible in the list
+    fingerNames.set(id, fingerName.c_str());
+    saveFingerListToPrefs(); // before importedId, so a resumed import has all names
+
+    preferences.putUShort("importedId", id);
+    templateCount++;
+  }
+  file.close();
+
+  unsigned long duration = millis() - startMillis;
+  if (ok) {
+    preferences.remove("importedId");
+    notifyClients(String("Import of ") + templateCount + " fingerprints finished (" + bytesTransferred + " bytes in " + duration + " ms, "
+      + (duration > 0 ? bytesTransferred / duration : 0) + " kB/s).");
+  } else {
+    notifyClients(String("Import of fingerprints interrupted after ") + templateCount + " fingerprints. Use 'Resume import' to continue.");
+  }
+  preferences.end();
 }
 
 void FingerprintManager::setColorSettings(ColorSettings colorSettings) {
@@ -3,23 +3,38 @@
 
 #include <Adafruit_Fingerprint.h>
 #include <Preferences.h>
+#include <FS.h>
+#include <functional>
+#include <atomic>
+#include "esp_pm.h"
 #include "global.h"
 #include "SettingsManager.h"
-
-#define mySerial Serial2
+#include "ScanMetrics.h"
+#include "PowerManager.h"
+#include "FingerNameTable.h"
+#include "JsonWriter.h"
 
 #define FINGERPRINT_WRITENOTEPAD 0x18 // Write Notepad on sensor
 #define FINGERPRINT_READNOTEPAD 0x19 // Read Notepad from sensor
+#define FINGERPRINT_DOWNCHAR 0x09 // Download template from host to char buffer
+#define FINGERPRINT_READINDEXTABLE 0x1F // Read slot occupancy bitmap, one page of 32 bytes covers 256 slots
 
 
 /*
   By using the touch ring as an additional input to the image sensor the sensitivity is much higher for door bell ring events. Unfortunately
   we cannot differ between touches on the ring by fingers or rain drops, so rain on the ring will cause false alarms.
 */
-const int touchRingPin = 5;     // touch/wakeup pin connected to fingerprint sensor
+const int defaultTouchRingPin = 5;     // touch/wakeup pin connected to fingerprint sensor
+
+/*
+  interrupt: a falling edge on the touchRingPin wakes the scan task, no UART traffic while nobody touches the sensor
+  polling:   scan continuously like in earlier versions (for sensors without a wired touch/wakeup line)
+*/
+enum class TouchWakeup { interrupt, polling };
 
 enum class ScanResult { noFinger, matchFound, noMatchFound, error };
 enum class EnrollResult { ok, error };
+enum class FingerUpdateResult { ok, notEnrolled, sensorError, saveFailed, busy }; // of deleteFinger() and renameFinger()
 
 struct Match {
   ScanResult scanResult = ScanResult::noFinger;
@@ -27,6 +42,29 @@ struct Match {
   String matchName = "unknown";
   uint16_t matchConfidence = 0;
   uint8_t returnCode = 0;
+  int64_t touchMicros = 0; // time of touch ring edge (or scan start), for end-to-end latency
+  String pairingCode; // read from the sensor right after a match, so loop() checks the pairing without a sensor round trip. Empty on error
+};
+
+struct SearchStats {
+  uint32_t hotHits = 0;      // matches found by searching the recently matched fingers only
+  uint32_t hotMisses = 0;    // searches of the recently matched fingers without match
+  uint32_t fullSearches = 0; // searches of the whole library (after a miss in recently matched fingers)
+  int64_t hotHitMicros = 0;
+  int64_t hotMissMicros = 0; // time spent in searches of the recently matched fingers that missed
+  int64_t fullSearchMicros = 0;
+};
+
+/* parameters of a LEDcontrol command, to skip commands that would not change the current state of the ring */
+struct LedCommand {
+  uint8_t control = 0;
+  uint8_t speed = 0;
+  uint8_t coloridx = 0;
+  uint8_t count = 0;
+
+  bool operator==(const LedCommand &other) const {
+    return control == other.control && speed == other.speed && coloridx == other.coloridx && count == other.count;
+  }
 };
 
 struct NewFinger {
@@ -34,39 +72,213 @@ struct NewFinger {
   uint8_t returnCode = 0;
 };
 
+enum class EnrollStep { idle, waitForFinger, waitForRelease, storeModel };
+enum class EnrollStatus { waitForFinger, sampleTaken, liftFinger, done, failed, timeout, cancelled };
+
+struct EnrollProgress {
+  int id = 0;
+  int sample = 0;  // current sample (1..samples)
+  int samples = 0;
+  EnrollStatus status = EnrollStatus::waitForFinger;
+  uint8_t returnCode = 0;
+};
+
+/* differences between the slots occupied on the sensor (index table) and the finger names we know */
+enum class ReconcileState { idle, running, done, failed };
+
+struct ReconcileReport {
+  ReconcileState state = ReconcileState::idle;
+  uint16_t templateCount = 0;   // occupied slots on sensor
+  std::vector<uint16_t> unnamed; // template on sensor, but no name
+  std::vector<uint16_t> ghosts;  // name, but no template on sensor
+  bool repaired = false;
+  uint8_t returnCode = 0;
+  unsigned long durationMillis = 0;
+};
+
+/*
+  All sensor access is serialized through the sensor task. Public functions called from other tasks (e.g. webserver) are
+  queued as commands and executed by the sensor task between two scans. A caller waits at most commandStartTimeoutMs for
+  its command to start, so a long running job (export, import, benchmark) or a stuck sensor task makes the call fail
+  instead of blocking the web server. Long running jobs are queued asynchronously and report to the log.
+*/
+enum class SensorCommandType { enroll, cancelEnrollment, startReconciliation, getReconcileReport, deleteFinger, renameFinger, deleteAll, getFingerList, writeFingerList, writeFingerListAsHtmlOptions, setLedRing, getPairingCode, setPairingCode, benchmark, exportSensorDB, importSensorDB };
+enum class LedRingState { error, wifiConfig, ready };
+enum class CommandState { queued, running, cancelled };
+
+struct SensorCommand {
+  SensorCommandType type;
+  int id = 0;
+  String text;
+  LedRingState ledRingState = LedRingState::ready;
+  bool resume = false;
+  JsonWriter *json = NULL;
+  int limit = 0;
+  char *buffer = NULL;
+  size_t bufferSize = 0;
+  // results
+  bool result = false;
+  String resultText;
+  int count = 0;
+  int total = 0;
+  size_t length = 0;
+  FingerUpdateResult updateResult = FingerUpdateResult::ok;
+  NewFinger newFinger;
+  std::function<void(NewFinger)> onEnrollDone; // for async commands: called by sensor task when done, command is deleted afterwards
+  SemaphoreHandle_t done = NULL; // for sync commands: given by sensor task when done
+  CommandState state = CommandState::queued; // of sync commands, a command cancelled by its caller is deleted by the sensor task
+};
+
 class FingerprintManager {       
   private:
-    Adafruit_Fingerprint finger = Adafruit_Fingerprint(&mySerial);
+    HardwareSerial &sensorSerial; // UART the sensor is connected to
+    const int touchRingPin;
+    const int rxPin; // -1: default pins of the UART
+    const int txPin;
+    const String prefsSuffix; // appended to NVS namespaces and file names, empty for the first sensor
+    Adafruit_Fingerprint finger;
     bool lastTouchState = false;
-    String fingerList[201];
+    FingerNameTable fingerNames; // sensor task only
+    std::atomic<int> fingerCount{0}; // copies of the state of fingerNames for the other tasks
+    std::atomic<uint32_t> fingerListGeneration{0};
     int fingerCountOnSensor = 0;
+    uint32_t baudRate = 57600;
+    uint8_t reply[64]; // payload of the last acknowledge packet received by sendCommand()
+    uint16_t replyLength = 0;
+    static const int hotFingerCount = 5;
+    uint16_t hotFingers[hotFingerCount] = { 0 }; // recently matched finger ids, most recent first, 0 = unused
+    SearchStats searchStats;
+    ScanMetrics metrics;
+    LedCommand ledState; // last command sent to the ring
+    bool ledStateKnown = false; // false after (re)connect or a failed command, next command is always sent
+    LedCommand deferredLed;
+    bool deferredLedPending = false;
+    EnrollStep enrollStep = EnrollStep::idle;
+    unsigned long enrollStepStartMillis = 0;
+    EnrollProgress enrollment;
+    String enrollName;
+    std::function<void(NewFinger)> enrollDone;
+    std::function<void(const EnrollProgress&)> enrollProgress;
     bool ignoreTouchRing = false; // set to true when the sensor is usually exposed to rain to avoid false ring events. Can also be set conditional by a rain sensor over MQTT
     bool lastIgnoreTouchRing = false;
+    TouchWakeup touchWakeup = TouchWakeup::polling;
+    TaskHandle_t sensorTask = NULL;
+    QueueHandle_t commandQueue = NULL;
+    portMUX_TYPE commandMux = portMUX_INITIALIZER_UNLOCKED; // state of the queued sync commands
+    static const uint32_t commandStartTimeoutMs = 2000; // longer than a scan
+    QueueHandle_t matchQueue = NULL; // scan results for loop()
+    ScanResult lastQueuedResult = ScanResult::noFinger;
+    TaskHandle_t matchListener = NULL; // notified when a new scan result was queued
+    volatile bool touchEdgePending = false; // set by ISR, so even very short touches are not missed
+    volatile bool touchWakeupPending = false; // set by ISR, cleared when the sensor task woke up for scanning
+    volatile int64_t touchDetectedMicros = 0; // set by ISR on every touch ring edge
+    bool lightSleepWakeup = false; // touch ring is armed as (level triggered) wakeup source from light sleep
+    volatile bool touchWakeupArmed = false; // cleared by ISR, re-armed by sensor task when the ring was released
+    esp_pm_lock_handle_t noSleepLock = NULL; // held by the sensor task while talking to the sensor (UART does not receive in light sleep)
+    bool noSleepLockHeld = false;
+    PowerManager *powerManager = NULL;
+    volatile bool scanPowerLockHeld = false; // CPU at max. frequency from touch (or scan start) until the result was published
+    portMUX_TYPE scanPowerLockMux = portMUX_INITIALIZER_UNLOCKED;
+    int64_t lastTouchLatencyMicros = -1;
+    unsigned long scanActiveUntilMillis = 0; // keep on scanning after a touch edge (finger is often placed after the ring was touched)
+    unsigned long holdOffUntilMillis = 0; // no scans until then to let the LED ring show the result
+    static const int indexTablePageSize = 32; // bytes
+    static const int maxIndexTablePages = 12; // 3000 slots
+    uint8_t indexTable[maxIndexTablePages * indexTablePageSize];
+    int reconcilePage = -1; // next index table page to read, -1 = no reconciliation running
+    bool reconcileRepair = false;
+    unsigned long reconcileStartMillis = 0;
+    ReconcileReport reconcileReport;
     
-    void updateTouchState(bool touched);
+    static void IRAM_ATTR onTouchRingInterrupt(void *arg);
+    static void sensorTaskMain(void *arg);
+    bool waitForTouch(uint32_t timeoutMs);
+    void armTouchWakeup();
+    void allowLightSleep(bool allow);
+    void acquireScanPowerLock();
+    void scanAndQueueMatch();
+    bool isSensorTask();
+    void queueCommand(SensorCommand *command);
+    bool runOnSensorTask(SensorCommand &command);
+    void processCommands();
+    void executeCommand(SensorCommand &command);
+    void updateTouchState(bool touched, bool deferLed = false);
+    void enrollTick();
+    void setEnrollStep(EnrollStep step);
+    void reportEnrollProgress(EnrollStatus status, uint8_t returnCode);
+    void finishEnrollment(NewFinger newFinger, EnrollStatus status);
+    uint8_t ledControl(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count = 0);
+    void deferLedControl(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count = 0);
+    void flushLedControl();
     bool isRingTouched();
     void loadFingerListFromPrefs();
+    bool saveFingerListToPrefs();
+    void publishFingerListState();
+    bool isValidId(int id);
+    int findInvalidSensorDbId(fs::File &file);
+    void reconcileTick();
+    int getIndexTablePageCount();
+    uint8_t readIndexTablePage(int page);
+    bool isSlotOccupied(uint16_t id);
+    uint8_t readSlotOccupied(uint16_t id, bool &occupied);
+    void diffIndexTable(int pages);
+    uint8_t searchFingerprint();
+    uint8_t searchRange(uint16_t startId, uint16_t count);
+    void setHotFinger(uint16_t id);
+    void removeHotFinger(uint16_t id);
+    uint32_t findSensorBaudRate(uint32_t preferredBaudRate);
+    void setSerialBaudRate(uint32_t rate);
+    bool switchBaudRate(uint32_t newBaudRate);
     void disconnect();
     uint8_t writeNotepad(uint8_t pageNumber, const char *text, uint8_t length);
     uint8_t readNotepad(uint8_t pageNumber, char *text, uint8_t length);
+    void writeRawPacket(uint8_t type, const uint8_t *data, uint16_t length);
+    int readRawPacket(uint8_t &type, uint8_t *buffer, uint16_t bufferSize, uint32_t timeoutMs = 1000);
+    uint8_t sendCommand(const uint8_t *data, uint16_t length, uint32_t timeoutMs);
+    uint8_t getImage();
+    uint8_t image2Tz(uint8_t slot);
     
     ColorSettings colorSettings;
 
   public:
+    FingerprintManager(HardwareSerial &sensorSerial = Serial2, int touchRingPin = defaultTouchRingPin, int rxPin = -1, int txPin = -1, const String &prefsSuffix = "");
+
     bool connected;
     bool connect();
     Match scanFingerprint();
-    NewFinger enrollFinger(int id, String name);
-    void deleteFinger(int id);
-    void renameFinger(int id, String newName);
+    FingerUpdateResult deleteFinger(int id);
+    FingerUpdateResult renameFinger(int id, String newName); // only fingers with a template on the sensor
     String getFingerListAsHtmlOptionList();
+    uint32_t getFingerListGeneration();
+    int writeFingerList(JsonWriter &json, int offset, int limit, int &total); // -1 if the sensor task is busy
+    int writeFingerListAsHtmlOptions(char *buffer, size_t size, int offset, size_t &length); // -1 if the sensor task is busy
+    int getFingerCount();
+    uint16_t getCapacity();
+    void startReconciliation(bool repair);
+    String getReconcileReport(); // empty if the sensor task is busy
     void setIgnoreTouchRing(bool state);
+    void startSensorTask(TouchWakeup mode);
+    bool getNextMatch(Match &match);
+    bool enableLightSleepWakeup();
+    void setPowerManager(PowerManager *powerManager);
+    void releaseScanPowerLock();
+    void setMatchListener(TaskHandle_t task);
+    String getPrefsNamespace(const char *name);
+    String getSensorDbFileName();
+    void startEnrollment(int id, String name, std::function<void(NewFinger)> onDone);
+    void cancelEnrollment();
+    bool isEnrolling();
+    void setEnrollProgressCallback(std::function<void(const EnrollProgress&)> onProgress);
+    int64_t getTouchLatencyMicros();
+    String getSearchStats();
+    ScanMetrics& getMetrics();
     bool isFingerOnSensor();
     void setLedRingError();
     void setLedRingWifiConfig();
     void setLedRingReady();
     String getPairingCode();
     bool setPairingCode(String pairingCode);
+    void benchmarkBaudRates(); // runs in background, the report is sent to the log
     
     void setColorSettings(ColorSettings colorSettings);
     bool deleteAll();
@@ -74,7 +286,7 @@ class FingerprintManager {
     
     // functions for sensor replacement
     void exportSensorDB();
-    void importSensorDB();
+    void importSensorDB(bool resume);
 
 };
 
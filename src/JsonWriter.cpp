@@ -0,0 +1,162 @@
+#include "JsonWriter.h"
+
+JsonWriter::JsonWriter(char *buffer, size_t size) : buffer(buffer), size(size) {
+  first[0] = true;
+  buffer[0] = 0;
+}
+
+void JsonWriter::append(char c) {
+  append(&c, 1);
+}
+
+void JsonWriter::append(const char *text, size_t textLength) {
+  if (overflow || length + textLength + reserved >= size) { // keep one byte for the null termination
+    overflow = true;
+    return;
+  }
+  memcpy(buffer + length, text, textLength);
+  length += textLength;
+  buffer[length] = 0;
+}
+
+/* comma before every value except the first of an object/array and values following their key */
+void JsonWriter::separate() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (!first[depth])
+    append(',');
+  first[depth] = false;
+}
+
+void JsonWriter::beginObject() {
+  separate();
+  append('{');
+  if (depth < maxDepth)
+    depth++;
+  first[depth] = true;
+}
+
+void JsonWriter::endObject() {
+  if (depth > 0)
+    depth--;
+  append('}');
+}
+
+void JsonWriter::beginArray() {
+  separate();
+  append('[');
+  if (depth < maxDepth)
+    depth++;
+  first[depth] = true;
+}
+
+void JsonWriter::endArray() {
+  if (depth > 0)
+    depth--;
+  append(']');
+}
+
+void JsonWriter::key(const char *name) {
+  value(name);
+  append(':');
+  afterKey = true;
+}
+
+void JsonWriter::value(const char *text) {
+  value(text, strlen(text));
+}
+
+void JsonWriter::value(const String &text) {
+  value(text.c_str(), text.length());
+}
+
+void JsonWriter::value(const char *text, size_t textLength) {
+  separate();
+  append('"');
+  size_t start = 0; // unescaped characters are copied in runs
+  for (size_t i=0; i<textLength; i++) {
+    unsigned char c = text[i];
+    if (c != '"' && c != '\\' && c >= 0x20)
+      continue;
+    append(text + start, i - start);
+    start = i + 1;
+    if (c == '"' || c == '\\') {
+      append('\\');
+      append(c);
+    } else if (c == '\n') {
+      append("\\n", 2);
+    } else {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      append(escaped, 6);
+    }
+  }
+  append(text + start, textLength - start);
+  append('"');
+}
+
+void JsonWriter::value(int number) {
+  value((long)number);
+}
+
+void JsonWriter::value(unsigned int number) {
+  value((unsigned long)number);
+}
+
+void JsonWriter::value(long number) {
+  char text[24];
+  separate();
+  append(text, snprintf(text, sizeof(text), "%ld", number));
+}
+
+void JsonWriter::value(unsigned long number) {
+  char text[24];
+  separate();
+  append(text, snprintf(text, sizeof(text), "%lu", number));
+}
+
+void JsonWriter::value(bool state) {
+  separate();
+  if (state)
+    append("true", 4);
+  else
+    append("false", 5);
+}
+
+void JsonWriter::valueNull() {
+  separate();
+  append("null", 4);
+}
+
+size_t JsonWriter::mark() {
+  return length;
+}
+
+/* drop everything written after the mark (the writer must be at the same nesting level as when the mark was taken) */
+void JsonWriter::rollback(size_t position) {
+  if (position > length)
+    return;
+  length = position;
+  buffer[length] = 0;
+  overflow = false;
+  afterKey = false;
+  first[depth] = (length > 0 && (buffer[length - 1] == '[' || buffer[length - 1] == '{'));
+}
+
+void JsonWriter::reserve(size_t bytes) {
+  reserved = bytes;
+}
+
+bool JsonWriter::hasOverflow() {
+  return overflow;
+}
+
+const char* JsonWriter::getData() {
+  return buffer;
+}
+
+size_t JsonWriter::getLength() {
+  return length;
+}
@@ -0,0 +1,53 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <Arduino.h>
+
+/*
+  Writes JSON directly into a fixed buffer, no String is created. Commas between values are inserted automatically.
+  When the buffer is full further output is dropped and hasOverflow() returns true; callers that add a variable number of
+  items take a mark() before each item and rollback() to it on overflow, with the space for what follows the items reserve()d.
+*/
+class JsonWriter {
+  public:
+    JsonWriter(char *buffer, size_t size);
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char *name); // followed by the value
+    void value(const char *text);
+    void value(const char *text, size_t length);
+    void value(const String &text);
+    void value(int number);
+    void value(unsigned int number);
+    void value(long number);
+    void value(unsigned long number);
+    void value(bool state);
+    void valueNull();
+
+    size_t mark();
+    void rollback(size_t position);
+    void reserve(size_t bytes); // keeps bytes free for the closing part of a list, reserve(0) releases them
+    bool hasOverflow();
+    const char* getData(); // null terminated
+    size_t getLength();
+
+  private:
+    static const int maxDepth = 8;
+    char *buffer;
+    size_t size;
+    size_t length = 0;
+    size_t reserved = 0;
+    bool overflow = false;
+    int depth = 0;
+    bool first[maxDepth + 1]; // no value written yet at this level
+    bool afterKey = false;
+
+    void separate();
+    void append(char c);
+    void append(const char *text, size_t textLength);
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "LogBuffer.h"
+
+const time_t minValidTime = 1451606400; // 2016-01-01, earlier times mean the clock was not set by NTP yet
+
+LogBuffer::LogBuffer(Entry *slots, int capacity) : slots(slots), capacity(capacity) {
+}
+
+uint32_t LogBuffer::append(const char *text) {
+  time_t now = time(nullptr);
+  if (now < minValidTime)
+    now = 0;
+  portENTER_CRITICAL(&lock);
+  uint32_t seq = ++latestSeq;
+  Entry &entry = slots[seq % capacity];
+  entry.seq = seq;
+  entry.time = now;
+  strncpy(entry.text, text, textSize - 1); // bounded copy, the lock is held
+  entry.text[textSize - 1] = 0;
+  portEXIT_CRITICAL(&lock);
+  return seq;
+}
+
+bool LogBuffer::read(uint32_t seq, Entry &entry) {
+  bool found = false;
+  portENTER_CRITICAL(&lock);
+  const Entry &slot = slots[seq % capacity];
+  if (seq != 0 && slot.seq == seq) {
+    entry = slot;
+    found = true;
+  }
+  portEXIT_CRITICAL(&lock);
+  return found;
+}
+
+uint32_t LogBuffer::getLatestSeq() {
+  portENTER_CRITICAL(&lock);
+  uint32_t seq = latestSeq;
+  portEXIT_CRITICAL(&lock);
+  return seq;
+}
+
+uint32_t LogBuffer::getOldestSeq() {
+  uint32_t latest = getLatestSeq();
+  return (latest < (uint32_t)capacity) ? 1 : latest - capacity + 1;
+}
+
+int LogBuffer::getCapacity() {
+  return capacity;
+}
+
+String LogBuffer::format(const Entry &entry) {
+  return "[" + formatTime(entry.time) + "]: " + entry.text;
+}
+
+String LogBuffer::formatTime(time_t time) {
+  if (time == 0)
+    return "no time";
+  struct tm timeinfo;
+  localtime_r(&time, &timeinfo);
+  char buffer[32];
+  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S %Z", &timeinfo);
+  return String(buffer);
+}
@@ -0,0 +1,39 @@
+#ifndef LOGBUFFER_H
+#define LOGBUFFER_H
+
+#include <Arduino.h>
+#include <time.h>
+
+/*
+  Log messages in a ring of fixed size slots, allocated once: appending is O(1) without heap allocation, when full the
+  oldest message is overwritten. Messages are numbered by a sequence number starting at 1 and are read by it, so every
+  reader (web page, SSE clients, MQTT, JSON API) keeps its own position. Timestamps are stored binary and only
+  formatted when read. Safe to use from any task.
+*/
+class LogBuffer {
+  public:
+    static const int textSize = 256; // incl. terminating 0, longer messages are truncated
+
+    struct Entry {
+      uint32_t seq;
+      time_t time; // 0 if the time was not known yet (no NTP sync)
+      char text[textSize];
+    };
+
+    LogBuffer(Entry *slots, int capacity);
+    uint32_t append(const char *text); // returns the sequence number of the new message
+    bool read(uint32_t seq, Entry &entry); // false if seq was not written yet or is overwritten already
+    uint32_t getLatestSeq(); // 0 if empty
+    uint32_t getOldestSeq(); // oldest message still in the buffer, getLatestSeq()+1 if empty
+    int getCapacity();
+    String format(const Entry &entry); // "[2024-01-31 21:05:10 CET]: text"
+    static String formatTime(time_t time);
+
+  private:
+    Entry *slots;
+    int capacity;
+    uint32_t latestSeq = 0;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "PowerManager.h"
+#include <WiFi.h>
+#include "esp_pm.h"
+#include "esp_wifi.h"
+
+const int maxCpuFreqMhz = 240;
+const int minCpuFreqMhz = 80;
+
+/*
+  Rough current consumption of the ESP32 (datasheet values, WiFi associated), only used to estimate the average
+  consumption in the report. Measure your own board if you have to size a supply.
+*/
+const float fullPowerMilliAmps = 68.0;   // 240 MHz, modem sleep
+const float awakeMilliAmps = 30.0;       // 80 MHz, modem sleep
+const float lightSleepMilliAmps = 3.0;   // light sleep incl. beacon wakeups (DTIM1)
+
+const uint32_t wakeToImageBudgetMicros = 50000; // a ring must not feel slower than without idle mode
+
+/* returns the mode that was actually configured, builds without tickless idle fall back to frequency scaling only */
+PowerMode PowerManager::begin(bool lightSleep) {
+  startMicros = esp_timer_get_time();
+  idleMicros = 0;
+
+  // modem sleep is required for light sleep while WiFi is associated
+  esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+
+  esp_pm_config_esp32_t pmConfig;
+  pmConfig.max_freq_mhz = maxCpuFreqMhz;
+  pmConfig.min_freq_mhz = minCpuFreqMhz;
+  pmConfig.light_sleep_enable = lightSleep;
+  esp_err_t err = esp_pm_configure(&pmConfig);
+  if (err == ESP_OK) {
+    mode = lightSleep ? PowerMode::lightSleep : PowerMode::frequencyScaling;
+  } else {
+    if (lightSleep)
+      Serial.println(String("Automatic light sleep not supported by this build (") + esp_err_to_name(err) + "), trying frequency scaling only");
+    pmConfig.light_sleep_enable = false;
+    err = esp_pm_configure(&pmConfig);
+    if (err == ESP_OK) {
+      mode = PowerMode::frequencyScaling;
+    } else {
+      Serial.println(String("Power management not supported by this build (") + esp_err_to_name(err) + ")");
+      mode = PowerMode::full;
+    }
+  }
+  if (mode != PowerMode::full && esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "active", &cpuMaxLock) != ESP_OK)
+    cpuMaxLock = NULL;
+  Serial.println(String("Power mode: ") + getModeName(mode));
+  return mode;
+}
+
+/* run at maximum frequency until releaseCpuMax(), calls are counted */
+void PowerManager::acquireCpuMax() {
+  if (cpuMaxLock == NULL)
+    return;
+  portENTER_CRITICAL(&lock);
+  if (cpuMaxCount++ == 0)
+    cpuMaxSinceMicros = esp_timer_get_time();
+  cpuMaxAcquisitions++;
+  portEXIT_CRITICAL(&lock);
+  esp_pm_lock_acquire(cpuMaxLock);
+}
+
+void IRAM_ATTR PowerManager::acquireCpuMaxFromISR() {
+  if (cpuMaxLock == NULL)
+    return;
+  portENTER_CRITICAL_ISR(&lock);
+  if (cpuMaxCount++ == 0)
+    cpuMaxSinceMicros = esp_timer_get_time();
+  cpuMaxAcquisitions++;
+  portEXIT_CRITICAL_ISR(&lock);
+  esp_pm_lock_acquire(cpuMaxLock); // ISR safe
+}
+
+void PowerManager::releaseCpuMax() {
+  if (cpuMaxLock == NULL)
+    return;
+  portENTER_CRITICAL(&lock);
+  bool held = (cpuMaxCount > 0); // ignore releases of sessions opened before the lock was created
+  if (held && --cpuMaxCount == 0)
+    cpuMaxMicros += esp_timer_get_time() - cpuMaxSinceMicros;
+  portEXIT_CRITICAL(&lock);
+  if (held)
+    esp_pm_lock_release(cpuMaxLock);
+}
+
+PowerMode PowerManager::getMode() {
+  return mode;
+}
+
+void PowerManager::addIdleTime(int64_t micros) {
+  idleMicros += micros;
+}
+
+const char* PowerManager::getModeName(PowerMode mode) {
+  switch (mode)
+  {
+  case PowerMode::full: return "full";
+  case PowerMode::frequencyScaling: return "frequencyScaling";
+  case PowerMode::lightSleep: return "lightSleep";
+  }
+  return "unknown";
+}
+
+/*
+  Energy/latency budget as JSON. idleRatio is the share of time loop() was waiting for events, it's an upper bound for
+  the time spent in light sleep (webserver or sensor task may keep the CPU awake in the meantime). frequencyMillis counts the
+  time a CPU_FREQ_MAX lock was held, the rest was spent at minimum frequency (or in light sleep).
+*/
+String PowerManager::getReport(LatencyHistogram wakeToImage) {
+  int64_t now = esp_timer_get_time();
+  int64_t elapsed = now - startMicros;
+  float idleRatio = (elapsed > 0) ? (float)idleMicros / elapsed : 0.0;
+
+  portENTER_CRITICAL(&lock);
+  int64_t maxMicros = cpuMaxMicros + ((cpuMaxCount > 0) ? now - cpuMaxSinceMicros : 0);
+  uint32_t acquisitions = cpuMaxAcquisitions;
+  portEXIT_CRITICAL(&lock);
+  if (mode == PowerMode::full)
+    maxMicros = elapsed;
+
+  float maxRatio = (elapsed > 0) ? (float)maxMicros / elapsed : 1.0;
+  float estimatedMilliAmps = fullPowerMilliAmps;
+  if (mode == PowerMode::frequencyScaling) {
+    estimatedMilliAmps = maxRatio * fullPowerMilliAmps + (1.0 - maxRatio) * awakeMilliAmps;
+  } else if (mode == PowerMode::lightSleep) {
+    float sleepRatio = (idleRatio < 1.0 - maxRatio) ? idleRatio : 1.0 - maxRatio; // loop() may also wait while a scan holds the CPU awake
+    estimatedMilliAmps = maxRatio * fullPowerMilliAmps + (1.0 - maxRatio - sleepRatio) * awakeMilliAmps + sleepRatio * lightSleepMilliAmps;
+  }
+
+  uint32_t p95 = wakeToImage.percentile(95);
+  return String("{\"mode\":\"") + getModeName(mode) + "\""
+    + ",\"idleRatio\":" + String(idleRatio, 3)
+    + ",\"estimatedMilliAmps\":" + String(estimatedMilliAmps, 1)
+    + ",\"cpuMaxAcquisitions\":" + acquisitions
+    + ",\"frequencyMillis\":{\"" + maxCpuFreqMhz + "\":" + (long)(maxMicros / 1000) + ",\"" + minCpuFreqMhz + "\":" + (long)((elapsed - maxMicros) / 1000) + "}"
+    + ",\"wakeToImage\":{\"count\":" + wakeToImage.getCount()
+    + ",\"p50\":" + wakeToImage.percentile(50)
+    + ",\"p95\":" + p95
+    + ",\"max\":" + wakeToImage.getMax()
+    + ",\"budget\":" + wakeToImageBudgetMicros
+    + ",\"withinBudget\":" + ((p95 <= wakeToImageBudgetMicros) ? "true" : "false") + "}}";
+}
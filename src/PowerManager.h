@@ -0,0 +1,54 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+
+#include <Arduino.h>
+#include "esp_pm.h"
+#include "ScanMetrics.h"
+
+/*
+  Idle power mode: the CPU is clocked down and enters automatic light sleep whenever all tasks are blocked (FreeRTOS tickless
+  idle). WiFi stays associated by modem sleep, the radio only wakes up for the beacons of the access point.
+  Wakeup sources are the touch ring (GPIO, armed by FingerprintManager) and the next due FreeRTOS timeout (tickless idle
+  programs the sleep timer itself, so loop() and the sensor task keep their timing).
+  The CPU runs at minimum frequency while idle. From the first touch ring edge until the result was published (and while
+  web or OTA requests are served) a CPU_FREQ_MAX lock keeps it at maximum frequency.
+*/
+enum class PowerMode { full, frequencyScaling, lightSleep };
+
+class PowerManager {
+  private:
+    PowerMode mode = PowerMode::full;
+    int64_t startMicros = 0;
+    int64_t idleMicros = 0; // time loop() was waiting for events
+    esp_pm_lock_handle_t cpuMaxLock = NULL;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED; // lock counters are changed by ISR, sensor task, loop() and webserver
+    uint32_t cpuMaxCount = 0; // number of current holders
+    uint32_t cpuMaxAcquisitions = 0;
+    int64_t cpuMaxSinceMicros = 0;
+    int64_t cpuMaxMicros = 0; // total time at maximum frequency
+
+  public:
+    PowerMode begin(bool lightSleep);
+    PowerMode getMode();
+    void addIdleTime(int64_t micros);
+    void acquireCpuMax();
+    void IRAM_ATTR acquireCpuMaxFromISR();
+    void releaseCpuMax();
+    String getReport(LatencyHistogram wakeToImage);
+
+    static const char* getModeName(PowerMode mode);
+};
+
+/* holds the CPU_FREQ_MAX lock of powerManager while in scope, e.g. for the duration of a web request */
+class CpuMaxLock {
+  private:
+    PowerManager &powerManager;
+
+  public:
+    explicit CpuMaxLock(PowerManager &powerManager) : powerManager(powerManager) { powerManager.acquireCpuMax(); }
+    ~CpuMaxLock() { powerManager.releaseCpuMax(); }
+    CpuMaxLock(const CpuMaxLock&) = delete;
+    CpuMaxLock& operator=(const CpuMaxLock&) = delete;
+};
+
+#endif
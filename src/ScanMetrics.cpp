@@ -0,0 +1,140 @@
+#include "ScanMetrics.h"
+
+// roughly logarithmic steps from 100us to 5s, last bucket collects everything above
+const uint32_t LatencyHistogram::bucketLimits[LatencyHistogram::bucketCount] = {
+  100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000, 2000000, 5000000, UINT32_MAX
+};
+
+void LatencyHistogram::record(uint32_t micros) {
+  int bucket = 0;
+  while (micros > bucketLimits[bucket])
+    bucket++;
+  buckets[bucket]++;
+  count++;
+  if (micros > maxMicros)
+    maxMicros = micros;
+}
+
+/* upper bound of the bucket containing the given percentile, 0 if nothing was recorded */
+uint32_t LatencyHistogram::percentile(uint8_t percent) {
+  if (count == 0)
+    return 0;
+  uint32_t rank = (count * percent + 99) / 100; // rounded up, so p50 of a single value is that value
+  uint32_t sum = 0;
+  for (int i=0; i<bucketCount; i++) {
+    sum += buckets[i];
+    if (sum >= rank)
+      return (bucketLimits[i] < maxMicros) ? bucketLimits[i] : maxMicros;
+  }
+  return maxMicros;
+}
+
+uint32_t LatencyHistogram::getCount() {
+  return count;
+}
+
+uint32_t LatencyHistogram::getMax() {
+  return maxMicros;
+}
+
+
+void ScanMetrics::record(ScanStage stage, int64_t micros) {
+  if (micros < 0)
+    return;
+  portENTER_CRITICAL(&lock);
+  histograms[(int)stage].record((micros > UINT32_MAX) ? UINT32_MAX : (uint32_t)micros);
+  portEXIT_CRITICAL(&lock);
+}
+
+void ScanMetrics::countImagingRetry() {
+  portENTER_CRITICAL(&lock);
+  imagingRetries++;
+  portEXIT_CRITICAL(&lock);
+}
+
+void ScanMetrics::countScanRetry() {
+  portENTER_CRITICAL(&lock);
+  scanRetries++;
+  portEXIT_CRITICAL(&lock);
+}
+
+void ScanMetrics::countLedCommandSent() {
+  portENTER_CRITICAL(&lock);
+  ledCommandsSent++;
+  portEXIT_CRITICAL(&lock);
+}
+
+void ScanMetrics::countLedCommandSaved() {
+  portENTER_CRITICAL(&lock);
+  ledCommandsSaved++;
+  portEXIT_CRITICAL(&lock);
+}
+
+/* copy of a single histogram, taken under lock */
+LatencyHistogram ScanMetrics::getHistogram(ScanStage stage) {
+  portENTER_CRITICAL(&lock);
+  LatencyHistogram snapshot = histograms[(int)stage];
+  portEXIT_CRITICAL(&lock);
+  return snapshot;
+}
+
+void ScanMetrics::countSensorPacket() {
+  portENTER_CRITICAL(&lock);
+  sensorPackets++;
+  portEXIT_CRITICAL(&lock);
+}
+
+void ScanMetrics::countSensorTimeout() {
+  portENTER_CRITICAL(&lock);
+  sensorTimeouts++;
+  portEXIT_CRITICAL(&lock);
+}
+
+const char* ScanMetrics::getStageName(ScanStage stage) {
+  switch (stage)
+  {
+  case ScanStage::touchDetect: return "touchDetect";
+  case ScanStage::getImage: return "getImage";
+  case ScanStage::image2Tz: return "image2Tz";
+  case ScanStage::search: return "search";
+  case ScanStage::ledControl: return "ledControl";
+  case ScanStage::pairingCheck: return "pairingCheck";
+  case ScanStage::mqttPublish: return "mqttPublish";
+  case ScanStage::scan: return "scan";
+  case ScanStage::touchToPublish: return "touchToPublish";
+  }
+  return "unknown";
+}
+
+/* all values in microseconds */
+String ScanMetrics::toJson() {
+  // copy under lock, format without it (String operations may allocate)
+  portENTER_CRITICAL(&lock);
+  LatencyHistogram snapshot[scanStageCount];
+  for (int i=0; i<scanStageCount; i++)
+    snapshot[i] = histograms[i];
+  uint32_t imagingRetriesSnapshot = imagingRetries;
+  uint32_t scanRetriesSnapshot = scanRetries;
+  uint32_t ledCommandsSentSnapshot = ledCommandsSent;
+  uint32_t ledCommandsSavedSnapshot = ledCommandsSaved;
+  uint32_t sensorPacketsSnapshot = sensorPackets;
+  uint32_t sensorTimeoutsSnapshot = sensorTimeouts;
+  portEXIT_CRITICAL(&lock);
+
+  String json = "{\"stages\":{";
+  for (int i=0; i<scanStageCount; i++) {
+    if (i > 0)
+      json += ",";
+    json += String("\"") + getStageName((ScanStage)i) + "\":{\"count\":" + snapshot[i].getCount()
+      + ",\"p50\":" + snapshot[i].percentile(50)
+      + ",\"p95\":" + snapshot[i].percentile(95)
+      + ",\"p99\":" + snapshot[i].percentile(99)
+      + ",\"max\":" + snapshot[i].getMax() + "}";
+  }
+  uint32_t scans = snapshot[(int)ScanStage::scan].getCount();
+  json += String("},\"imagingRetries\":") + imagingRetriesSnapshot + ",\"scanRetries\":" + scanRetriesSnapshot
+    + ",\"ledCommandsSent\":" + ledCommandsSentSnapshot + ",\"ledCommandsSaved\":" + ledCommandsSavedSnapshot
+    + ",\"ledCommandsSavedPerScan\":" + String((scans > 0) ? (float)ledCommandsSavedSnapshot / scans : 0.0f, 2)
+    + ",\"sensorPackets\":" + sensorPacketsSnapshot + ",\"sensorTimeouts\":" + sensorTimeoutsSnapshot + "}";
+  return json;
+}
@@ -0,0 +1,54 @@
+#ifndef SCANMETRICS_H
+#define SCANMETRICS_H
+
+#include <Arduino.h>
+
+/*
+  Latency of every step between touching the sensor and publishing the result by MQTT.
+  Durations are sorted into fixed buckets, so recording is cheap and needs no heap.
+*/
+enum class ScanStage { touchDetect, getImage, image2Tz, search, ledControl, pairingCheck, mqttPublish, scan, touchToPublish };
+const int scanStageCount = 9;
+
+class LatencyHistogram {
+  public:
+    static const int bucketCount = 16;
+    static const uint32_t bucketLimits[bucketCount]; // upper bound of each bucket in microseconds
+
+    void record(uint32_t micros);
+    uint32_t percentile(uint8_t percent);
+    uint32_t getCount();
+    uint32_t getMax();
+
+  private:
+    uint32_t buckets[bucketCount] = { 0 };
+    uint32_t count = 0;
+    uint32_t maxMicros = 0;
+};
+
+class ScanMetrics {
+  public:
+    void record(ScanStage stage, int64_t micros);
+    void countImagingRetry();
+    void countScanRetry();
+    void countLedCommandSent();
+    void countLedCommandSaved();
+    void countSensorPacket();
+    void countSensorTimeout();
+    String toJson();
+    LatencyHistogram getHistogram(ScanStage stage);
+
+    static const char* getStageName(ScanStage stage);
+
+  private:
+    LatencyHistogram histograms[scanStageCount];
+    uint32_t imagingRetries = 0; // additional getImage passes because ring was touched but no finger on sensor yet
+    uint32_t scanRetries = 0;    // additional scans after "no match"
+    uint32_t ledCommandsSent = 0;
+    uint32_t ledCommandsSaved = 0; // LED commands dropped because the ring already was in that state or they were replaced before being sent
+    uint32_t sensorPackets = 0;  // command/acknowledge round trips by FingerprintManager::sendCommand()
+    uint32_t sensorTimeouts = 0; // ... without a valid acknowledge
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED; // recorded by sensor task and loop()
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "ScanPublisher.h"
+#include "global.h"
+
+String getSensorName(const Sensor& sensor) {
+  if (sensor.mqttSubTopic.isEmpty())
+    return "Sensor 1";
+  return sensor.mqttSubTopic.substring(1); // without leading "/"
+}
+
+
+ScanPublisher::ScanPublisher(Sensor *sensors, int sensorCount, SettingsManager &settingsManager, PubSubClient &mqttClient,
+  LogBuffer &logBuffer, volatile bool &mqttConnecting)
+  : sensors(sensors), sensorCount(sensorCount), settingsManager(settingsManager), mqttClient(mqttClient), logBuffer(logBuffer),
+    mqttConnecting(mqttConnecting) {
+}
+
+/* source of the JSON published as <mqttRootTopic>/stats every intervalMillis */
+void ScanPublisher::setStatsSource(std::function<String()> source, unsigned long intervalMillis) {
+  statsSource = source;
+  statsIntervalMillis = intervalMillis;
+}
+
+void ScanPublisher::setPairingStarter(std::function<bool(PairingJob)> starter) {
+  startPairing = starter;
+}
+
+/* all publishing of loop(), nothing is sent while the connect task owns mqttClient */
+bool ScanPublisher::publish(const String& topic, const char *payload) {
+  if (mqttConnecting)
+    return false;
+  return mqttClient.publish(topic.c_str(), payload);
+}
+
+
+/* one iteration, mqttConnected is the state loop() determined at its start */
+void ScanPublisher::loop(bool mqttConnected) {
+  for (int i=0; i<sensorCount; i++) {
+    Match match;
+    bool published = false;
+    while (sensors[i].manager.getNextMatch(match)) {
+      publishMatch(sensors[i], match);
+      published = true;
+    }
+    if (published)
+      sensors[i].manager.releaseScanPowerLock(); // back to min. CPU frequency
+    updateDoorbellOutput(sensors[i]);
+  }
+  if (mqttConnected)
+    publishStats();
+  publishLogMessages(mqttConnected);
+}
+
+
+void ScanPublisher::publishMatch(Sensor& sensor, const Match& match)
+{
+  String mqttRootTopic = settingsManager.getAppSettings().mqttRootTopic + sensor.mqttSubTopic;
+  String logPrefix = (sensorCount > 1) ? "[" + getSensorName(sensor) + "] " : "";
+  switch(match.scanResult)
+  {
+    case ScanResult::noFinger:
+      // standard case, occurs every iteration when no finger touchs the sensor
+      if (match.scanResult != sensor.lastMatch.scanResult) {
+        Serial.println("no finger");
+        publish(String(mqttRootTopic) + "/ring", "off");
+        publish(String(mqttRootTopic) + "/matchId", "-1");
+        publish(String(mqttRootTopic) + "/matchName", "");
+        publish(String(mqttRootTopic) + "/matchConfidence", "-1");
+      }
+      break;
+    case ScanResult::matchFound:
+      notifyClients(logPrefix + "Match Found: " + match.matchId + " - " + match.matchName  + " with confidence of " + match.matchConfidence );
+      if (match.scanResult != sensor.lastMatch.scanResult) {
+        if (isMatchPairingValid(match)) {
+          int64_t publishStart = esp_timer_get_time();
+          publish(String(mqttRootTopic) + "/ring", "off");
+          publish(String(mqttRootTopic) + "/matchId", String(match.matchId).c_str());
+          publish(String(mqttRootTopic) + "/matchName", match.matchName.c_str());
+          publish(String(mqttRootTopic) + "/matchConfidence", String(match.matchConfidence).c_str());
+          sensor.manager.getMetrics().record(ScanStage::mqttPublish, esp_timer_get_time() - publishStart);
+          sensor.manager.getMetrics().record(ScanStage::touchToPublish, esp_timer_get_time() - match.touchMicros);
+          Serial.println("MQTT message sent: Open the door!");
+        } else {
+          notifyClients("Security issue! Match was not sent by MQTT because of invalid sensor pairing! This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page.");
+        }
+      }
+      break;
+    case ScanResult::noMatchFound:
+      notifyClients(logPrefix + "No Match Found (Code " + match.returnCode + ")");
+      if (match.scanResult != sensor.lastMatch.scanResult) {
+        digitalWrite(sensor.doorbellOutputPin, HIGH);
+        sensor.doorbellOutputActive = true;
+        sensor.doorbellOnMillis = millis();
+        int64_t publishStart = esp_timer_get_time();
+        publish(String(mqttRootTopic) + "/ring", "on");
+        publish(String(mqttRootTopic) + "/matchId", "-1");
+        publish(String(mqttRootTopic) + "/matchName", "");
+        publish(String(mqttRootTopic) + "/matchConfidence", "-1");
+        sensor.manager.getMetrics().record(ScanStage::mqttPublish, esp_timer_get_time() - publishStart);
+        sensor.manager.getMetrics().record(ScanStage::touchToPublish, esp_timer_get_time() - match.touchMicros);
+        Serial.println("MQTT message sent: ring the bell!");
+      }
+      break;
+    case ScanResult::error:
+      notifyClients(logPrefix + "ScanResult Error (Code " + match.returnCode + ")");
+      break;
+  };
+  sensor.lastMatch = match;
+}
+
+
+/* compares the pairing code the sensor task read right after the match with the stored one */
+bool ScanPublisher::isMatchPairingValid(const Match& match) {
+  AppSettings settings = settingsManager.getAppSettings();
+  if (!settings.sensorPairingValid) {
+    if (settings.sensorPairingCode.isEmpty() && startPairing)
+      startPairing(PairingJob::pair); // automatic pairing at first boot failed, try again
+    return false;
+  }
+  if (match.pairingCode.equals(settings.sensorPairingCode))
+    return true;
+  if (!match.pairingCode.isEmpty() && startPairing)
+    startPairing(PairingJob::invalidate); // a different code won't change until repairing was done
+  return false;
+}
+
+
+/* switch doorbell output off again after the ring pulse */
+void ScanPublisher::updateDoorbellOutput(Sensor& sensor)
+{
+  if (sensor.doorbellOutputActive && (millis() - sensor.doorbellOnMillis >= 1000ul)) {
+    digitalWrite(sensor.doorbellOutputPin, LOW);
+    sensor.doorbellOutputActive = false;
+  }
+}
+
+
+void ScanPublisher::publishStats()
+{
+  if (statsSource && millis() - statsPreviousMillis >= statsIntervalMillis) {
+    statsPreviousMillis = millis();
+    String topic = settingsManager.getAppSettings().mqttRootTopic + "/stats";
+    String json = statsSource();
+    // the stats grow with sensors and rendered pages, so the MQTT buffer grows with them (fixed header 5 bytes + topic length 2 bytes)
+    size_t needed = 7 + topic.length() + json.length();
+    if (needed > mqttClient.getBufferSize() && !mqttClient.setBufferSize((needed + 511) / 512 * 512))
+      Serial.println(String("MQTT buffer could not be enlarged to ") + needed + " bytes");
+    if (!publish(topic, json.c_str()))
+      notifyClients(String("Publishing the stats by MQTT failed (") + json.length() + " bytes).");
+  }
+}
+
+
+/* publish log messages logged since the last call, the ones logged while MQTT was disconnected are skipped */
+void ScanPublisher::publishLogMessages(bool mqttConnected)
+{
+  if (!mqttConnected) {
+    mqttLogSeq = logBuffer.getLatestSeq();
+    return;
+  }
+  uint32_t latest = logBuffer.getLatestSeq();
+  if (mqttLogSeq == latest)
+    return;
+  String topic = settingsManager.getAppSettings().mqttRootTopic + "/lastLogMessage";
+  LogBuffer::Entry entry;
+  for (uint32_t seq = max(mqttLogSeq + 1, logBuffer.getOldestSeq()); seq <= latest; seq++) {
+    if (logBuffer.read(seq, entry))
+      publish(topic, entry.text);
+  }
+  mqttLogSeq = latest;
+}
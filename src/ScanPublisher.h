@@ -0,0 +1,62 @@
+#ifndef SCANPUBLISHER_H
+#define SCANPUBLISHER_H
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <functional>
+#include "FingerprintManager.h"
+#include "SettingsManager.h"
+#include "LogBuffer.h"
+
+struct Sensor {
+  FingerprintManager &manager;
+  int doorbellOutputPin;
+  String mqttSubTopic; // appended to the MQTT root topic, empty for the first sensor
+  bool doorbellOutputActive;
+  unsigned long doorbellOnMillis; // doorbell output is switched off again 1s after this time
+  Match lastMatch;
+};
+
+String getSensorName(const Sensor& sensor);
+
+enum class PairingJob {
+  pair,
+  invalidate
+};
+
+/*
+  The scan part of every loop() iteration: takes the results queued by the sensor tasks, publishes them by MQTT and to the
+  log, drives the doorbell outputs and publishes stats and log messages by MQTT. Runs on the loop task only and must
+  never wait for a sensor or the flash, anything slower is left to other tasks (pairing). Kept apart from main.cpp, so
+  the host tests measure the code the device runs.
+*/
+class ScanPublisher {
+  private:
+    Sensor *sensors;
+    int sensorCount;
+    SettingsManager &settingsManager;
+    PubSubClient &mqttClient;
+    LogBuffer &logBuffer;
+    volatile bool &mqttConnecting; // set while the connect task owns mqttClient
+    uint32_t mqttLogSeq = 0; // last log message published by MQTT
+    unsigned long statsPreviousMillis = 0;
+    unsigned long statsIntervalMillis = 300000;
+    std::function<String()> statsSource;
+    std::function<bool(PairingJob)> startPairing;
+
+    void publishMatch(Sensor& sensor, const Match& match);
+    bool isMatchPairingValid(const Match& match);
+    void updateDoorbellOutput(Sensor& sensor);
+    void publishStats();
+    void publishLogMessages(bool mqttConnected);
+
+  public:
+    ScanPublisher(Sensor *sensors, int sensorCount, SettingsManager &settingsManager, PubSubClient &mqttClient, LogBuffer &logBuffer,
+      volatile bool &mqttConnecting);
+    void setStatsSource(std::function<String()> source, unsigned long intervalMillis = 300000);
+    void setPairingStarter(std::function<bool(PairingJob)> starter); // runs the pairing job in background
+    bool publish(const String& topic, const char *payload); // false while the connect task owns mqttClient
+    void loop(bool mqttConnected);
+};
+
+#endif
@@ -1,9 +1,15 @@
 #include "SettingsManager.h"
 #include <Crypto.h>
 
+SettingsManager::SettingsManager() {
+    lock = xSemaphoreCreateMutex();
+    saveLock = xSemaphoreCreateMutex();
+}
+
 bool SettingsManager::loadWifiSettings() {
     Preferences preferences;
     if (preferences.begin("wifiSettings", true)) {
+        xSemaphoreTake(lock, portMAX_DELAY);
         wifiSettings.ssid = preferences.getString("ssid", String(""));
         wifiSettings.password = preferences.getString("password", String(""));
         wifiSettings.hostname = preferences.getString("hostname", String("FingerprintDoorbell"));
@@ -13,6 +19,7 @@ bool SettingsManager::loadWifiSettings() {
         wifiSettings.subnetMask.fromString(preferences.getString("subnetMask"));
         wifiSettings.dnsIP0.fromString(preferences.getString("dnsIP0"));
         wifiSettings.dnsIP1.fromString(preferences.getString("dnsIP1"));
+        xSemaphoreGive(lock);
         preferences.end();
         return true;
     } else {
@@ -23,6 +30,7 @@ bool SettingsManager::loadWifiSettings() {
 bool SettingsManager::loadAppSettings() {
     Preferences preferences;
     if (preferences.begin("appSettings", true)) {
+        xSemaphoreTake(lock, portMAX_DELAY);
         appSettings.mqttServer = preferences.getString("mqttServer", String(""));
         appSettings.mqttPort = preferences.getUShort("mqttPort", (uint16_t) 1883);
         appSettings.mqttUsername = preferences.getString("mqttUsername", String(""));
@@ -32,6 +40,7 @@ bool SettingsManager::loadAppSettings() {
         appSettings.sensorPin = preferences.getString("sensorPin", "00000000");
         appSettings.sensorPairingCode = preferences.getString("pairingCode", "");
         appSettings.sensorPairingValid = preferences.getBool("pairingValid", false);
+        xSemaphoreGive(lock);
         preferences.end();
         return true;
     } else {
@@ -42,10 +51,12 @@ bool SettingsManager::loadAppSettings() {
 bool SettingsManager::loadColorSettings() {
     Preferences preferences;
     if (preferences.begin("colorSettings", true)) {
+        xSemaphoreTake(lock, portMAX_DELAY);
         colorSettings.activeColor = preferences.getUChar("ringActCol", 2);
         colorSettings.activeSequence = preferences.getUChar("ringActSeq", 1);
         colorSettings.scanColor = preferences.getUChar("scanColor", 1);
         colorSettings.matchColor = preferences.getUChar("matchColor", 3);
+        xSemaphoreGive(lock);
         preferences.end();
         return true;
     } else {
@@ -56,9 +67,11 @@ bool SettingsManager::loadColorSettings() {
 bool SettingsManager::loadWebPageSettings() {
     Preferences preferences;
     if (preferences.begin("webPageSettings", true)) {
+        xSemaphoreTake(lock, portMAX_DELAY);
         webPageSettings.webPageUsername = preferences.getString("webPageUsername", String("admin"));
         webPageSettings.webPagePassword = preferences.getString("webPagePassword", String("admin"));
         webPageSettings.webPageRealm = preferences.getString("webPageRealm", String("FingerprintDoorbell"));
+        xSemaphoreGive(lock);
         preferences.end();
         return true;
     } else {
@@ -66,93 +79,138 @@ bool SettingsManager::loadWebPageSettings() {
     }
 }
    
-void SettingsManager::saveWifiSettings() {
+void SettingsManager::writeWifiSettings(const WifiSettings &settings) {
     Preferences preferences;
     preferences.begin("wifiSettings", false); 
-    preferences.putString("ssid", wifiSettings.ssid);
-    preferences.putString("password", wifiSettings.password);
-    preferences.putString("hostname", wifiSettings.hostname);
-    preferences.putBool("dhcp_setting", wifiSettings.dhcp_setting);
-    preferences.putString("localIP", wifiSettings.localIP.toString());
-    preferences.putString("gatewayIP", wifiSettings.gatewayIP.toString());
-    preferences.putString("subnetMask", wifiSettings.subnetMask.toString());
-    preferences.putString("dnsIP0", wifiSettings.dnsIP0.toString());
-    preferences.putString("dnsIP1", wifiSettings.dnsIP1.toString());
+    preferences.putString("ssid", settings.ssid);
+    preferences.putString("password", settings.password);
+    preferences.putString("hostname", settings.hostname);
+    preferences.putBool("dhcp_setting", settings.dhcp_setting);
+    preferences.putString("localIP", settings.localIP.toString());
+    preferences.putString("gatewayIP", settings.gatewayIP.toString());
+    preferences.putString("subnetMask", settings.subnetMask.toString());
+    preferences.putString("dnsIP0", settings.dnsIP0.toString());
+    preferences.putString("dnsIP1", settings.dnsIP1.toString());
     preferences.end();
 }
 
-void SettingsManager::saveAppSettings() {
+void SettingsManager::writeAppSettings(const AppSettings &settings) {
     Preferences preferences;
     preferences.begin("appSettings", false); 
-    preferences.putString("mqttServer", appSettings.mqttServer);
-    preferences.putUShort("mqttPort", appSettings.mqttPort);
-    preferences.putString("mqttUsername", appSettings.mqttUsername);
-    preferences.putString("mqttPassword", appSettings.mqttPassword);
-    preferences.putString("mqttRootTopic", appSettings.mqttRootTopic);
-    preferences.putString("ntpServer", appSettings.ntpServer);
-    preferences.putString("sensorPin", appSettings.sensorPin);
-    preferences.putString("pairingCode", appSettings.sensorPairingCode);
-    preferences.putBool("pairingValid", appSettings.sensorPairingValid);
+    preferences.putString("mqttServer", settings.mqttServer);
+    preferences.putUShort("mqttPort", settings.mqttPort);
+    preferences.putString("mqttUsername", settings.mqttUsername);
+    preferences.putString("mqttPassword", settings.mqttPassword);
+    preferences.putString("mqttRootTopic", settings.mqttRootTopic);
+    preferences.putString("ntpServer", settings.ntpServer);
+    preferences.putString("sensorPin", settings.sensorPin);
+    preferences.putString("pairingCode", settings.sensorPairingCode);
+    preferences.putBool("pairingValid", settings.sensorPairingValid);
     preferences.end();
 }
 
-void SettingsManager::saveColorSettings() {
+void SettingsManager::writeColorSettings(const ColorSettings &settings) {
     Preferences preferences;
     preferences.begin("colorSettings", false);
-    preferences.putUChar("ringActCol", colorSettings.activeColor);
-    preferences.putUChar("ringActSeq", colorSettings.activeSequence);
-    preferences.putUChar("scanColor", colorSettings.scanColor);
-    preferences.putUChar("matchColor", colorSettings.matchColor);
+    preferences.putUChar("ringActCol", settings.activeColor);
+    preferences.putUChar("ringActSeq", settings.activeSequence);
+    preferences.putUChar("scanColor", settings.scanColor);
+    preferences.putUChar("matchColor", settings.matchColor);
     preferences.end();
 }
 
-void SettingsManager::saveWebPageSettings() {
+void SettingsManager::writeWebPageSettings(const WebPageSettings &settings) {
     Preferences preferences;
     preferences.begin("webPageSettings", false);
-    preferences.putString("webPageUsername", webPageSettings.webPageUsername);
-    preferences.putString("webPagePassword", webPageSettings.webPagePassword);
-    preferences.putString("webPageRealm", webPageSettings.webPageRealm);
+    preferences.putString("webPageUsername", settings.webPageUsername);
+    preferences.putString("webPagePassword", settings.webPagePassword);
+    preferences.putString("webPageRealm", settings.webPageRealm);
     preferences.end();
 }
 
 WifiSettings SettingsManager::getWifiSettings() {
-    return wifiSettings;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    WifiSettings settings = wifiSettings;
+    xSemaphoreGive(lock);
+    return settings;
 }
 
 void SettingsManager::saveWifiSettings(WifiSettings newSettings) {
+    xSemaphoreTake(saveLock, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
     wifiSettings = newSettings;
-    saveWifiSettings();
+    generation++;
+    xSemaphoreGive(lock);
+    writeWifiSettings(newSettings);
+    xSemaphoreGive(saveLock);
 }
 
 AppSettings SettingsManager::getAppSettings() {
-    return appSettings;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    AppSettings settings = appSettings;
+    xSemaphoreGive(lock);
+    return settings;
 }
 
 void SettingsManager::saveAppSettings(AppSettings newSettings) {
-    appSettings = newSettings;
-    saveAppSettings();
+    updateAppSettings([&newSettings](AppSettings &settings) { settings = newSettings; });
+}
+
+void SettingsManager::updateAppSettings(std::function<void(AppSettings&)> change) {
+    xSemaphoreTake(saveLock, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    change(appSettings);
+    AppSettings settings = appSettings;
+    generation++;
+    xSemaphoreGive(lock);
+    writeAppSettings(settings);
+    xSemaphoreGive(saveLock);
 }
 
 ColorSettings SettingsManager::getColorSettings() {
-    return colorSettings;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    ColorSettings settings = colorSettings;
+    xSemaphoreGive(lock);
+    return settings;
 }
 
 void SettingsManager::saveColorSettings(ColorSettings newSettings) {
+    xSemaphoreTake(saveLock, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
     colorSettings = newSettings;
-    saveColorSettings();
+    generation++;
+    xSemaphoreGive(lock);
+    writeColorSettings(newSettings);
+    xSemaphoreGive(saveLock);
 }
 
 WebPageSettings SettingsManager::getWebPageSettings() {
-    return webPageSettings;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    WebPageSettings settings = webPageSettings;
+    xSemaphoreGive(lock);
+    return settings;
 }
 
 void SettingsManager::saveWebPageSettings(WebPageSettings newSettings) {
+    xSemaphoreTake(saveLock, portMAX_DELAY);
+    xSemaphoreTake(lock, portMAX_DELAY);
     webPageSettings = newSettings;
-    saveWebPageSettings();
+    generation++;
+    xSemaphoreGive(lock);
+    writeWebPageSettings(newSettings);
+    xSemaphoreGive(saveLock);
+}
+
+uint32_t SettingsManager::getGeneration() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t current = generation;
+    xSemaphoreGive(lock);
+    return current;
 }
 
 bool SettingsManager::isWifiConfigured() {
-    if (wifiSettings.ssid.isEmpty() || wifiSettings.password.isEmpty())
+    WifiSettings settings = getWifiSettings();
+    if (settings.ssid.isEmpty() || settings.password.isEmpty())
         return false;
     else
         return true;
@@ -199,6 +257,8 @@ bool SettingsManager::deleteWebPageSettings() {
 }
 
 String SettingsManager::generateNewPairingCode() {
+    AppSettings appSettings = getAppSettings();
+    WifiSettings wifiSettings = getWifiSettings();
 
     /* Create a SHA256 hash */
     SHA256 hasher;
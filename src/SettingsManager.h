@@ -1,7 +1,9 @@
 #ifndef SETTINGSMANAGER_H
 #define SETTINGSMANAGER_H
 
+#include <Arduino.h>
 #include <Preferences.h>
+#include <functional>
 #include "global.h"
 
 struct WifiSettings {    
@@ -63,19 +65,30 @@ struct WebPageSettings {
     String webPageRealm = "FingerprintDoorbell";
 };
 
+/*
+  The settings are read by loop(), the web server, the MQTT callback and the boot and pairing tasks, and saved by some of
+  them. Getters return a copy taken under lock, so no task reads a String while another one replaces it. Saving changes the
+  copy in RAM under lock and writes it to NVS afterwards, so readers never wait for the flash. Use updateAppSettings() to
+  change single fields, a get/modify/save sequence could overwrite the change of another task.
+*/
 class SettingsManager {       
   private:
     WifiSettings wifiSettings;
     AppSettings appSettings;
     ColorSettings colorSettings;
     WebPageSettings webPageSettings;
+    uint32_t generation = 0; // incremented on every change, used as version of the web pages
+    SemaphoreHandle_t lock; // settings in RAM
+    SemaphoreHandle_t saveLock; // one save at a time, so NVS is written in the order of the changes
 
-    void saveWifiSettings();
-    void saveAppSettings();
-    void saveColorSettings();
-    void saveWebPageSettings();
+    void writeWifiSettings(const WifiSettings &settings);
+    void writeAppSettings(const AppSettings &settings);
+    void writeColorSettings(const ColorSettings &settings);
+    void writeWebPageSettings(const WebPageSettings &settings);
 
   public:
+    SettingsManager();
+
     bool loadWifiSettings();
     bool loadAppSettings();
     bool loadColorSettings();
@@ -86,6 +99,7 @@ class SettingsManager {
     
     AppSettings getAppSettings();
     void saveAppSettings(AppSettings newSettings);
+    void updateAppSettings(std::function<void(AppSettings&)> change); // change is called under lock, it must not use the SettingsManager
 
     ColorSettings getColorSettings();
     void saveColorSettings(ColorSettings newSettings);
@@ -94,6 +108,7 @@ class SettingsManager {
     void saveWebPageSettings(WebPageSettings newSettings);
 
     bool isWifiConfigured();
+    uint32_t getGeneration();
 
     bool deleteWifiSettings();
     bool deleteAppSettings();
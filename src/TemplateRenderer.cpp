@@ -0,0 +1,234 @@
+#include "TemplateRenderer.h"
+#include <LittleFS.h>
+
+TemplateOutput::TemplateOutput(PsychicResponse &response, char *buffer, size_t bufferSize)
+  : response(response), buffer(buffer), bufferSize(bufferSize) {
+  lowestFreeHeap = ESP.getFreeHeap();
+}
+
+void TemplateOutput::write(const char *data, size_t length) {
+  while (length > 0) {
+    size_t part = bufferSize - used;
+    if (part > length)
+      part = length;
+    memcpy(buffer + used, data, part);
+    used += part;
+    data += part;
+    length -= part;
+    if (used == bufferSize)
+      flush();
+  }
+}
+
+void TemplateOutput::write(const char *text) {
+  write(text, strlen(text));
+}
+
+void TemplateOutput::write(const String &text) {
+  write(text.c_str(), text.length());
+}
+
+bool TemplateOutput::copyFrom(File &file, size_t length) {
+  while (length > 0) {
+    size_t part = bufferSize - used;
+    if (part > length)
+      part = length;
+    size_t read = file.read((uint8_t*)buffer + used, part);
+    if (read == 0)
+      return false; // file shorter than when it was parsed
+    used += read;
+    length -= read;
+    if (used == bufferSize)
+      flush();
+  }
+  return true;
+}
+
+void TemplateOutput::flush() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < lowestFreeHeap)
+    lowestFreeHeap = freeHeap;
+  if (used > 0 && result == ESP_OK) {
+    result = response.sendChunk((uint8_t*)buffer, used); // after an error (client gone) the rest is dropped
+    if (firstChunkMicros == 0)
+      firstChunkMicros = esp_timer_get_time();
+  }
+  used = 0;
+}
+
+esp_err_t TemplateOutput::finish() {
+  flush();
+  if (result == ESP_OK)
+    result = response.finishChunking();
+  return result;
+}
+
+uint32_t TemplateOutput::getLowestFreeHeap() {
+  return lowestFreeHeap;
+}
+
+int64_t TemplateOutput::getFirstChunkMicros() {
+  return firstChunkMicros;
+}
+
+
+TemplateRenderer::TemplateRenderer(const char * const *keys, int keyCount) : keys(keys), keyCount(keyCount) {
+  lock = xSemaphoreCreateMutex();
+}
+
+/* index of the key matching the marker name, -1 if none */
+int TemplateRenderer::findKey(const char *name, size_t length, uint8_t &param) {
+  param = 0;
+  for (int i=0; i<keyCount; i++) {
+    size_t keyLength = strlen(keys[i]);
+    if (keys[i][keyLength - 1] == '_') {
+      // key with numeric suffix
+      if (length <= keyLength || strncmp(name, keys[i], keyLength) != 0)
+        continue;
+      int value = 0;
+      size_t pos = keyLength;
+      while (pos < length && isdigit(name[pos]) && value <= 255)
+        value = value * 10 + (name[pos++] - '0');
+      if (pos == length && value <= 255) {
+        param = value;
+        return i;
+      }
+    } else if (length == keyLength && strncmp(name, keys[i], length) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* reads the file in blocks, a marker may span two blocks */
+bool TemplateRenderer::parse(Page &page) {
+  File file = LittleFS.open(page.path, "r");
+  if (!file)
+    return false;
+  if (file.size() > UINT16_MAX) {
+    file.close();
+    return false;
+  }
+
+  char name[maxKeyLength + 1]; // name of the current marker candidate
+  size_t nameLength = 0;
+  bool inMarker = false;
+  size_t markerStart = 0;
+  size_t literalStart = 0;
+  size_t pos = 0;
+  char block[256];
+  size_t blockLength;
+  while ((blockLength = file.read((uint8_t*)block, sizeof(block))) > 0) {
+    for (size_t i=0; i<blockLength; i++, pos++) {
+      char c = block[i];
+      if (inMarker && c == '%' && nameLength > 0) {
+        uint8_t param;
+        int key = findKey(name, nameLength, param);
+        if (key >= 0) {
+          if (markerStart > literalStart)
+            page.segments.push_back({ (uint16_t)literalStart, (uint16_t)(markerStart - literalStart), -1, 0 });
+          page.segments.push_back({ (uint16_t)markerStart, (uint16_t)(pos + 1 - markerStart), (int8_t)key, param });
+          literalStart = pos + 1;
+          inMarker = false;
+          continue;
+        }
+      }
+      if (inMarker && c != '%' && (isupper(c) || isdigit(c) || c == '_') && nameLength < maxKeyLength) {
+        name[nameLength++] = c;
+        continue;
+      }
+      // no marker (yet), a '%' may start the next one
+      inMarker = (c == '%');
+      markerStart = pos;
+      nameLength = 0;
+    }
+  }
+  file.close();
+  if (pos > literalStart)
+    page.segments.push_back({ (uint16_t)literalStart, (uint16_t)(pos - literalStart), -1, 0 });
+  page.segments.shrink_to_fit();
+  return true;
+}
+
+/* parsed page from cache, parsed and cached on first use. NULL if the file does not exist */
+TemplateRenderer::Page* TemplateRenderer::getPage(const char *path) {
+  for (size_t i=0; i<pages.size(); i++) {
+    if (pages[i].path.equals(path))
+      return &pages[i];
+  }
+  Page page;
+  page.path = path;
+  if (!parse(page))
+    return NULL;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  pages.push_back(std::move(page));
+  Page *cached = &pages.back();
+  xSemaphoreGive(lock);
+  return cached;
+}
+
+esp_err_t TemplateRenderer::render(PsychicRequest *request, const char *path, int status, PlaceholderResolver resolver, const String &etag) {
+  int64_t startMicros = esp_timer_get_time();
+  uint32_t freeHeapBefore = ESP.getFreeHeap();
+  Page *page = getPage(path);
+  File file;
+  if (page != NULL)
+    file = LittleFS.open(path, "r");
+  if (!file)
+    return ESP_ERR_NOT_FOUND;
+
+  PsychicResponse response(request);
+  response.setCode(status);
+  response.setContentType("text/html");
+  if (!etag.isEmpty()) {
+    response.addHeader("ETag", etag.c_str());
+    response.addHeader("Cache-Control", "no-cache");
+  }
+  response.sendHeaders();
+  TemplateOutput out(response, chunkBuffer, chunkSize);
+  for (const Segment &segment : page->segments) {
+    if (segment.key >= 0) {
+      resolver(segment.key, segment.param, out);
+      continue;
+    }
+    if (file.position() != segment.offset)
+      file.seek(segment.offset); // skip the marker
+    if (!out.copyFrom(file, segment.length))
+      break;
+  }
+  file.close();
+  esp_err_t result = out.finish();
+
+  uint32_t micros = esp_timer_get_time() - startMicros;
+  uint32_t firstByteMicros = (out.getFirstChunkMicros() > 0) ? out.getFirstChunkMicros() - startMicros : micros;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  page->renders++;
+  page->lastMicros = micros;
+  if (micros > page->maxMicros)
+    page->maxMicros = micros;
+  page->lastFirstByteMicros = firstByteMicros;
+  if (firstByteMicros > page->maxFirstByteMicros)
+    page->maxFirstByteMicros = firstByteMicros;
+  uint32_t lowest = out.getLowestFreeHeap();
+  if (freeHeapBefore > lowest && freeHeapBefore - lowest > page->peakHeapBytes)
+    page->peakHeapBytes = freeHeapBefore - lowest;
+  xSemaphoreGive(lock);
+  return result;
+}
+
+/* render time and heap usage per page, e.g. {"/index.html":{"renders":3,"lastMicros":8000,...}} */
+String TemplateRenderer::getStatsJson() {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  String json = "{";
+  for (size_t i=0; i<pages.size(); i++) {
+    const Page &page = pages[i];
+    if (i > 0)
+      json += ",";
+    json += String("\"") + page.path + "\":{\"renders\":" + page.renders + ",\"lastMicros\":" + page.lastMicros
+      + ",\"maxMicros\":" + page.maxMicros + ",\"lastFirstByteMicros\":" + page.lastFirstByteMicros
+      + ",\"maxFirstByteMicros\":" + page.maxFirstByteMicros + ",\"peakHeapBytes\":" + page.peakHeapBytes
+      + ",\"cachedBytes\":" + (page.segments.size() * sizeof(Segment)) + "}";
+  }
+  xSemaphoreGive(lock);
+  return json + "}";
+}
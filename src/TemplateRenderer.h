@@ -0,0 +1,80 @@
+#ifndef TEMPLATERENDERER_H
+#define TEMPLATERENDERER_H
+
+#include <Arduino.h>
+#include <PsychicHttp.h>
+#include <functional>
+#include <vector>
+
+/*
+  HTML pages with %PLACEHOLDER% markers. Each file is parsed only once into literal and placeholder segments, placeholders
+  are mapped to the index of their name in the key list given to the constructor. Keys ending with "_" match a numeric
+  suffix (e.g. "ACTIVE_COLOR_" matches %ACTIVE_COLOR_3% with param 3). Unknown markers are kept as literal text.
+  Only the segment list (file offsets) is cached. Pages are streamed from the file in blocks through one reusable buffer and
+  sent as chunked response, so heap usage per request does not depend on the size of the page.
+*/
+class TemplateOutput {
+  public:
+    TemplateOutput(PsychicResponse &response, char *buffer, size_t bufferSize);
+    void write(const char *data, size_t length);
+    void write(const char *text);
+    void write(const String &text);
+    bool copyFrom(File &file, size_t length); // read directly into the chunk buffer
+    esp_err_t finish();
+    uint32_t getLowestFreeHeap();
+    int64_t getFirstChunkMicros(); // time the first chunk was sent, 0 if none
+
+  private:
+    PsychicResponse &response;
+    char *buffer;
+    size_t bufferSize;
+    size_t used = 0;
+    esp_err_t result = ESP_OK;
+    uint32_t lowestFreeHeap;
+    int64_t firstChunkMicros = 0;
+
+    void flush();
+};
+
+typedef std::function<void(int key, uint8_t param, TemplateOutput &out)> PlaceholderResolver;
+
+class TemplateRenderer {
+  public:
+    TemplateRenderer(const char * const *keys, int keyCount);
+    // ESP_ERR_NOT_FOUND (nothing sent) if the file does not exist. With etag the browser has to revalidate the page on every use
+    esp_err_t render(PsychicRequest *request, const char *path, int status, PlaceholderResolver resolver, const String &etag = "");
+    String getStatsJson();
+
+  private:
+    struct Segment {
+      uint16_t offset;
+      uint16_t length;
+      int8_t key; // -1: literal text
+      uint8_t param;
+    };
+    struct Page {
+      String path;
+      std::vector<Segment> segments; // offsets are file positions
+      // render statistics
+      uint32_t renders = 0;
+      uint32_t lastMicros = 0;
+      uint32_t maxMicros = 0;
+      uint32_t lastFirstByteMicros = 0; // time to first chunk
+      uint32_t maxFirstByteMicros = 0;
+      uint32_t peakHeapBytes = 0; // max. heap used while rendering (free heap at start - lowest free heap)
+    };
+    static const size_t chunkSize = 1024;
+    static const size_t maxKeyLength = 32;
+
+    const char * const *keys;
+    int keyCount;
+    std::vector<Page> pages;
+    char chunkBuffer[chunkSize]; // the web server handles one request at a time
+    SemaphoreHandle_t lock; // pages are rendered by the web server, statistics are read by loop() as well
+
+    Page* getPage(const char *path);
+    bool parse(Page &page);
+    int findKey(const char *name, size_t length, uint8_t &param);
+};
+
+#endif
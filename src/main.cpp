@@ -13,11 +13,20 @@
 #include <ElegantOTA.h>
 #include <LittleFS.h>
 #include <PubSubClient.h>
+#include "esp_heap_caps.h"
+#include "lwip/sockets.h"
+#include "rom/crc.h"
 #include "FingerprintManager.h"
 #include "SettingsManager.h"
+#include "PowerManager.h"
+#include "BootTimeline.h"
+#include "TemplateRenderer.h"
+#include "JsonWriter.h"
+#include "LogBuffer.h"
+#include "ScanPublisher.h"
 #include "global.h"
 
-enum class Mode { scan, enroll, wificonfig, maintenance };
+enum class Mode { scan, wificonfig };
 
 const char* VersionInfo = "1.0";
 
@@ -35,6 +44,27 @@ const long  gmtOffset_sec = 0; // UTC Time
 const int   daylightOffset_sec = 0; // UTC Time
 const int   doorbellOutputPin = 19; // pin connected to the doorbell (when using hardware connection instead of mqtt to ring the bell)
 
+#ifdef SECOND_SENSOR
+  // second sensor (e.g. at the gate) on UART1, it's scanned by its own task and published below <mqttRootTopic>/gate
+  const int   secondSensorRxPin = 32;
+  const int   secondSensorTxPin = 33;
+  const int   secondTouchRingPin = 27;
+  const int   secondDoorbellOutputPin = 23;
+#endif
+
+#ifdef TOUCH_RING_POLLING
+  const TouchWakeup touchWakeupMode = TouchWakeup::polling; // no touch/wakeup line wired, scan continuously
+#else
+  const TouchWakeup touchWakeupMode = TouchWakeup::interrupt; // scan only after the touch ring was touched
+#endif
+
+#ifdef LIGHT_SLEEP_IDLE
+  const bool lightSleepIdle = true; // enter automatic light sleep when idle
+  const uint32_t idleWaitMillis = 50; // max. time loop() sleeps waiting for scan results, MQTT and reconnect handling run at least this often
+#else
+  const bool lightSleepIdle = false; // frequency scaling only
+#endif
+
 #ifdef CUSTOM_GPIOS
   const int   customOutput1 = 18; // not used internally, but can be set over MQTT
   const int   customOutput2 = 26; // not used internally, but can be set over MQTT
@@ -44,20 +74,69 @@ const int   doorbellOutputPin = 19; // pin connected to the doorbell (when using
   bool customInput2Value = false;
 #endif
 
-const int logMessagesCount = 5;
-String logMessages[logMessagesCount]; // log messages, 0=most recent log message
+// #define LOG_CAPACITY to keep more (or less) log messages, every message takes sizeof(LogBuffer::Entry) bytes
+#ifndef LOG_CAPACITY
+  #define LOG_CAPACITY 100 // about 26 KB RAM
+#endif
+LogBuffer::Entry logSlots[LOG_CAPACITY];
+LogBuffer logBuffer(logSlots, LOG_CAPACITY);
+const uint32_t logPageLines = 10; // most recent log messages shown on the pages
+uint32_t bootId = 0; // part of the page ETags, so a browser never gets a 304 for a page of an earlier boot
 bool shouldReboot = false;
+bool rebootPending = false;
+unsigned long rebootRequestedMillis = 0; // the reboot follows 1s later, so the clients still get the notification
 unsigned long wifiReconnectPreviousMillis = 0;
-unsigned long mqttReconnectPreviousMillis = 0;
+unsigned long mqttReconnectPreviousMillis = 0; // end of the last connect attempt
 unsigned long ota_progress_millis = 0;
 
-String enrollId;
-String enrollName;
+// loop() must never block, so MQTT, OTA and reconnect handling keep running while scanning
+const unsigned long maxLoopMicros = 20000;
+unsigned long loopStartMicros = 0;
+unsigned long loopMaxMicros = 0;
+unsigned long loopOverrunCount = 0;
+
 Mode currentMode = Mode::scan;
 
-FingerprintManager fingerManager;
+FingerprintManager fingerManager; // first sensor
+#ifdef SECOND_SENSOR
+  FingerprintManager secondFingerManager(Serial1, secondTouchRingPin, secondSensorRxPin, secondSensorTxPin, "2");
+#endif
+
+Sensor sensors[] = {
+  { fingerManager, doorbellOutputPin, "", false, 0, Match() },
+  #ifdef SECOND_SENSOR
+  { secondFingerManager, secondDoorbellOutputPin, "/gate", false, 0, Match() },
+  #endif
+};
+const int sensorCount = sizeof(sensors) / sizeof(sensors[0]);
+
 SettingsManager settingsManager;
-bool needMaintenanceMode = false;
+PowerManager powerManager;
+
+/*
+  Startup runs as concurrent tasks: sensor bring-up, WiFi association (followed by MQTT name resolution) and LittleFS/web server.
+  Dependencies are expressed by bits of bootEvents, scanning starts as soon as the sensors are ready.
+*/
+EventGroupHandle_t bootEvents = NULL;
+const EventBits_t bootSensorsReady = BIT0; // sensors connected, operating mode decided, sensor tasks started
+const EventBits_t bootWifiReady = BIT1;    // station connected (or access point started in wifi config mode)
+const EventBits_t bootMqttResolved = BIT2; // MQTT server address known, loop() connects
+BootTimeline bootTimeline;
+bool bootTimelinePublished = false;
+bool mqttConnectAttempted = false;
+// PubSubClient::connect() blocks until the broker answers or the TCP connect times out, so it runs in a task of its own
+volatile bool mqttConnecting = false; // set by loop() before the connect task starts, loop() leaves mqttClient alone while set
+const unsigned long mqttMinReconnectMillis = 5000;
+const unsigned long mqttMaxReconnectMillis = 300000;
+unsigned long mqttReconnectMillis = mqttMinReconnectMillis; // doubled after every failed attempt, reset on success
+TaskHandle_t loopTask = NULL; // notified by the sensor tasks
+
+/* enrollment steps reported by the sensor tasks, sent to the web clients and by MQTT in loop() like the scan results */
+struct EnrollEvent {
+  int sensorIndex;
+  EnrollProgress progress;
+};
+QueueHandle_t enrollEventQueue = NULL;
 
 const byte DNS_PORT = 53;
 DNSServer dnsServer;
@@ -72,32 +151,170 @@ DNSServer dnsServer;
 #endif
 PsychicEventSource events; // event source (Server-Sent events)
 
+/*
+  Log messages are sent from logBuffer to the browsers by the logSender task as one SSE event "log" per message, the event id is the
+  sequence number of the message. Every client has a cursor into the log instead of a queue: a reconnecting browser
+  sends Last-Event-ID and only gets the messages it missed, a client falling behind further than the log reaches back
+  skips the lost messages. Sockets not writable are retried later, so notifyClients() never waits for a slow client.
+  The other events (finger list, enrollment progress) are queued by broadcastEvent() and sent by the logSender task as
+  well, so only one task writes to the event sockets and events never interleave. They carry no id, so the
+  Last-Event-ID of the browser stays the sequence number of the last log message.
+*/
+struct LogClient {
+  httpd_handle_t server;
+  int socket; // -1: slot unused
+  uint32_t lastSeq; // sequence number of the last message sent
+  uint32_t lastBroadcastSeq; // of the last other event sent
+  bool retrySent;
+};
+const int maxLogClients = 4;
+LogClient logClients[maxLogClients] = {};
+struct BroadcastEvent {
+  String name;
+  String data;
+};
+const int maxBroadcastEvents = 8; // a client falling behind further only misses the oldest ones
+BroadcastEvent broadcastEvents[maxBroadcastEvents]; // ring indexed by sequence number
+uint32_t broadcastSeq = 0; // sequence number of the newest event
+SemaphoreHandle_t logLock = NULL; // logClients and broadcastEvents, accessed by the logSender task, the web server and loop()
+TaskHandle_t logSenderTask = NULL;
+const uint32_t logSenderRetryMillis = 100; // poll interval while a client socket is not writable
+
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
+ScanPublisher scanPublisher(sensors, sensorCount, settingsManager, mqttClient, logBuffer, mqttConnecting);
 long lastMsg = 0;
 char msg[50];
 int value = 0;
 bool mqttConfigValid = true;
+volatile bool mqttConnected = false; // state for other tasks (PubSubClient is only used by loop() and the MQTT connect task)
 
+/* JSON API: responses are written into one fixed buffer, the web server handles one request at a time */
+const int apiVersion = 1;
+const int apiDefaultPageSize = 50;
+const int apiMaxPageSize = 200;
+char apiBuffer[8192];
+uint32_t apiFingersLastMicros = 0; // serialization time of the last /api/fingers page
+uint32_t apiFingersMaxMicros = 0;
 
-Match lastMatch;
-
-void addLogMessage(const String& message) {
-  // shift all messages in array by 1, oldest message will die
-  for (int i=logMessagesCount-1; i>0; i--)
-    logMessages[i]=logMessages[i-1];
-  logMessages[0]=message;
-}
 
+/* the most recent log messages, oldest first */
 String getLogMessagesAsHtml() {
   String html = "";
-  for (int i=logMessagesCount-1; i>=0; i--) {
-    if (logMessages[i]!="")
-      html = html + logMessages[i] + "<br>";
+  uint32_t latest = logBuffer.getLatestSeq();
+  uint32_t first = max(logBuffer.getOldestSeq(), (latest > logPageLines) ? latest - logPageLines + 1 : 1);
+  LogBuffer::Entry entry;
+  for (uint32_t seq = first; seq <= latest; seq++) {
+    if (logBuffer.read(seq, entry))
+      html += logBuffer.format(entry) + "<br>";
   }
   return html;
 }
 
+bool isSocketWritable(int socket) {
+  fd_set writeSet;
+  FD_ZERO(&writeSet);
+  FD_SET(socket, &writeSet);
+  struct timeval timeout = { 0, 0 };
+  return select(socket + 1, NULL, &writeSet, NULL, &timeout) > 0;
+}
+
+/* writes a whole event to the socket of the client, false if the socket failed */
+bool sendEvent(const LogClient &client, const char *event, size_t length) {
+  while (length > 0) {
+    int sent = httpd_socket_send(client.server, client.socket, event, length, 0);
+    if (sent <= 0)
+      return false;
+    event += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+/* the cursors of a client are only advanced after its event was sent, a failed send is retried */
+void logSenderMain(void *parameter) {
+  char event[LogBuffer::textSize + 128]; // retry, id, event name and the formatted timestamp
+  LogBuffer::Entry entry;
+  while (true) {
+    bool pending = false;
+    for (int i=0; i<maxLogClients; i++) {
+      // log messages
+      while (true) {
+        xSemaphoreTake(logLock, portMAX_DELAY);
+        LogClient client = logClients[i];
+        xSemaphoreGive(logLock);
+        uint32_t seq = max(client.lastSeq + 1, logBuffer.getOldestSeq());
+        if (client.socket < 0 || !logBuffer.read(seq, entry))
+          break;
+        if (!isSocketWritable(client.socket)) {
+          pending = true;
+          break;
+        }
+        String message = logBuffer.format(entry);
+        message.replace("\n", " "); // a newline would end the data field of the event
+        int length = snprintf(event, sizeof(event), "%sid: %u\nevent: log\ndata: %s\n\n", client.retrySent ? "" : "retry: 1000\n",
+          (unsigned int)seq, message.c_str());
+        length = min(length, (int)sizeof(event) - 1);
+        bool sent = sendEvent(client, event, length);
+        xSemaphoreTake(logLock, portMAX_DELAY);
+        if (sent && logClients[i].socket == client.socket) { // client may have disconnected meanwhile
+          logClients[i].lastSeq = seq;
+          logClients[i].retrySent = true;
+        }
+        xSemaphoreGive(logLock);
+        if (!sent) {
+          pending = true; // socket closed (onClose frees the slot) or busy
+          break;
+        }
+      }
+
+      // other events
+      while (true) {
+        xSemaphoreTake(logLock, portMAX_DELAY);
+        LogClient client = logClients[i];
+        uint32_t seq = client.lastBroadcastSeq + 1;
+        if (broadcastSeq >= maxBroadcastEvents)
+          seq = max(seq, broadcastSeq - maxBroadcastEvents + 1);
+        String broadcast;
+        if (client.socket >= 0 && seq <= broadcastSeq) {
+          const BroadcastEvent &source = broadcastEvents[seq % maxBroadcastEvents];
+          broadcast = String(client.retrySent ? "" : "retry: 1000\n") + "event: " + source.name + "\ndata: " + source.data + "\n\n";
+        }
+        xSemaphoreGive(logLock);
+        if (broadcast.isEmpty())
+          break;
+        if (!isSocketWritable(client.socket)) {
+          pending = true;
+          break;
+        }
+        bool sent = sendEvent(client, broadcast.c_str(), broadcast.length());
+        xSemaphoreTake(logLock, portMAX_DELAY);
+        if (sent && logClients[i].socket == client.socket) {
+          logClients[i].lastBroadcastSeq = seq;
+          logClients[i].retrySent = true;
+        }
+        xSemaphoreGive(logLock);
+        if (!sent) {
+          pending = true;
+          break;
+        }
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, pending ? pdMS_TO_TICKS(logSenderRetryMillis) : portMAX_DELAY);
+  }
+}
+
+/* queues an event for all web clients, it's sent by the logSender task */
+void broadcastEvent(const String &name, String data) {
+  data.replace("\n", " "); // a newline would end the data field of the event
+  xSemaphoreTake(logLock, portMAX_DELAY);
+  broadcastSeq++;
+  broadcastEvents[broadcastSeq % maxBroadcastEvents] = { name, data };
+  xSemaphoreGive(logLock);
+  if (logSenderTask != NULL)
+    xTaskNotifyGive(logSenderTask);
+}
+
 String getTimestampString(){
   struct tm timeinfo;
   if(!getLocalTime(&timeinfo)){
@@ -111,95 +328,295 @@ String getTimestampString(){
   return datetime;
 }
 
-/* wait for maintenance mode or timeout 5s */
-bool waitForMaintenanceMode() {
-  needMaintenanceMode = true;
-  unsigned long startMillis = millis();
-  while (currentMode != Mode::maintenance) {
-    if ((millis() - startMillis) >= 5000ul) {
-      needMaintenanceMode = false;
-      return false;
-    }
-    delay(50);
+/* sensor selected in the web UI by parameter "sensor" (index), first sensor if missing or invalid */
+int getSensorIndex(PsychicRequest *request) {
+  if (request->hasParam("sensor")) {
+    int index = request->getParam("sensor")->value().toInt();
+    if (index >= 0 && index < sensorCount)
+      return index;
   }
-  needMaintenanceMode = false;
-  return true;
+  return 0;
 }
 
-String processFile(const String& fileContent) {
-  String processedContent = fileContent;
-  processedContent.replace("%LOGMESSAGES%", getLogMessagesAsHtml());
-  processedContent.replace("%FINGERLIST%", fingerManager.getFingerListAsHtmlOptionList());
-  processedContent.replace("%HOSTNAME%", settingsManager.getWifiSettings().hostname);
-  processedContent.replace("%VERSIONINFO%", VersionInfo);
-  processedContent.replace("%WIFI_SSID%", settingsManager.getWifiSettings().ssid);
-  if (settingsManager.getWifiSettings().password.isEmpty())
-    processedContent.replace("%WIFI_PASSWORD%", "");
-  else
-    processedContent.replace("%WIFI_PASSWORD%", "********"); // for security reasons the wifi password will not leave the device once configured
-  processedContent.replace(("%DHCP_SETTING_" + String((int)settingsManager.getWifiSettings().dhcp_setting) + "%"), checked);
-  processedContent.replace("%LOCAL_IP%", settingsManager.getWifiSettings().localIP.toString());
-  processedContent.replace("%GATEWAY_IP%", settingsManager.getWifiSettings().gatewayIP.toString());
-  processedContent.replace("%SUBNET_MASK%", settingsManager.getWifiSettings().subnetMask.toString());
-  processedContent.replace("%DNS_IP0%", settingsManager.getWifiSettings().dnsIP0.toString());
-  processedContent.replace("%DNS_IP1%", settingsManager.getWifiSettings().dnsIP1.toString());
-  processedContent.replace("%MQTT_SERVER%", settingsManager.getAppSettings().mqttServer);
-  processedContent.replace("%MQTT_PORT%", String(settingsManager.getAppSettings().mqttPort));
-  processedContent.replace("%MQTT_USERNAME%", settingsManager.getAppSettings().mqttUsername);
-  if (settingsManager.getAppSettings().mqttPassword.isEmpty())
-    processedContent.replace("%MQTT_PASSWORD%", "");
-  else
-    processedContent.replace("%MQTT_PASSWORD%", "********"); // for security reasons the MQTT password will not leave the device once configured
-  processedContent.replace("%MQTT_ROOTTOPIC%", settingsManager.getAppSettings().mqttRootTopic);
-  processedContent.replace("%NTP_SERVER%", settingsManager.getAppSettings().ntpServer);
-  processedContent.replace("%WEBPAGE_USERNAME%", settingsManager.getWebPageSettings().webPageUsername);
-  if (settingsManager.getWebPageSettings().webPagePassword.isEmpty())
-    processedContent.replace("%WEBPAGE_PASSWORD%", "");
-  else
-    processedContent.replace("%WEBPAGE_PASSWORD%", "********"); // for security reasons the web page password will not leave the device once configured
-  processedContent.replace(("%ACTIVE_COLOR_" + String(settingsManager.getColorSettings().activeColor) + "%"), selected);
-  processedContent.replace(("%ACTIVE_SEQUENCE_" + String(settingsManager.getColorSettings().activeSequence) + "%"), checked);
-  processedContent.replace(("%SCAN_COLOR_" + String(settingsManager.getColorSettings().scanColor) + "%"), selected);
-  processedContent.replace(("%SCAN_SEQUENCE_" + String(settingsManager.getColorSettings().scanSequence) + "%"), checked);
-  processedContent.replace(("%MATCH_COLOR_" + String(settingsManager.getColorSettings().matchColor) + "%"), selected);
-  processedContent.replace(("%MATCH_SEQUENCE_" + String(settingsManager.getColorSettings().matchSequence) + "%"), checked);
-  processedContent.replace(("%ENROLL_COLOR_" + String(settingsManager.getColorSettings().enrollColor) + "%"), selected);
-  processedContent.replace(("%ENROLL_SEQUENCE_" + String(settingsManager.getColorSettings().enrollSequence) + "%"), checked);
-  processedContent.replace(("%CONNECT_COLOR_" + String(settingsManager.getColorSettings().connectColor) + "%"), selected);
-  processedContent.replace(("%CONNECT_SEQUENCE_" + String(settingsManager.getColorSettings().connectSequence) + "%"), checked);
-  processedContent.replace(("%WIFI_COLOR_" + String(settingsManager.getColorSettings().wifiColor) + "%"), selected);
-  processedContent.replace(("%WIFI_SEQUENCE_" + String(settingsManager.getColorSettings().wifiSequence) + "%"), checked);
-  processedContent.replace(("%ERROR_COLOR_" + String(settingsManager.getColorSettings().errorColor) + "%"), selected);
-  processedContent.replace(("%ERROR_SEQUENCE_" + String(settingsManager.getColorSettings().errorSequence) + "%"), checked);
-
-  return processedContent;
-}
-
-// send LastMessage to websocket clients
+String getSensorName(int index) {
+  return getSensorName(sensors[index]);
+}
+
+String getSensorOptions(int selectedIndex) {
+  String options = "";
+  for (int i=0; i<sensorCount; i++)
+    options += String("<option value=\"") + i + "\"" + ((i == selectedIndex) ? " selected" : "") + ">" + getSensorName(i) + "</option>";
+  return options;
+}
+
+/* placeholders of the html pages, order must match the Placeholder enum. Keys ending with "_" have a numeric suffix */
+enum class Placeholder { logMessages, logLatest, fingerList, sensorIndex, sensorCapacity, sensorOptions, sensorSelectHidden, hostname, versionInfo,
+  wifiSsid, wifiPassword, dhcpSetting, localIp, gatewayIp, subnetMask, dnsIp0, dnsIp1,
+  mqttServer, mqttPort, mqttUsername, mqttPassword, mqttRootTopic, ntpServer, webPageUsername, webPagePassword,
+  activeColor, activeSequence, scanColor, scanSequence, matchColor, matchSequence, enrollColor, enrollSequence,
+  connectColor, connectSequence, wifiColor, wifiSequence, errorColor, errorSequence };
+const char* const placeholderKeys[] = { "LOGMESSAGES", "LOG_LATEST", "FINGERLIST", "SENSOR_INDEX", "SENSOR_CAPACITY", "SENSOR_OPTIONS", "SENSOR_SELECT_HIDDEN", "HOSTNAME", "VERSIONINFO",
+  "WIFI_SSID", "WIFI_PASSWORD", "DHCP_SETTING_", "LOCAL_IP", "GATEWAY_IP", "SUBNET_MASK", "DNS_IP0", "DNS_IP1",
+  "MQTT_SERVER", "MQTT_PORT", "MQTT_USERNAME", "MQTT_PASSWORD", "MQTT_ROOTTOPIC", "NTP_SERVER", "WEBPAGE_USERNAME", "WEBPAGE_PASSWORD",
+  "ACTIVE_COLOR_", "ACTIVE_SEQUENCE_", "SCAN_COLOR_", "SCAN_SEQUENCE_", "MATCH_COLOR_", "MATCH_SEQUENCE_", "ENROLL_COLOR_", "ENROLL_SEQUENCE_",
+  "CONNECT_COLOR_", "CONNECT_SEQUENCE_", "WIFI_COLOR_", "WIFI_SEQUENCE_", "ERROR_COLOR_", "ERROR_SEQUENCE_" };
+TemplateRenderer templateRenderer(placeholderKeys, sizeof(placeholderKeys) / sizeof(placeholderKeys[0]));
+
+/* settings are copied once per page, not once per placeholder */
+struct PageSettings {
+  WifiSettings wifi;
+  AppSettings app;
+  WebPageSettings webPage;
+  ColorSettings colors;
+  int sensorIndex;
+};
+
+/* for security reasons passwords will not leave the device once configured */
+const char* maskPassword(const String& password) {
+  return password.isEmpty() ? "" : "********";
+}
+
+/* the options are fetched from the sensor task page by page and streamed, the whole list never exists as one String */
+char fingerOptionsPage[1024]; // the web server handles one request at a time
+
+void writeFingerListOptions(FingerprintManager& manager, TemplateOutput& out) {
+  int offset = 0;
+  size_t length;
+  int count;
+  while ((count = manager.writeFingerListAsHtmlOptions(fingerOptionsPage, sizeof(fingerOptionsPage), offset, length)) > 0) {
+    out.write(fingerOptionsPage, length);
+    offset += count;
+  }
+}
+
+void resolvePlaceholder(const PageSettings& settings, Placeholder key, uint8_t param, TemplateOutput& out) {
+  FingerprintManager &manager = sensors[settings.sensorIndex].manager;
+  const ColorSettings &colors = settings.colors;
+  switch (key)
+  {
+  case Placeholder::logMessages: out.write(getLogMessagesAsHtml()); break;
+  case Placeholder::logLatest: out.write(String(logBuffer.getLatestSeq())); break;
+  case Placeholder::fingerList: writeFingerListOptions(manager, out); break;
+  case Placeholder::sensorIndex: out.write(String(settings.sensorIndex)); break;
+  case Placeholder::sensorCapacity: out.write(String(manager.getCapacity())); break;
+  case Placeholder::sensorOptions: out.write(getSensorOptions(settings.sensorIndex)); break;
+  case Placeholder::sensorSelectHidden: out.write((sensorCount > 1) ? "" : "hidden"); break;
+  case Placeholder::hostname: out.write(settings.wifi.hostname); break;
+  case Placeholder::versionInfo: out.write(VersionInfo); break;
+  case Placeholder::wifiSsid: out.write(settings.wifi.ssid); break;
+  case Placeholder::wifiPassword: out.write(maskPassword(settings.wifi.password)); break;
+  case Placeholder::dhcpSetting: if (param == (int)settings.wifi.dhcp_setting) out.write(checked); break;
+  case Placeholder::localIp: out.write(settings.wifi.localIP.toString()); break;
+  case Placeholder::gatewayIp: out.write(settings.wifi.gatewayIP.toString()); break;
+  case Placeholder::subnetMask: out.write(settings.wifi.subnetMask.toString()); break;
+  case Placeholder::dnsIp0: out.write(settings.wifi.dnsIP0.toString()); break;
+  case Placeholder::dnsIp1: out.write(settings.wifi.dnsIP1.toString()); break;
+  case Placeholder::mqttServer: out.write(settings.app.mqttServer); break;
+  case Placeholder::mqttPort: out.write(String(settings.app.mqttPort)); break;
+  case Placeholder::mqttUsername: out.write(settings.app.mqttUsername); break;
+  case Placeholder::mqttPassword: out.write(maskPassword(settings.app.mqttPassword)); break;
+  case Placeholder::mqttRootTopic: out.write(settings.app.mqttRootTopic); break;
+  case Placeholder::ntpServer: out.write(settings.app.ntpServer); break;
+  case Placeholder::webPageUsername: out.write(settings.webPage.webPageUsername); break;
+  case Placeholder::webPagePassword: out.write(maskPassword(settings.webPage.webPagePassword)); break;
+  // color/sequence options: only the one matching the current setting gets selected/checked
+  case Placeholder::activeColor: if (param == colors.activeColor) out.write(selected); break;
+  case Placeholder::activeSequence: if (param == colors.activeSequence) out.write(checked); break;
+  case Placeholder::scanColor: if (param == colors.scanColor) out.write(selected); break;
+  case Placeholder::scanSequence: if (param == colors.scanSequence) out.write(checked); break;
+  case Placeholder::matchColor: if (param == colors.matchColor) out.write(selected); break;
+  case Placeholder::matchSequence: if (param == colors.matchSequence) out.write(checked); break;
+  case Placeholder::enrollColor: if (param == colors.enrollColor) out.write(selected); break;
+  case Placeholder::enrollSequence: if (param == colors.enrollSequence) out.write(checked); break;
+  case Placeholder::connectColor: if (param == colors.connectColor) out.write(selected); break;
+  case Placeholder::connectSequence: if (param == colors.connectSequence) out.write(checked); break;
+  case Placeholder::wifiColor: if (param == colors.wifiColor) out.write(selected); break;
+  case Placeholder::wifiSequence: if (param == colors.wifiSequence) out.write(checked); break;
+  case Placeholder::errorColor: if (param == colors.errorColor) out.write(selected); break;
+  case Placeholder::errorSequence: if (param == colors.errorSequence) out.write(checked); break;
+  }
+}
+
+esp_err_t sendNotModified(PsychicRequest *request, const String& etag, const char *cacheControl) {
+  PsychicResponse response(request);
+  response.setCode(304);
+  response.addHeader("ETag", etag.c_str());
+  response.addHeader("Cache-Control", cacheControl);
+  return response.send();
+}
+
+bool isNotModified(PsychicRequest *request, const String& etag) {
+  return request->hasHeader("If-None-Match") && request->header("If-None-Match").equals(etag);
+}
+
+/*
+  Version of a rendered page: the content only changes with the settings, the log messages and the finger list shown.
+  Weak ETag, because it's derived from these counters and not from the content. All three are safe to read from the web
+  server task (settings lock, log buffer lock, finger list generation published by the sensor task). They are read before
+  the page is rendered, so a change during rendering gives content newer than the ETag, which only costs one more render.
+*/
+String getPageEtag(int sensorIndex) {
+  char etag[48];
+  snprintf(etag, sizeof(etag), "W/\"%08x-%x-%x-%x\"", (unsigned int)bootId, (unsigned int)settingsManager.getGeneration(),
+    (unsigned int)logBuffer.getLatestSeq(), (unsigned int)sensors[sensorIndex].manager.getFingerListGeneration());
+  return String(etag);
+}
+
+/* render a html page from LittleFS as chunked response, ESP_ERR_NOT_FOUND if the file does not exist (nothing sent yet) */
+esp_err_t renderPage(PsychicRequest *request, const char *fileName, int status = 200) {
+  int sensorIndex = getSensorIndex(request);
+  String etag;
+  if (status == 200) {
+    etag = getPageEtag(sensorIndex);
+    if (isNotModified(request, etag))
+      return sendNotModified(request, etag, "no-cache");
+  }
+  PageSettings settings = { settingsManager.getWifiSettings(), settingsManager.getAppSettings(), settingsManager.getWebPageSettings(),
+    settingsManager.getColorSettings(), sensorIndex };
+  return templateRenderer.render(request, fileName, status, [&settings](int key, uint8_t param, TemplateOutput &out) {
+    resolvePlaceholder(settings, (Placeholder)key, param, out);
+  }, etag);
+}
+
+/* strong ETags of static files (CRC32 of the file served), calculated once per boot */
+struct StaticFileEtag {
+  String path;
+  String etag;
+};
+std::vector<StaticFileEtag> staticFileEtags;
+
+String getStaticFileEtag(const String& path) {
+  for (const StaticFileEtag &entry : staticFileEtags) {
+    if (entry.path.equals(path))
+      return entry.etag;
+  }
+  File file = LittleFS.open(path, "r");
+  if (!file)
+    return "";
+  uint32_t crc = 0;
+  uint8_t buffer[512];
+  size_t length;
+  while ((length = file.read(buffer, sizeof(buffer))) > 0)
+    crc = crc32_le(crc, buffer, length);
+  file.close();
+  char etag[16];
+  snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned int)crc);
+  staticFileEtags.push_back({ path, String(etag) });
+  return String(etag);
+}
+
+/*
+  Static assets: css/js are stored only gzip compressed by the build (scripts/gzip_data.py), an uncompressed file is sent
+  only if it exists (uploaded by hand). Long-lived cacheable, after expiry the browser revalidates with If-None-Match.
+*/
+esp_err_t serveStaticFile(PsychicRequest *request, const String& path, const char *contentType) {
+  const char *cacheControl = "public, max-age=2592000"; // 30 days
+  String gzipPath = path + ".gz";
+  bool acceptsGzip = request->hasHeader("Accept-Encoding") && request->header("Accept-Encoding").indexOf("gzip") >= 0;
+  bool gzip = LittleFS.exists(gzipPath) && (acceptsGzip || !LittleFS.exists(path));
+  String servedPath = gzip ? gzipPath : path;
+  String etag = getStaticFileEtag(servedPath);
+  if (etag.isEmpty())
+    return request->reply(404, "text/plain", "File not found");
+  if (isNotModified(request, etag))
+    return sendNotModified(request, etag, cacheControl);
+
+  PsychicFileResponse response(request, LittleFS, servedPath, contentType);
+  if (gzip)
+    response.addHeader("Content-Encoding", "gzip");
+  response.addHeader("Vary", "Accept-Encoding");
+  response.addHeader("ETag", etag.c_str());
+  response.addHeader("Cache-Control", cacheControl);
+  return response.send();
+}
+
+// log a message, it's sent to the browsers by the logSender task and published by MQTT in loop()
 void notifyClients(String message) {
-  String messageWithTimestamp = "[" + getTimestampString() + "]: " + message;
-  Serial.println(messageWithTimestamp);
-  addLogMessage(messageWithTimestamp);
-  events.send(getLogMessagesAsHtml().c_str(),"message",millis(),1000);
-  
-  String mqttRootTopic = settingsManager.getAppSettings().mqttRootTopic;
-  mqttClient.publish((String(mqttRootTopic) + "/lastLogMessage").c_str(), message.c_str());
+  uint32_t seq = logBuffer.append(message.c_str());
+  LogBuffer::Entry entry;
+  if (logBuffer.read(seq, entry))
+    Serial.println(logBuffer.format(entry));
+  if (logSenderTask != NULL)
+    xTaskNotifyGive(logSenderTask);
+  if (loopTask != NULL)
+    xTaskNotifyGive(loopTask);
 }
 
-void updateClientsFingerlist(String fingerlist) {
+void updateClientsFingerlist(String fingerlist, int sensorIndex = 0) {
   Serial.println("New fingerlist was sent to clients");
-  events.send(fingerlist.c_str(),"fingerlist",millis(),1000);
+  String eventName = (sensorIndex == 0) ? String("fingerlist") : String("fingerlist") + sensorIndex;
+  broadcastEvent(eventName, fingerlist);
+}
+
+
+const char* getEnrollStatusName(EnrollStatus status) {
+  switch (status)
+  {
+  case EnrollStatus::waitForFinger: return "waitForFinger";
+  case EnrollStatus::sampleTaken: return "sampleTaken";
+  case EnrollStatus::liftFinger: return "liftFinger";
+  case EnrollStatus::done: return "done";
+  case EnrollStatus::failed: return "failed";
+  case EnrollStatus::timeout: return "timeout";
+  case EnrollStatus::cancelled: return "cancelled";
+  }
+  return "unknown";
+}
+
+/* called by the sensor task on every enrollment step, hands the step over to loop() */
+void queueEnrollProgress(int sensorIndex, const EnrollProgress& progress) {
+  EnrollEvent event = { sensorIndex, progress };
+  if (xQueueSend(enrollEventQueue, &event, 0) != pdTRUE)
+    Serial.println("Enrollment progress dropped, queue full");
+  if (loopTask != NULL)
+    xTaskNotifyGive(loopTask);
+}
+
+/* called by loop(), sent as "enroll" event to the web clients and by MQTT */
+void updateClientsEnrollProgress(const Sensor& sensor, const EnrollProgress& progress) {
+  String json = String("{\"sensor\":") + (int)(&sensor - sensors) + ",\"id\":" + progress.id + ",\"sample\":" + progress.sample + ",\"samples\":" + progress.samples
+    + ",\"status\":\"" + getEnrollStatusName(progress.status) + "\",\"returnCode\":" + progress.returnCode + "}";
+  broadcastEvent("enroll", json);
+
+  String mqttRootTopic = settingsManager.getAppSettings().mqttRootTopic;
+  scanPublisher.publish(String(mqttRootTopic) + sensor.mqttSubTopic + "/enrollProgress", json.c_str());
+}
+
+
+/* validate input and start enrollment, the sensor task will report the result */
+void doEnroll(int sensorIndex, const String& enrollId, const String& enrollName)
+{
+  int id = enrollId.toInt();
+  if (id < 1 || id > sensors[sensorIndex].manager.getCapacity()) {
+    notifyClients("Invalid memory slot id '" + enrollId + "'");
+    return;
+  }
+
+  sensors[sensorIndex].manager.startEnrollment(id, enrollName, [sensorIndex](NewFinger finger){
+    if (finger.enrollResult == EnrollResult::ok) {
+      notifyClients("Enrollment successfull. You can now use your new finger for scanning.");
+      updateClientsFingerlist(sensors[sensorIndex].manager.getFingerListAsHtmlOptionList(), sensorIndex);
+    }  else if (finger.enrollResult == EnrollResult::error) {
+      notifyClients(String("Enrollment failed. (Code ") + finger.returnCode + ")");
+    }
+  });
 }
 
 
+/* all connected sensors get the same pairing code */
 bool doPairing() {
   String newPairingCode = settingsManager.generateNewPairingCode();
 
-  if (fingerManager.setPairingCode(newPairingCode)) {
-    AppSettings settings = settingsManager.getAppSettings();
-    settings.sensorPairingCode = newPairingCode;
-    settings.sensorPairingValid = true;
-    settingsManager.saveAppSettings(settings);
+  bool paired = true;
+  for (int i=0; i<sensorCount; i++) {
+    if ((i == 0 || sensors[i].manager.connected) && !sensors[i].manager.setPairingCode(newPairingCode))
+      paired = false;
+  }
+  if (paired) {
+    settingsManager.updateAppSettings([&newPairingCode](AppSettings &settings) {
+      settings.sensorPairingCode = newPairingCode;
+      settings.sensorPairingValid = true;
+    });
     notifyClients("Pairing successful.");
     return true;
   } else {
@@ -210,7 +627,8 @@ bool doPairing() {
 }
 
 
-bool checkPairingValid() {
+/* sensorIndex -1: check all sensors */
+bool checkPairingValid(int sensorIndex = -1) {
   AppSettings settings = settingsManager.getAppSettings();
 
    if (!settings.sensorPairingValid) {
@@ -223,38 +641,75 @@ bool checkPairingValid() {
      }
    }
 
-  String actualSensorPairingCode = fingerManager.getPairingCode();
-  //Serial.println("Awaited pairing code: " + settings.sensorPairingCode);
-  //Serial.println("Actual pairing code: " + actualSensorPairingCode);
+  for (int i=0; i<sensorCount; i++) {
+    if ((sensorIndex >= 0 && i != sensorIndex) || (i > 0 && !sensors[i].manager.connected))
+      continue; // an additional sensor that is not connected can't send matches anyway
+    String actualSensorPairingCode = sensors[i].manager.getPairingCode();
+    //Serial.println("Awaited pairing code: " + settings.sensorPairingCode);
+    //Serial.println("Actual pairing code: " + actualSensorPairingCode);
 
-  if (actualSensorPairingCode.equals(settings.sensorPairingCode))
-    return true;
-  else {
+    if (actualSensorPairingCode.equals(settings.sensorPairingCode))
+      continue;
     if (!actualSensorPairingCode.isEmpty()) { 
       // An empty code means there was a communication problem. So we don't have a valid code, but maybe next read will succeed and we get one again.
       // But here we just got an non-empty pairing code that was different to the awaited one. So don't expect that will change in future until repairing was done.
-      // -> invalidate pairing for security reasons
-      AppSettings settings = settingsManager.getAppSettings();
-      settings.sensorPairingValid = false;
-      settingsManager.saveAppSettings(settings);
+      // -> invalidate pairing for security reasons (only the flag, the boot tasks read the other settings meanwhile)
+      settingsManager.updateAppSettings([](AppSettings &settings) { settings.sensorPairingValid = false; });
     }
     return false;
   }
+  return true;
 }
 
 
-bool initWifi() {
-  // Connect to Wi-Fi
+/*
+  Pairing talks to every sensor and saves the settings to NVS, which takes too long for loop() and the web server. Both
+  leave it to a one-shot task, the result is reported by notifyClients(). The task changes only the pairing fields by
+  updateAppSettings(), other tasks keep reading the settings meanwhile.
+*/
+volatile bool pairingTaskRunning = false;
+
+void pairingTask(void *arg) {
+  if ((PairingJob)(intptr_t)arg == PairingJob::pair) {
+    doPairing();
+  } else {
+    settingsManager.updateAppSettings([](AppSettings &settings) { settings.sensorPairingValid = false; });
+  }
+  pairingTaskRunning = false;
+  vTaskDelete(NULL);
+}
+
+bool startPairingTask(PairingJob job) {
+  if (pairingTaskRunning)
+    return false;
+  pairingTaskRunning = true;
+  if (xTaskCreate(pairingTask, "pairing", 4096, (void*)(intptr_t)job, 1, NULL) != pdPASS) {
+    pairingTaskRunning = false;
+    return false;
+  }
+  return true;
+}
+
+/* start association in background, initWifi() waits for it */
+void startWifi() {
   WifiSettings wifiSettings = settingsManager.getWifiSettings();
   WiFi.setHostname(wifiSettings.hostname.c_str()); //define hostname
   WiFi.mode(WIFI_STA);
   WiFi.begin(wifiSettings.ssid.c_str(), wifiSettings.password.c_str());
+}
+
+bool initWifi() {
+  // Wait for Wi-Fi connection (max. 30s)
+  WifiSettings wifiSettings = settingsManager.getWifiSettings();
   int counter = 0;
   while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.println("Waiting for WiFi connection...");
+    vTaskDelay(pdMS_TO_TICKS(100));
+    if (currentMode == Mode::wificonfig)
+      return false; // finger on sensor during startup, config access point replaces the station
     counter++;
-    if (counter > 30)
+    if (counter % 10 == 0)
+      Serial.println("Waiting for WiFi connection...");
+    if (counter > 300)
       return false;
   }
   if (!settingsManager.getWifiSettings().dhcp_setting){
@@ -310,25 +765,36 @@ void initWiFiAccessPointForConfiguration() {
   Serial.println(WifiConfigIp); 
 }
 
+/* first sensor on top level, additional sensors by their name */
+String getMetricsJson()
+{
+  String json = String("{\"scan\":") + fingerManager.getMetrics().toJson()
+    + ",\"search\":\"" + fingerManager.getSearchStats() + "\"";
+  for (int i=1; i<sensorCount; i++)
+    json += String(",\"") + getSensorName(i) + "\":{\"scan\":" + sensors[i].manager.getMetrics().toJson()
+      + ",\"search\":\"" + sensors[i].manager.getSearchStats() + "\"}";
+  return json + ",\"loop\":{\"maxMicros\":" + loopMaxMicros + ",\"overruns\":" + loopOverrunCount + "}"
+    + ",\"power\":" + powerManager.getReport(fingerManager.getMetrics().getHistogram(ScanStage::touchDetect))
+    + ",\"heap\":{\"free\":" + ESP.getFreeHeap() + ",\"minFree\":" + ESP.getMinFreeHeap()
+    + ",\"largestFreeBlock\":" + heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) + "}"
+    + ",\"boot\":" + bootTimeline.toJson() + ",\"pages\":" + templateRenderer.getStatsJson()
+    + ",\"log\":{\"capacity\":" + logBuffer.getCapacity() + ",\"latest\":" + logBuffer.getLatestSeq()
+    + ",\"oldest\":" + logBuffer.getOldestSeq() + ",\"bytes\":" + sizeof(logSlots) + "}"
+    + ",\"api\":{\"fingersLastMicros\":" + apiFingersLastMicros + ",\"fingersMaxMicros\":" + apiFingersMaxMicros + "}}";
+}
+
 // Function to send a html file as a response to a request
 esp_err_t sendHTML(PsychicRequest *request, String fileName) {
-  File file = LittleFS.open(fileName.c_str(), "r");
-  if (!file) {
+  esp_err_t result = renderPage(request, fileName.c_str());
+  if (result == ESP_ERR_NOT_FOUND)
     return request->reply(404, "text/plain", "File not found");
-  }
-  String fileContent;
-  while (file.available()) {
-    fileContent += (char)file.read();
-  }
-  file.close();
-  // Process the file content using the processor function
-  String processedContent = processFile(fileContent);
-  return request->reply(processedContent.c_str());
+  return result;
 }
 
 void onOTAStart() {
   // Log when OTA has started
   Serial.println("OTA update started!");
+  powerManager.acquireCpuMax();
 }
 
 void onOTAProgress(size_t current, size_t final) {
@@ -340,6 +806,7 @@ void onOTAProgress(size_t current, size_t final) {
 }
 
 void onOTAEnd(bool success) {
+  powerManager.releaseCpuMax();
   // Log when OTA has finished
   if (success) {
     Serial.println("OTA update finished successfully!");
@@ -348,6 +815,138 @@ void onOTAEnd(bool success) {
   }
 }
 
+esp_err_t sendJsonError(PsychicRequest *request, int status, const char *message) {
+  char buffer[128];
+  JsonWriter json(buffer, sizeof(buffer));
+  json.beginObject();
+  json.key("apiVersion"); json.value(apiVersion);
+  json.key("error"); json.value(message);
+  json.endObject();
+  return request->reply(status, "application/json", json.getData());
+}
+
+/* 404 for a slot without finger, 500 if the sensor or NVS failed, 503 while the sensor task is busy with a long job */
+esp_err_t sendFingerUpdateError(PsychicRequest *request, FingerUpdateResult result) {
+  switch (result)
+  {
+  case FingerUpdateResult::notEnrolled: return sendJsonError(request, 404, "finger not enrolled");
+  case FingerUpdateResult::sensorError: return sendJsonError(request, 500, "sensor error");
+  case FingerUpdateResult::saveFailed: return sendJsonError(request, 500, "saving the finger names failed");
+  case FingerUpdateResult::busy: return sendJsonError(request, 503, "sensor busy");
+  default: return sendJsonError(request, 500, "unknown error");
+  }
+}
+
+esp_err_t sendJson(PsychicRequest *request, JsonWriter &json) {
+  if (json.hasOverflow())
+    return sendJsonError(request, 500, "response too large");
+  return request->reply(200, "application/json", json.getData());
+}
+
+/* id of /api/fingers/<id>, 0 if missing or out of the slot range of the sensor */
+int getApiFingerId(PsychicRequest *request, int sensorIndex) {
+  String uri = request->uri();
+  int start = uri.lastIndexOf('/') + 1;
+  int end = uri.indexOf('?', start);
+  int id = uri.substring(start, (end < 0) ? uri.length() : end).toInt();
+  if (id <= 0 || id > sensors[sensorIndex].manager.getCapacity())
+    return 0;
+  return id;
+}
+
+void writeStatusJson(JsonWriter &json) {
+  json.beginObject();
+  json.key("apiVersion"); json.value(apiVersion);
+  json.key("firmware"); json.value(VersionInfo);
+  json.key("uptimeMillis"); json.value(millis());
+  json.key("mode"); json.value((currentMode == Mode::wificonfig) ? "wificonfig" : "scan");
+  json.key("wifi");
+  json.beginObject();
+  json.key("connected"); json.value(WiFi.status() == WL_CONNECTED);
+  json.key("rssi"); json.value((int)WiFi.RSSI());
+  json.key("ip"); json.value(WiFi.localIP().toString());
+  json.endObject();
+  json.key("mqttConnected"); json.value((bool)mqttConnected);
+  json.key("pairingValid"); json.value(settingsManager.getAppSettings().sensorPairingValid);
+  json.key("sensors");
+  json.beginArray();
+  for (int i=0; i<sensorCount; i++) {
+    FingerprintManager &manager = sensors[i].manager;
+    json.beginObject();
+    json.key("index"); json.value(i);
+    json.key("name"); json.value(getSensorName(i));
+    json.key("connected"); json.value(manager.connected);
+    json.key("capacity"); json.value(manager.getCapacity());
+    json.key("fingers"); json.value(manager.getFingerCount());
+    json.key("enrolling"); json.value(manager.isEnrolling());
+    json.endObject();
+  }
+  json.endArray();
+  json.key("freeHeap"); json.value(ESP.getFreeHeap());
+  json.endObject();
+}
+
+/* log messages newer than the sequence number "since", oldest first. "latest" is the "since" for the next poll */
+void writeLogsJson(JsonWriter &json, uint32_t since) {
+  json.beginObject();
+  json.key("apiVersion"); json.value(apiVersion);
+  uint32_t latest = logBuffer.getLatestSeq();
+  json.key("messages");
+  json.beginArray();
+  json.reserve(32); // "latest" must fit after a full page
+  LogBuffer::Entry entry;
+  for (uint32_t seq = max(since + 1, logBuffer.getOldestSeq()); seq <= latest; seq++) {
+    if (!logBuffer.read(seq, entry))
+      continue; // overwritten meanwhile
+    size_t mark = json.mark();
+    json.beginObject();
+    json.key("seq"); json.value(seq);
+    json.key("time"); json.value((unsigned long)entry.time);
+    json.key("text"); json.value(logBuffer.format(entry));
+    json.endObject();
+    if (json.hasOverflow()) {
+      json.rollback(mark);
+      latest = seq - 1; // the remaining messages are returned by the next poll
+      break;
+    }
+  }
+  json.reserve(0);
+  json.endArray();
+  json.key("latest"); json.value(latest);
+  json.endObject();
+}
+
+/* one page of the finger list, "next" is the offset of the following page (null on the last page). false if the sensor task is busy */
+bool writeFingersJson(JsonWriter &json, int sensorIndex, int offset, int limit) {
+  FingerprintManager &manager = sensors[sensorIndex].manager;
+  int64_t startMicros = esp_timer_get_time();
+  json.beginObject();
+  json.key("apiVersion"); json.value(apiVersion);
+  json.key("sensor"); json.value(sensorIndex);
+  json.key("capacity"); json.value(manager.getCapacity());
+  json.key("offset"); json.value(offset);
+  json.key("fingers");
+  json.beginArray();
+  int total = 0;
+  json.reserve(64); // a full page must still fit total and next
+  int count = manager.writeFingerList(json, offset, limit, total);
+  json.reserve(0);
+  if (count < 0)
+    return false;
+  json.endArray();
+  json.key("total"); json.value(total);
+  json.key("next");
+  if (offset + count < total)
+    json.value(offset + count);
+  else
+    json.valueNull();
+  json.endObject();
+  apiFingersLastMicros = esp_timer_get_time() - startMicros;
+  if (apiFingersLastMicros > apiFingersMaxMicros)
+    apiFingersMaxMicros = apiFingersLastMicros;
+  return true;
+}
+
 void startWebserver(){
   
   // Initialize LittleFS
@@ -366,7 +965,9 @@ void startWebserver(){
   //server.config is an ESP-IDF httpd_config struct
   //see: https://docs.espressif.com/projects/esp-idf/en/v4.4.6/esp32/api-reference/protocols/esp_http_server.html#_CPPv412httpd_config
   //increase maximum number of uri endpoint handlers (.on() calls)
-  webServer.config.max_uri_handlers = 20;
+  webServer.config.max_uri_handlers = 32;
+
+  // every handler holds a CpuMaxLock while it runs: requests are served at max. CPU frequency, open connections (event streams, keep-alive) don't keep it there
 
   //look up our keys?
   #ifdef PSY_ENABLE_SSL
@@ -397,7 +998,7 @@ void startWebserver(){
   #ifdef PSY_ENABLE_SSL
     if (app_enable_ssl)
       {
-        webServer.ssl_config.httpd.max_uri_handlers = 20; //maximum number of uri handlers (.on() calls)
+        webServer.ssl_config.httpd.max_uri_handlers = 32; //maximum number of uri handlers (.on() calls)
 
         webServer.listen(443, server_cert.c_str(), server_key.c_str());
         //this creates a 2nd server listening on port 80 and redirects all requests HTTPS
@@ -433,10 +1034,12 @@ void startWebserver(){
     // =================
 
     webServer.on("/", HTTP_GET, [](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       return sendHTML(request, "/wificonfig.html");
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/save", HTTP_GET, [](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("hostname")){
         Serial.println("Save wifi config");
         WifiSettings settings = settingsManager.getWifiSettings();
@@ -458,48 +1061,87 @@ void startWebserver(){
     // normal operation mode
     // =======================
 
+    // a new client gets the log messages after those rendered into its page, a reconnecting one those after Last-Event-ID
     events.onOpen([](PsychicEventSourceClient *client){
-      if(client->lastId()){
-        Serial.printf("Client reconnected! Last message ID it got was: %u\n", client->lastId());
+      uint32_t lastId = client->lastId();
+      uint32_t latest = logBuffer.getLatestSeq();
+      if (lastId)
+        Serial.printf("Client reconnected! Last message ID it got was: %u\n", (unsigned int)lastId);
+      if (lastId == 0)
+        lastId = latest;
+      else if (lastId > latest)
+        lastId = 0; // id of an earlier boot, all messages since the reboot
+      xSemaphoreTake(logLock, portMAX_DELAY);
+      int slot = -1;
+      for (int i=0; i<maxLogClients && slot < 0; i++) {
+        if (logClients[i].socket < 0)
+          slot = i;
       }
-      // send event with message "ready", id current millis
-      // and set reconnect delay to 1 second
-      client->send(getLogMessagesAsHtml().c_str(),"message",millis(),1000);
+      if (slot >= 0)
+        logClients[slot] = { client->server(), client->socket(), lastId, broadcastSeq, false };
+      xSemaphoreGive(logLock);
+      if (slot < 0)
+        Serial.println("Too many event clients, log messages are not sent to the new client");
+      else
+        xTaskNotifyGive(logSenderTask);
     });
 
+    events.onClose([](PsychicEventSourceClient *client){
+      xSemaphoreTake(logLock, portMAX_DELAY);
+      for (int i=0; i<maxLogClients; i++) {
+        if (logClients[i].socket == client->socket() && logClients[i].server == client->server())
+          logClients[i].socket = -1;
+      }
+      xSemaphoreGive(logLock);
+    });
+
+    webServer.on("/events", &events);
+
     webServer.on("/", HTTP_GET, [](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       return sendHTML(request, "/index.html");
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/enroll", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      int sensorIndex = getSensorIndex(request);
       if(request->hasParam("startEnrollment")){
-        enrollId = request->getParam("newFingerprintId")->value();
-        enrollName = request->getParam("newFingerprintName")->value();
-        currentMode = Mode::enroll;
+        doEnroll(sensorIndex, request->getParam("newFingerprintId")->value(), request->getParam("newFingerprintName")->value());
+      } else if (request->hasParam("cancelEnrollment")) {
+        sensors[sensorIndex].manager.cancelEnrollment();
       }
-      return request->redirect("/");
+      return request->redirect(("/?sensor=" + String(sensorIndex)).c_str());
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/editFingerprints", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      int sensorIndex = getSensorIndex(request);
       if(request->hasParam("selectedFingerprint")){
         if(request->hasParam("btnDelete"))
         {
           int id = request->getParam("selectedFingerprint")->value().toInt();
-          waitForMaintenanceMode();
-          fingerManager.deleteFinger(id);
-          currentMode = Mode::scan;
+          FingerUpdateResult result = sensors[sensorIndex].manager.deleteFinger(id);
+          if (result == FingerUpdateResult::notEnrolled)
+            notifyClients(String("Finger #") + id + " is not enrolled.");
+          else if (result == FingerUpdateResult::busy)
+            notifyClients("Sensor is busy, please try again later.");
         }
         else if (request->hasParam("btnRename"))
         {
           int id = request->getParam("selectedFingerprint")->value().toInt();
           String newName = request->getParam("renameNewName")->value();
-          fingerManager.renameFinger(id, newName);
+          FingerUpdateResult result = sensors[sensorIndex].manager.renameFinger(id, newName);
+          if (result == FingerUpdateResult::notEnrolled)
+            notifyClients(String("Finger #") + id + " is not enrolled, only fingers stored on the sensor can be renamed.");
+          else if (result == FingerUpdateResult::busy)
+            notifyClients("Sensor is busy, please try again later.");
         }
       }
-      return request->redirect("/");
+      return request->redirect(("/?sensor=" + String(sensorIndex)).c_str());
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/colorSettings", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("btnSaveColorSettings")){
         Serial.println("Save color and sequence settings");
         ColorSettings colorSettings = settingsManager.getColorSettings();
@@ -526,6 +1168,7 @@ void startWebserver(){
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/wifiSettings", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("btnSaveWiFiSettings")){
         Serial.println("Save wifi config");
         WifiSettings settings = settingsManager.getWifiSettings();
@@ -555,20 +1198,20 @@ void startWebserver(){
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/settings", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("btnSaveSettings")){
         Serial.println("Save settings");
-        AppSettings settings = settingsManager.getAppSettings();
-        settings.mqttServer = request->getParam("mqtt_server")->value();
-        String mqttPortString = request->getParam("mqtt_port")->value();
-        settings.mqttPort = (uint16_t) mqttPortString.toInt();
-        settings.mqttUsername = request->getParam("mqtt_username")->value();
-        if (request->getParam("mqtt_password")->value().equals("********")) // password is replaced by wildcards when given to the browser, so if the user didn't changed it, don't save it
-          settings.mqttPassword = settingsManager.getAppSettings().mqttPassword; // use the old, already saved, one
-        else
-          settings.mqttPassword = request->getParam("mqtt_password")->value();
-        settings.mqttRootTopic = request->getParam("mqtt_rootTopic")->value();
-        settings.ntpServer = request->getParam("ntpServer")->value();
-        settingsManager.saveAppSettings(settings);
+        // only the fields of the form are changed, the pairing task may save the pairing state meanwhile
+        settingsManager.updateAppSettings([request](AppSettings &settings) {
+          settings.mqttServer = request->getParam("mqtt_server")->value();
+          String mqttPortString = request->getParam("mqtt_port")->value();
+          settings.mqttPort = (uint16_t) mqttPortString.toInt();
+          settings.mqttUsername = request->getParam("mqtt_username")->value();
+          if (!request->getParam("mqtt_password")->value().equals("********")) // password is replaced by wildcards when given to the browser, so if the user didn't changed it, keep the old one
+            settings.mqttPassword = request->getParam("mqtt_password")->value();
+          settings.mqttRootTopic = request->getParam("mqtt_rootTopic")->value();
+          settings.ntpServer = request->getParam("ntpServer")->value();
+        });
         shouldReboot = true;
         return request->redirect("/settings");
       } else if(request->hasParam("btnSaveWebPageSettings"))
@@ -589,10 +1232,12 @@ void startWebserver(){
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/pairing", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("btnDoPairing"))
       {
         Serial.println("Do (re)pairing");
-        doPairing();
+        if (!startPairingTask(PairingJob::pair))
+          notifyClients("Pairing is already in progress.");
         return request->redirect("/");  
       } else {
         return sendHTML(request, "/settings.html");
@@ -600,11 +1245,14 @@ void startWebserver(){
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
     webServer.on("/factoryReset", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("btnFactoryReset")){
         notifyClients("Factory reset initiated...");
         
-        if (!fingerManager.deleteAll())
-          notifyClients("Finger database could not be deleted.");
+        for (int i=0; i<sensorCount; i++) {
+          if (!sensors[i].manager.deleteAll())
+            notifyClients("Finger database of " + getSensorName(i) + " could not be deleted.");
+        }
 
         if (!settingsManager.deleteColorSettings())
           notifyClients("Color settings could not be deleted.");
@@ -625,12 +1273,132 @@ void startWebserver(){
       }
     })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
+    webServer.on("/sensorBenchmark", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      // measure command round trip times at each supported sensor baud rate (runs in background for a few seconds, the report is shown in the log)
+      sensors[getSensorIndex(request)].manager.benchmarkBaudRates();
+      return request->reply(202, "text/plain", "Sensor benchmark started, the report is shown in the log.");
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/reconcile", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      // differences between sensor index table and finger names, "start" or "repair" runs a new check in background
+      FingerprintManager &manager = sensors[getSensorIndex(request)].manager;
+      if (request->hasParam("repair"))
+        manager.startReconciliation(true);
+      else if (request->hasParam("start"))
+        manager.startReconciliation(false);
+      String report = manager.getReconcileReport();
+      if (report.isEmpty())
+        return sendJsonError(request, 503, "sensor busy");
+      return request->reply(200, "application/json", report.c_str());
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/sensorDB", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      // sensor replacement: export/import runs in background, progress and result are shown in the log
+      FingerprintManager &manager = sensors[getSensorIndex(request)].manager;
+      if(request->hasParam("btnExportSensorDB")) {
+        manager.exportSensorDB();
+        return request->redirect("/");
+      } else if(request->hasParam("btnImportSensorDB")) {
+        manager.importSensorDB(false);
+        return request->redirect("/");
+      } else if(request->hasParam("btnResumeImportSensorDB")) {
+        manager.importSensorDB(true);
+        return request->redirect("/");
+      } else {
+        if (!LittleFS.exists(manager.getSensorDbFileName()))
+          return request->reply(404, "text/plain", "No export found, export the fingerprints first");
+        PsychicFileResponse response(request, LittleFS, manager.getSensorDbFileName(), "application/octet-stream", true);
+        return response.send();
+      }
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    // JSON API for home automation, see README
+    webServer.on("/api/status", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      JsonWriter json(apiBuffer, sizeof(apiBuffer));
+      writeStatusJson(json);
+      return sendJson(request, json);
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/api/logs", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      JsonWriter json(apiBuffer, sizeof(apiBuffer));
+      uint32_t since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), NULL, 10) : 0;
+      writeLogsJson(json, since);
+      return sendJson(request, json);
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/api/fingers", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      int offset = request->hasParam("offset") ? request->getParam("offset")->value().toInt() : 0;
+      int limit = request->hasParam("limit") ? request->getParam("limit")->value().toInt() : apiDefaultPageSize;
+      if (offset < 0 || limit <= 0 || limit > apiMaxPageSize)
+        return sendJsonError(request, 400, "invalid offset or limit");
+      JsonWriter json(apiBuffer, sizeof(apiBuffer));
+      if (!writeFingersJson(json, getSensorIndex(request), offset, limit))
+        return sendJsonError(request, 503, "sensor busy");
+      return sendJson(request, json);
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/api/fingers/*", HTTP_PUT, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      // rename: new name as parameter "name" or as plain text body
+      int sensorIndex = getSensorIndex(request);
+      int id = getApiFingerId(request, sensorIndex);
+      if (id <= 0)
+        return sendJsonError(request, 404, "invalid finger id");
+      String name = request->hasParam("name") ? request->getParam("name")->value() : request->body();
+      name.trim();
+      if (name.isEmpty() || name.length() > 255)
+        return sendJsonError(request, 400, "invalid name");
+      FingerUpdateResult result = sensors[sensorIndex].manager.renameFinger(id, name);
+      if (result != FingerUpdateResult::ok)
+        return sendFingerUpdateError(request, result);
+      JsonWriter json(apiBuffer, sizeof(apiBuffer));
+      json.beginObject();
+      json.key("apiVersion"); json.value(apiVersion);
+      json.key("id"); json.value(id);
+      json.key("name"); json.value(name);
+      json.endObject();
+      return sendJson(request, json);
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/api/fingers/*", HTTP_DELETE, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      int sensorIndex = getSensorIndex(request);
+      int id = getApiFingerId(request, sensorIndex);
+      if (id <= 0)
+        return sendJsonError(request, 404, "invalid finger id");
+      FingerUpdateResult result = sensors[sensorIndex].manager.deleteFinger(id);
+      if (result != FingerUpdateResult::ok)
+        return sendFingerUpdateError(request, result);
+      JsonWriter json(apiBuffer, sizeof(apiBuffer));
+      json.beginObject();
+      json.key("apiVersion"); json.value(apiVersion);
+      json.key("id"); json.value(id);
+      json.key("deleted"); json.value(true);
+      json.endObject();
+      return sendJson(request, json);
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
+    webServer.on("/metrics", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
+      // latency histograms of all scan stages (values in microseconds)
+      return request->reply(200, "application/json", getMetricsJson().c_str());
+    })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
+
     webServer.on("/deleteAllFingerprints", HTTP_GET, [webPageSettings](PsychicRequest *request){
+      CpuMaxLock cpuMax(powerManager);
       if(request->hasParam("btnDeleteAllFingerprints")){
         notifyClients("Deleting all fingerprints...");
         
-        if (!fingerManager.deleteAll())
-          notifyClients("Finger database could not be deleted.");
+        for (int i=0; i<sensorCount; i++) {
+          if (!sensors[i].manager.deleteAll())
+            notifyClients("Finger database of " + getSensorName(i) + " could not be deleted.");
+        }
         
         return request->redirect("/");
         
@@ -642,32 +1410,26 @@ void startWebserver(){
 
   // common url callbacks
   webServer.on("/reboot", HTTP_GET, [webPageSettings](PsychicRequest *request){
+    CpuMaxLock cpuMax(powerManager);
     shouldReboot = true;
     return request->redirect("/");
   })->setAuthentication(webPageSettings.webPageUsername.c_str(), webPageSettings.webPagePassword.c_str(), BASIC_AUTH, webPageSettings.webPageRealm.c_str(), "You must log in.");
 
   webServer.on("/bootstrap.min.css", HTTP_GET, [](PsychicRequest *request){
-    String filename = "/bootstrap.min.css";
-    PsychicFileResponse response(request, LittleFS, filename, "text/css");
-    return response.send();
+    CpuMaxLock cpuMax(powerManager);
+    return serveStaticFile(request, "/bootstrap.min.css", "text/css");
   });
 
   webServer.on("/logout", HTTP_GET, [](PsychicRequest *request){
-    File file = LittleFS.open("/logout.html", "r");
-    if (!file) {
+    CpuMaxLock cpuMax(powerManager);
+    esp_err_t result = renderPage(request, "/logout.html", 401);
+    if (result == ESP_ERR_NOT_FOUND)
       return request->reply(401, "text/plain", "Successfully logged out!");
-    }
-    String fileContent;
-    while (file.available()) {
-      fileContent += (char)file.read();
-    }
-    file.close();
-    // Process the file content using the processor function
-    String processedContent = processFile(fileContent);
-    return request->reply(401, "text/html", processedContent.c_str());
+    return result;
   });
 
   webServer.onNotFound([](PsychicRequest *request){
+    CpuMaxLock cpuMax(powerManager);
     return request->redirect("/");
   });
 
@@ -687,12 +1449,14 @@ void mqttCallback(char* topic, byte* message, unsigned int length) {
   Serial.println();
 
   // Check incomming message for interesting topics
-  if (String(topic) == String(settingsManager.getAppSettings().mqttRootTopic) + "/ignoreTouchRing") {
-    if(messageTemp == "on"){
-      fingerManager.setIgnoreTouchRing(true);
-    }
-    else if(messageTemp == "off"){
-      fingerManager.setIgnoreTouchRing(false);
+  for (int i=0; i<sensorCount; i++) {
+    if (String(topic) == String(settingsManager.getAppSettings().mqttRootTopic) + sensors[i].mqttSubTopic + "/ignoreTouchRing") {
+      if(messageTemp == "on"){
+        sensors[i].manager.setIgnoreTouchRing(true);
+      }
+      else if(messageTemp == "off"){
+        sensors[i].manager.setIgnoreTouchRing(false);
+      }
     }
   }
 
@@ -717,128 +1481,171 @@ void mqttCallback(char* topic, byte* message, unsigned int length) {
 
 }
 
-void connectMqttClient() {
+/* runs in mqttConnectTask, true if connected */
+bool connectMqttClient() {
   if (!mqttClient.connected() && mqttConfigValid) {
     Serial.print("(Re)connect to MQTT broker...");
     // Attempt to connect
     bool connectResult;
+    AppSettings settings = settingsManager.getAppSettings(); // one snapshot, the pairing task may save meanwhile
     
     // connect with or witout authentication
-    String lastWillTopic = settingsManager.getAppSettings().mqttRootTopic + "/lastLogMessage";
+    String lastWillTopic = settings.mqttRootTopic + "/lastLogMessage";
     String lastWillMessage = "FingerprintDoorbell disconnected unexpectedly";
-    if (settingsManager.getAppSettings().mqttUsername.isEmpty() || settingsManager.getAppSettings().mqttPassword.isEmpty())
+    if (settings.mqttUsername.isEmpty() || settings.mqttPassword.isEmpty())
       connectResult = mqttClient.connect(settingsManager.getWifiSettings().hostname.c_str(),lastWillTopic.c_str(), 1, false, lastWillMessage.c_str());
     else
-      connectResult = mqttClient.connect(settingsManager.getWifiSettings().hostname.c_str(), settingsManager.getAppSettings().mqttUsername.c_str(), settingsManager.getAppSettings().mqttPassword.c_str(), lastWillTopic.c_str(), 1, false, lastWillMessage.c_str());
+      connectResult = mqttClient.connect(settingsManager.getWifiSettings().hostname.c_str(), settings.mqttUsername.c_str(), settings.mqttPassword.c_str(), lastWillTopic.c_str(), 1, false, lastWillMessage.c_str());
 
     if (connectResult) {
       // success
       Serial.println("connected");
       // Subscribe
-      mqttClient.subscribe((settingsManager.getAppSettings().mqttRootTopic + "/ignoreTouchRing").c_str(), 1); // QoS = 1 (at least once)
+      for (int i=0; i<sensorCount; i++)
+        mqttClient.subscribe((settings.mqttRootTopic + sensors[i].mqttSubTopic + "/ignoreTouchRing").c_str(), 1); // QoS = 1 (at least once)
       #ifdef CUSTOM_GPIOS
-        mqttClient.subscribe((settingsManager.getAppSettings().mqttRootTopic + "/customOutput1").c_str(), 1); // QoS = 1 (at least once)
-        mqttClient.subscribe((settingsManager.getAppSettings().mqttRootTopic + "/customOutput2").c_str(), 1); // QoS = 1 (at least once)
+        mqttClient.subscribe((settings.mqttRootTopic + "/customOutput1").c_str(), 1); // QoS = 1 (at least once)
+        mqttClient.subscribe((settings.mqttRootTopic + "/customOutput2").c_str(), 1); // QoS = 1 (at least once)
       #endif
-
-
-
+      if (!bootTimelinePublished) {
+        bootTimeline.mark("mqttConnected");
+        String timeline = bootTimeline.toJson();
+        Serial.println("Boot timeline (ms since reset): " + timeline);
+        mqttClient.publish((settings.mqttRootTopic + "/bootTimeline").c_str(), timeline.c_str());
+        bootTimelinePublished = true;
+      }
+      return true;
     } else {
       if (mqttClient.state() == 4 || mqttClient.state() == 5) {
         mqttConfigValid = false;
         notifyClients("Failed to connect to MQTT Server: bad credentials or not authorized. Will not try again, please check your settings.");
       } else {
-        notifyClients(String("Failed to connect to MQTT Server, rc=") + mqttClient.state() + ", try again in 30 seconds");
+        notifyClients(String("Failed to connect to MQTT Server, rc=") + mqttClient.state() + ", try again in " + (mqttReconnectMillis / 1000) + " seconds");
       }
+      return false;
     }
   }
+  return mqttClient.connected();
+}
+
+void mqttConnectTask(void *arg) {
+  if (connectMqttClient())
+    mqttReconnectMillis = mqttMinReconnectMillis;
+  else
+    mqttReconnectMillis = min(mqttReconnectMillis * 2, mqttMaxReconnectMillis);
+  mqttReconnectPreviousMillis = millis();
+  mqttConnecting = false;
+  vTaskDelete(NULL);
 }
 
 
-void doScan()
+void reboot()
 {
-  Match match = fingerManager.scanFingerprint();
-  String mqttRootTopic = settingsManager.getAppSettings().mqttRootTopic;
-  switch(match.scanResult)
+  if (!mqttConnecting)
+    mqttClient.disconnect();
+  espClient.stop();
+  dnsServer.stop();
+  // webServer.stop(); // does not work as intended
+  WiFi.disconnect();
+  ESP.restart();
+}
+
+/* connect all sensors, decide the operating mode and start scanning */
+void sensorBootTask(void *arg) {
+  for (int i=0; i<sensorCount; i++)
+    sensors[i].manager.connect();
+  bootTimeline.mark("sensorsConnected");
+  
+  if (!checkPairingValid())
+    notifyClients("Security issue! Pairing with sensor is invalid. This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page. MQTT messages regarding matching fingerprints will not been sent until pairing is valid again.");
+
+  if (fingerManager.isFingerOnSensor() || !settingsManager.isWifiConfigured())
   {
-    case ScanResult::noFinger:
-      // standard case, occurs every iteration when no finger touchs the sensor
-      if (match.scanResult != lastMatch.scanResult) {
-        Serial.println("no finger");
-        mqttClient.publish((String(mqttRootTopic) + "/ring").c_str(), "off");
-        mqttClient.publish((String(mqttRootTopic) + "/matchId").c_str(), "-1");
-        mqttClient.publish((String(mqttRootTopic) + "/matchName").c_str(), "");
-        mqttClient.publish((String(mqttRootTopic) + "/matchConfidence").c_str(), "-1");
-      }
-      break; 
-    case ScanResult::matchFound:
-      notifyClients( String("Match Found: ") + match.matchId + " - " + match.matchName  + " with confidence of " + match.matchConfidence );
-      if (match.scanResult != lastMatch.scanResult) {
-        if (checkPairingValid()) {
-          mqttClient.publish((String(mqttRootTopic) + "/ring").c_str(), "off");
-          mqttClient.publish((String(mqttRootTopic) + "/matchId").c_str(), String(match.matchId).c_str());
-          mqttClient.publish((String(mqttRootTopic) + "/matchName").c_str(), match.matchName.c_str());
-          mqttClient.publish((String(mqttRootTopic) + "/matchConfidence").c_str(), String(match.matchConfidence).c_str());
-          Serial.println("MQTT message sent: Open the door!");
-        } else {
-          notifyClients("Security issue! Match was not sent by MQTT because of invalid sensor pairing! This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page.");
-        }
+    // ring touched during startup or no wifi settings stored -> wifi config mode
+    currentMode = Mode::wificonfig;
+    Serial.println("Started WiFi-Config mode");
+    fingerManager.setLedRingWifiConfig();
+    WiFi.disconnect(true);
+    initWiFiAccessPointForConfiguration();
+    xEventGroupSetBits(bootEvents, bootWifiReady);
+
+  } else {
+    Serial.println("Started normal operating mode");
+    // every sensor is scanned by its own task, so a slow scan on one sensor never delays the others
+    for (int i=0; i<sensorCount; i++) {
+      FingerprintManager &manager = sensors[i].manager;
+      if (manager.connected) {
+        manager.setColorSettings(settingsManager.getColorSettings());
+        manager.setLedRingReady();
+        manager.setEnrollProgressCallback([i](const EnrollProgress& progress){
+          queueEnrollProgress(i, progress);
+        });
+        manager.setPowerManager(&powerManager);
+        manager.setMatchListener(loopTask);
+        manager.startSensorTask(touchWakeupMode);
       }
-      delay(3000); // wait some time before next scan to let the LED blink
-      break;
-    case ScanResult::noMatchFound:
-      notifyClients(String("No Match Found (Code ") + match.returnCode + ")");
-      if (match.scanResult != lastMatch.scanResult) {
-        digitalWrite(doorbellOutputPin, HIGH);
-        mqttClient.publish((String(mqttRootTopic) + "/ring").c_str(), "on");
-        mqttClient.publish((String(mqttRootTopic) + "/matchId").c_str(), "-1");
-        mqttClient.publish((String(mqttRootTopic) + "/matchName").c_str(), "");
-        mqttClient.publish((String(mqttRootTopic) + "/matchConfidence").c_str(), "-1");
-        Serial.println("MQTT message sent: ring the bell!");
-        delay(1000);
-        digitalWrite(doorbellOutputPin, LOW); 
-      } else {
-        delay(1000); // wait some time before next scan to let the LED blink
+      else
+        manager.setLedRingError();
+    }
+    bootTimeline.mark("scanReady");
+    if (powerManager.begin(lightSleepIdle) == PowerMode::lightSleep) {
+      for (int i=0; i<sensorCount; i++) {
+        if (sensors[i].manager.connected && !sensors[i].manager.enableLightSleepWakeup())
+          Serial.println("Touch ring could not be set as wakeup source, light sleep may delay ring events");
       }
-      break;
-    case ScanResult::error:
-      notifyClients(String("ScanResult Error (Code ") + match.returnCode + ")");
-      break;
-  };
-  lastMatch = match;
-
+    }
+  }
+  xEventGroupSetBits(bootEvents, bootSensorsReady);
+  vTaskDelete(NULL);
 }
 
-void doEnroll()
-{
-  int id = enrollId.toInt();
-  if (id < 1 || id > 200) {
-    notifyClients("Invalid memory slot id '" + enrollId + "'");
+/* wait for the WiFi association started in setup(), then resolve the MQTT server */
+void networkBootTask(void *arg) {
+  if (!initWifi()) {
+    if (currentMode != Mode::wificonfig) {
+      xEventGroupWaitBits(bootEvents, bootSensorsReady, pdFALSE, pdTRUE, portMAX_DELAY);
+      fingerManager.setLedRingError();
+      shouldReboot = true;
+    }
+    vTaskDelete(NULL);
     return;
   }
-
-  NewFinger finger = fingerManager.enrollFinger(id, enrollName);
-  if (finger.enrollResult == EnrollResult::ok) {
-    notifyClients("Enrollment successfull. You can now use your new finger for scanning.");
-    updateClientsFingerlist(fingerManager.getFingerListAsHtmlOptionList());
-  }  else if (finger.enrollResult == EnrollResult::error) {
-    notifyClients(String("Enrollment failed. (Code ") + finger.returnCode + ")");
+  bootTimeline.mark("wifiConnected");
+  xEventGroupSetBits(bootEvents, bootWifiReady);
+
+  AppSettings settings = settingsManager.getAppSettings(); // one snapshot, the sensor boot task may pair meanwhile
+  if (settings.mqttServer.isEmpty()) {
+    mqttConfigValid = false;
+    notifyClients("Error: No MQTT Broker is configured! Please go to settings and enter your server URL + user credentials.");
+    Serial.println("Boot timeline (ms since reset): " + bootTimeline.toJson());
+  } else {
+    IPAddress mqttServerIp;
+    if (WiFi.hostByName(settings.mqttServer.c_str(), mqttServerIp))
+    {
+      mqttConfigValid = true;
+      Serial.println("IP used for MQTT server: " + mqttServerIp.toString() + " | Port: " + String(settings.mqttPort));
+      mqttClient.setServer(mqttServerIp , settings.mqttPort);
+      mqttClient.setCallback(mqttCallback);
+      mqttClient.setBufferSize(2048); // default of 256 bytes is too small for the stats message, ScanPublisher enlarges it if needed
+      bootTimeline.mark("mqttResolved");
+    }
+    else {
+      mqttConfigValid = false;
+      notifyClients("MQTT Server '" + settings.mqttServer + "' not found. Please check your settings.");
+    }
   }
+  xEventGroupSetBits(bootEvents, bootMqttResolved);
+  vTaskDelete(NULL);
 }
 
-
-
-void reboot()
-{
-  notifyClients("System is rebooting now...");
-  delay(1000);
-    
-  mqttClient.disconnect();
-  espClient.stop();
-  dnsServer.stop();
-  // webServer.stop(); // does not work as intended
-  WiFi.disconnect();
-  ESP.restart();
+/* mount the file system right away, start the web server as soon as the network is up */
+void webBootTask(void *arg) {
+  if (LittleFS.begin(true))
+    bootTimeline.mark("fsMounted");
+  xEventGroupWaitBits(bootEvents, bootSensorsReady | bootWifiReady, pdFALSE, pdTRUE, portMAX_DELAY);
+  startWebserver();
+  bootTimeline.mark("webServerStarted");
+  vTaskDelete(NULL);
 }
 
 void setup()
@@ -847,9 +1654,16 @@ void setup()
   Serial.begin(115200);
   while (!Serial);  // For Yun/Leo/Micro/Zero/...
   delay(100);
+  bootTimeline.mark("setup");
+  bootId = esp_random();
+  logLock = xSemaphoreCreateMutex();
+  for (int i=0; i<maxLogClients; i++)
+    logClients[i].socket = -1;
+  xTaskCreate(logSenderMain, "logSender", 4096, NULL, 1, &logSenderTask);
 
   // initialize GPIOs
-  pinMode(doorbellOutputPin, OUTPUT); 
+  for (int i=0; i<sensorCount; i++)
+    pinMode(sensors[i].doorbellOutputPin, OUTPUT); 
   #ifdef CUSTOM_GPIOS
     pinMode(customOutput1, OUTPUT); 
     pinMode(customOutput2, OUTPUT); 
@@ -861,118 +1675,99 @@ void setup()
   settingsManager.loadWebPageSettings();
   settingsManager.loadAppSettings();
   settingsManager.loadColorSettings();
+  scanPublisher.setStatsSource(getMetricsJson); // every 5 minutes, so regressions after firmware updates show up in the home automation
+  scanPublisher.setPairingStarter(startPairingTask);
+
+  bootEvents = xEventGroupCreate();
+  loopTask = xTaskGetCurrentTaskHandle();
+  enrollEventQueue = xQueueCreate(10, sizeof(EnrollEvent));
+  if (settingsManager.isWifiConfigured()) {
+    startWifi(); // association runs while the sensors are connected
+    xTaskCreate(networkBootTask, "networkBoot", 4096, NULL, 1, NULL);
+  }
+  xTaskCreate(sensorBootTask, "sensorBoot", 8192, NULL, 1, NULL);
+  xTaskCreate(webBootTask, "webBoot", 8192, NULL, 1, NULL);
+}
 
-  fingerManager.connect();
-  
-  if (!checkPairingValid())
-    notifyClients("Security issue! Pairing with sensor is invalid. This could potentially be an attack! If the sensor is new or has been replaced by you do a (re)pairing in settings page. MQTT messages regarding matching fingerprints will not been sent until pairing is valid again.");
-
-  if (fingerManager.isFingerOnSensor() || !settingsManager.isWifiConfigured())
-  {
-    // ring touched during startup or no wifi settings stored -> wifi config mode
-    currentMode = Mode::wificonfig;
-    Serial.println("Started WiFi-Config mode");
-    fingerManager.setLedRingWifiConfig();
-    initWiFiAccessPointForConfiguration();
-    startWebserver();
-
-  } else {
-    Serial.println("Started normal operating mode");
-    currentMode = Mode::scan;
-    if (initWifi()) {
-      startWebserver();
-      if (settingsManager.getAppSettings().mqttServer.isEmpty()) {
-        mqttConfigValid = false;
-        notifyClients("Error: No MQTT Broker is configured! Please go to settings and enter your server URL + user credentials.");
-      } else {
-        delay(5000);
-
-        IPAddress mqttServerIp;
-        if (WiFi.hostByName(settingsManager.getAppSettings().mqttServer.c_str(), mqttServerIp))
-        {
-          mqttConfigValid = true;
-          Serial.println("IP used for MQTT server: " + mqttServerIp.toString() + " | Port: " + String(settingsManager.getAppSettings().mqttPort));
-          mqttClient.setServer(mqttServerIp , settingsManager.getAppSettings().mqttPort);
-          mqttClient.setCallback(mqttCallback);
-          connectMqttClient();
-        }
-        else {
-          mqttConfigValid = false;
-          notifyClients("MQTT Server '" + settingsManager.getAppSettings().mqttServer + "' not found. Please check your settings.");
-        }
-      }
-      if (fingerManager.connected) {
-        fingerManager.setColorSettings(settingsManager.getColorSettings());
-        fingerManager.setLedRingReady();
-      }
-      else
-        fingerManager.setLedRingError();
-    }  else {
-      fingerManager.setLedRingError();
-      shouldReboot = true;
+/* track duration of loop() iterations to detect blocking calls */
+void measureLoopTime()
+{
+  unsigned long now = micros();
+  if (loopStartMicros != 0) {
+    unsigned long duration = now - loopStartMicros;
+    if (duration > loopMaxMicros)
+      loopMaxMicros = duration;
+    if (duration > maxLoopMicros) {
+      loopOverrunCount++;
+      Serial.println(String("Warning: loop() iteration took ") + (duration / 1000) + " ms");
     }
-
   }
-  
+  loopStartMicros = now;
 }
 
 void loop()
 {
+  measureLoopTime();
+
   // shouldReboot flag for supporting reboot through webui
   if (shouldReboot) {
+    shouldReboot = false;
+    notifyClients("System is rebooting now...");
+    rebootPending = true;
+    rebootRequestedMillis = millis();
+  }
+  if (rebootPending && millis() - rebootRequestedMillis >= 1000ul) {
     reboot();
   }
+
+  // nothing to do until the operating mode is known
+  EventBits_t bootState = xEventGroupGetBits(bootEvents);
+  if (!(bootState & bootSensorsReady)) {
+    xEventGroupWaitBits(bootEvents, bootSensorsReady, pdFALSE, pdTRUE, pdMS_TO_TICKS(100));
+    loopStartMicros = micros(); // waiting is not loop work
+    return;
+  }
   
-  // Reconnect handling
+  // Reconnect handling (after the boot tasks have brought WiFi and MQTT up for the first time)
   if (currentMode != Mode::wificonfig)
   {
     unsigned long currentMillis = millis();
     // reconnect WiFi if down for 30s
-    if ((WiFi.status() != WL_CONNECTED) && (currentMillis - wifiReconnectPreviousMillis >= 30000ul)) {
+    if ((bootState & bootWifiReady) && (WiFi.status() != WL_CONNECTED) && (currentMillis - wifiReconnectPreviousMillis >= 30000ul)) {
       Serial.println("Reconnecting to WiFi...");
       WiFi.disconnect();
       WiFi.reconnect();
       wifiReconnectPreviousMillis = currentMillis;
     }
 
-    // reconnect mqtt if down
-    if (!settingsManager.getAppSettings().mqttServer.isEmpty()) {
-      if (!mqttClient.connected() && (currentMillis - mqttReconnectPreviousMillis >= 30000ul)) {
-        connectMqttClient();
-        mqttReconnectPreviousMillis = currentMillis;
+    // reconnect mqtt if down, first attempt right after the server address was resolved, then with growing delays
+    if ((bootState & bootMqttResolved) && !settingsManager.getAppSettings().mqttServer.isEmpty() && !mqttConnecting) {
+      if (!mqttClient.connected() && mqttConfigValid && (!mqttConnectAttempted || currentMillis - mqttReconnectPreviousMillis >= mqttReconnectMillis)) {
+        mqttConnectAttempted = true;
+        mqttConnecting = true;
+        if (xTaskCreate(mqttConnectTask, "mqttConnect", 4096, NULL, 1, NULL) != pdPASS) {
+          mqttConnecting = false;
+          mqttReconnectPreviousMillis = currentMillis;
+        }
+      } else {
+        mqttClient.loop();
       }
-      mqttClient.loop();
     }
   }
+  mqttConnected = !mqttConnecting && mqttClient.connected();
 
 
-  // do the actual loop work
-  switch (currentMode)
-  {
-  case Mode::scan:
-    if (fingerManager.connected)
-      doScan();
-    break;
-  
-  case Mode::enroll:
-    doEnroll();
-    currentMode = Mode::scan; // switch back to scan mode after enrollment is done
-    break;
-  
-  case Mode::wificonfig:
+  // do the actual loop work (scanning and enrollment are done by the sensor task)
+  if (currentMode == Mode::wificonfig) {
     dnsServer.processNextRequest(); // used for captive portal redirect
-    break;
-
-  case Mode::maintenance:
-    // do nothing, give webserver exclusive access to sensor (not thread-safe for concurrent calls)
-    break;
-
+  } else {
+    EnrollEvent enrollEvent;
+    while (xQueueReceive(enrollEventQueue, &enrollEvent, 0) == pdTRUE)
+      updateClientsEnrollProgress(sensors[enrollEvent.sensorIndex], enrollEvent.progress);
+    // publish scan results, stats and log messages
+    scanPublisher.loop(mqttConnected);
   }
 
-  // enter maintenance mode (no continous scanning) if requested
-  if (needMaintenanceMode)
-    currentMode = Mode::maintenance;
-
   #ifdef CUSTOM_GPIOS
     // read custom inputs and publish by MQTT
     bool i1;
@@ -983,16 +1778,16 @@ void loop()
     String mqttRootTopic = settingsManager.getAppSettings().mqttRootTopic;
     if (i1 != customInput1Value) {
         if (i1)
-          mqttClient.publish((String(mqttRootTopic) + "/customInput1").c_str(), "on");      
+          scanPublisher.publish(String(mqttRootTopic) + "/customInput1", "on");      
         else
-          mqttClient.publish((String(mqttRootTopic) + "/customInput1").c_str(), "off");      
+          scanPublisher.publish(String(mqttRootTopic) + "/customInput1", "off");      
     }
 
     if (i2 != customInput2Value) {
         if (i2)
-          mqttClient.publish((String(mqttRootTopic) + "/customInput2").c_str(), "on");      
+          scanPublisher.publish(String(mqttRootTopic) + "/customInput2", "on");      
         else
-          mqttClient.publish((String(mqttRootTopic) + "/customInput2").c_str(), "off");  
+          scanPublisher.publish(String(mqttRootTopic) + "/customInput2", "off");  
     }
 
     customInput1Value = i1;
@@ -1002,4 +1797,14 @@ void loop()
 
   // OTA update handling
   ElegantOTA.loop();
+
+  #ifdef LIGHT_SLEEP_IDLE
+    // block instead of spinning, so the CPU can enter light sleep until a scan result arrives or the next timeout
+    if (currentMode != Mode::wificonfig && powerManager.getMode() != PowerMode::full) {
+      int64_t idleStart = esp_timer_get_time();
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idleWaitMillis)); // woken by the sensor tasks when a scan result was queued
+      powerManager.addIdleTime(esp_timer_get_time() - idleStart);
+      loopStartMicros = micros(); // waiting is not loop work
+    }
+  #endif
 }
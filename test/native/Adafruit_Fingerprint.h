@@ -0,0 +1,296 @@
+#ifndef NATIVE_ADAFRUIT_FINGERPRINT_H
+#define NATIVE_ADAFRUIT_FINGERPRINT_H
+
+/*
+  Host replacement of the Adafruit Fingerprint Sensor Library (2.1.2), the subset used by FingerprintManager. Commands
+  are real packets on the UART, so against the R503 emulator the whole protocol path is exercised. Constants, packet
+  layout, field defaults and return codes follow the library; begin() does not wait a second for the sensor to boot.
+*/
+
+#include <Arduino.h>
+
+#define FINGERPRINT_OK 0x00
+#define FINGERPRINT_PACKETRECIEVEERR 0x01
+#define FINGERPRINT_NOFINGER 0x02
+#define FINGERPRINT_IMAGEFAIL 0x03
+#define FINGERPRINT_IMAGEMESS 0x06
+#define FINGERPRINT_FEATUREFAIL 0x07
+#define FINGERPRINT_NOMATCH 0x08
+#define FINGERPRINT_NOTFOUND 0x09
+#define FINGERPRINT_ENROLLMISMATCH 0x0A
+#define FINGERPRINT_BADLOCATION 0x0B
+#define FINGERPRINT_DBREADFAIL 0x0C
+#define FINGERPRINT_UPLOADFEATUREFAIL 0x0D
+#define FINGERPRINT_PACKETRESPONSEFAIL 0x0E
+#define FINGERPRINT_UPLOADFAIL 0x0F
+#define FINGERPRINT_DELETEFAIL 0x10
+#define FINGERPRINT_DBCLEARFAIL 0x11
+#define FINGERPRINT_PASSFAIL 0x13
+#define FINGERPRINT_INVALIDIMAGE 0x15
+#define FINGERPRINT_FLASHERR 0x18
+#define FINGERPRINT_INVALIDREG 0x1A
+#define FINGERPRINT_ADDRCODE 0x20
+#define FINGERPRINT_PASSVERIFY 0x21
+
+#define FINGERPRINT_STARTCODE 0xEF01
+
+#define FINGERPRINT_COMMANDPACKET 0x1
+#define FINGERPRINT_DATAPACKET 0x2
+#define FINGERPRINT_ACKPACKET 0x7
+#define FINGERPRINT_ENDDATAPACKET 0x8
+
+#define FINGERPRINT_TIMEOUT 0xFF
+#define FINGERPRINT_BADPACKET 0xFE
+
+#define FINGERPRINT_GETIMAGE 0x01
+#define FINGERPRINT_IMAGE2TZ 0x02
+#define FINGERPRINT_SEARCH 0x04
+#define FINGERPRINT_REGMODEL 0x05
+#define FINGERPRINT_STORE 0x06
+#define FINGERPRINT_LOAD 0x07
+#define FINGERPRINT_UPLOAD 0x08
+#define FINGERPRINT_DELETE 0x0C
+#define FINGERPRINT_EMPTY 0x0D
+#define FINGERPRINT_READSYSPARAM 0x0F
+#define FINGERPRINT_SETPASSWORD 0x12
+#define FINGERPRINT_VERIFYPASSWORD 0x13
+#define FINGERPRINT_HISPEEDSEARCH 0x1B
+#define FINGERPRINT_TEMPLATECOUNT 0x1D
+#define FINGERPRINT_AURALEDCONFIG 0x35
+#define FINGERPRINT_LEDON 0x50
+#define FINGERPRINT_LEDOFF 0x51
+
+#define FINGERPRINT_LED_BREATHING 0x01
+#define FINGERPRINT_LED_FLASHING 0x02
+#define FINGERPRINT_LED_ON 0x03
+#define FINGERPRINT_LED_OFF 0x04
+#define FINGERPRINT_LED_GRADUAL_ON 0x05
+#define FINGERPRINT_LED_GRADUAL_OFF 0x06
+#define FINGERPRINT_LED_RED 0x01
+#define FINGERPRINT_LED_BLUE 0x02
+#define FINGERPRINT_LED_PURPLE 0x03
+
+#define FINGERPRINT_REG_ADDR_ERROR 0x1A
+#define FINGERPRINT_WRITE_REG 0x0E
+#define FINGERPRINT_BAUD_REG_ADDR 0x4
+#define FINGERPRINT_SECURITY_REG_ADDR 0x5
+#define FINGERPRINT_PACKET_REG_ADDR 0x6
+
+#define DEFAULTTIMEOUT 1000
+
+struct Adafruit_Fingerprint_Packet {
+  Adafruit_Fingerprint_Packet(uint8_t type, uint16_t length, uint8_t *data) {
+    this->start_code = FINGERPRINT_STARTCODE;
+    this->type = type;
+    this->length = length;
+    address[0] = 0xFF;
+    address[1] = 0xFF;
+    address[2] = 0xFF;
+    address[3] = 0xFF;
+    memcpy(this->data, data, (length < 64) ? length : 64);
+  }
+  uint16_t start_code;
+  uint8_t address[4];
+  uint8_t type;
+  uint16_t length; // payload without checksum
+  uint8_t data[64];
+};
+
+class Adafruit_Fingerprint {
+  public:
+    explicit Adafruit_Fingerprint(HardwareSerial *serial, uint32_t password = 0x0) : mySerial(serial), thePassword(password) {}
+
+    void begin(uint32_t baud) {
+      mySerial->begin(baud);
+    }
+
+    bool verifyPassword() {
+      return checkPassword() == FINGERPRINT_OK;
+    }
+    uint8_t checkPassword() {
+      uint8_t data[] = { FINGERPRINT_VERIFYPASSWORD, (uint8_t)(thePassword >> 24), (uint8_t)(thePassword >> 16), (uint8_t)(thePassword >> 8),
+        (uint8_t)(thePassword & 0xFF) };
+      return sendCommand(data, sizeof(data));
+    }
+
+    uint8_t getParameters() {
+      uint8_t data[] = { FINGERPRINT_READSYSPARAM };
+      Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+      uint8_t code = exchange(packet);
+      if (code != FINGERPRINT_OK)
+        return code;
+      status_reg = ((uint16_t)packet.data[1] << 8) | packet.data[2];
+      system_id = ((uint16_t)packet.data[3] << 8) | packet.data[4];
+      capacity = ((uint16_t)packet.data[5] << 8) | packet.data[6];
+      security_level = ((uint16_t)packet.data[7] << 8) | packet.data[8];
+      device_addr = ((uint32_t)packet.data[9] << 24) | ((uint32_t)packet.data[10] << 16) | ((uint32_t)packet.data[11] << 8) | packet.data[12];
+      packet_len = ((uint16_t)packet.data[13] << 8) | packet.data[14];
+      packet_len = (packet_len <= 3) ? 32 << packet_len : packet_len; // size code 0..3 = 32..256 bytes
+      baud_rate = (((uint16_t)packet.data[15] << 8) | packet.data[16]) * 9600;
+      return code;
+    }
+
+    uint8_t getImage() {
+      uint8_t data[] = { FINGERPRINT_GETIMAGE };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t image2Tz(uint8_t slot = 1) {
+      uint8_t data[] = { FINGERPRINT_IMAGE2TZ, slot };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t createModel() {
+      uint8_t data[] = { FINGERPRINT_REGMODEL };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t storeModel(uint16_t location, uint8_t slot = 1) {
+      uint8_t data[] = { FINGERPRINT_STORE, slot, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF) };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t loadModel(uint16_t location, uint8_t slot = 1) {
+      uint8_t data[] = { FINGERPRINT_LOAD, slot, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF) };
+      return sendCommand(data, sizeof(data));
+    }
+    /* starts the upload of char buffer 1, the data packets are left on the UART for the caller */
+    uint8_t getModel(uint8_t slot = 1) {
+      uint8_t data[] = { FINGERPRINT_UPLOAD, slot };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t deleteModel(uint16_t location) {
+      uint8_t data[] = { FINGERPRINT_DELETE, (uint8_t)(location >> 8), (uint8_t)(location & 0xFF), 0x00, 0x01 };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t emptyDatabase() {
+      uint8_t data[] = { FINGERPRINT_EMPTY };
+      return sendCommand(data, sizeof(data));
+    }
+    uint8_t fingerSearch(uint8_t slot = 1) {
+      uint8_t data[] = { FINGERPRINT_SEARCH, slot, 0x00, 0x00, (uint8_t)(capacity >> 8), (uint8_t)(capacity & 0xFF) };
+      Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+      uint8_t code = exchange(packet);
+      fingerID = ((uint16_t)packet.data[1] << 8) | packet.data[2];
+      confidence = ((uint16_t)packet.data[3] << 8) | packet.data[4];
+      return code;
+    }
+    uint8_t getTemplateCount() {
+      uint8_t data[] = { FINGERPRINT_TEMPLATECOUNT };
+      Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, sizeof(data), data);
+      uint8_t code = exchange(packet);
+      if (code == FINGERPRINT_OK)
+        templateCount = ((uint16_t)packet.data[1] << 8) | packet.data[2];
+      return code;
+    }
+    uint8_t setBaudRate(uint8_t baudrate) {
+      return writeRegister(FINGERPRINT_BAUD_REG_ADDR, baudrate);
+    }
+    uint8_t setSecurityLevel(uint8_t level) {
+      return writeRegister(FINGERPRINT_SECURITY_REG_ADDR, level);
+    }
+    uint8_t setPacketSize(uint8_t size) {
+      return writeRegister(FINGERPRINT_PACKET_REG_ADDR, size);
+    }
+    uint8_t LEDcontrol(uint8_t control, uint8_t speed, uint8_t coloridx, uint8_t count = 0) {
+      uint8_t data[] = { FINGERPRINT_AURALEDCONFIG, control, speed, coloridx, count };
+      return sendCommand(data, sizeof(data));
+    }
+
+    void writeStructuredPacket(const Adafruit_Fingerprint_Packet &packet) {
+      uint16_t wireLength = packet.length + 2;
+      uint8_t header[9] = { (uint8_t)(packet.start_code >> 8), (uint8_t)(packet.start_code & 0xFF), packet.address[0], packet.address[1],
+        packet.address[2], packet.address[3], packet.type, (uint8_t)(wireLength >> 8), (uint8_t)(wireLength & 0xFF) };
+      uint16_t sum = packet.type + (wireLength >> 8) + (wireLength & 0xFF);
+      for (uint16_t i=0; i<packet.length; i++)
+        sum += packet.data[i];
+      uint8_t buffer[9 + 64 + 2];
+      memcpy(buffer, header, sizeof(header));
+      memcpy(buffer + sizeof(header), packet.data, packet.length);
+      buffer[sizeof(header) + packet.length] = (uint8_t)(sum >> 8);
+      buffer[sizeof(header) + packet.length + 1] = (uint8_t)(sum & 0xFF);
+      mySerial->write(buffer, sizeof(header) + packet.length + 2); // one write, like the UART FIFO sees it
+    }
+
+    /* polls byte by byte like the library does, returns FINGERPRINT_TIMEOUT or FINGERPRINT_BADPACKET on errors */
+    uint8_t getStructuredPacket(Adafruit_Fingerprint_Packet *packet, uint16_t timeout = DEFAULTTIMEOUT) {
+      uint16_t index = 0;
+      uint16_t wireLength = 0;
+      uint16_t timer = 0;
+      while (true) {
+        while (!mySerial->available()) {
+          delay(1);
+          timer++;
+          if (timer >= timeout)
+            return FINGERPRINT_TIMEOUT;
+        }
+        uint8_t c = mySerial->read();
+        switch (index) {
+          case 0:
+            if (c != (FINGERPRINT_STARTCODE >> 8))
+              continue; // wait for the start code
+            packet->start_code = (uint16_t)c << 8;
+            break;
+          case 1:
+            packet->start_code |= c;
+            if (packet->start_code != FINGERPRINT_STARTCODE)
+              return FINGERPRINT_BADPACKET;
+            break;
+          case 2: case 3: case 4: case 5:
+            packet->address[index - 2] = c;
+            break;
+          case 6:
+            packet->type = c;
+            break;
+          case 7:
+            wireLength = (uint16_t)c << 8;
+            break;
+          case 8:
+            wireLength |= c;
+            if (wireLength < 2 || (size_t)(wireLength - 2) > sizeof(packet->data))
+              return FINGERPRINT_BADPACKET;
+            packet->length = wireLength - 2;
+            break;
+          default:
+            if (index - 9 < packet->length) {
+              packet->data[index - 9] = c;
+            } else if (index - 9 == (uint16_t)(packet->length + 1)) {
+              return FINGERPRINT_OK; // checksum is not verified by the library either
+            }
+            break;
+        }
+        index++;
+      }
+    }
+
+    uint16_t fingerID = 0;
+    uint16_t confidence = 0;
+    uint16_t templateCount = 0;
+    uint16_t status_reg = 0x0;
+    uint16_t system_id = 0x0;
+    uint16_t capacity = 64;
+    uint16_t security_level = 0;
+    uint32_t device_addr = 0xFFFFFFFF;
+    uint16_t packet_len = 64;
+    uint32_t baud_rate = 57600;
+
+  private:
+    HardwareSerial *mySerial;
+    uint32_t thePassword;
+
+    uint8_t writeRegister(uint8_t regAdd, uint8_t value) {
+      uint8_t data[] = { FINGERPRINT_WRITE_REG, regAdd, value };
+      return sendCommand(data, sizeof(data));
+    }
+    /* sends the command and replaces the packet with the acknowledge */
+    uint8_t exchange(Adafruit_Fingerprint_Packet &packet) {
+      writeStructuredPacket(packet);
+      if (getStructuredPacket(&packet) != FINGERPRINT_OK)
+        return FINGERPRINT_PACKETRECIEVEERR;
+      if (packet.type != FINGERPRINT_ACKPACKET)
+        return FINGERPRINT_PACKETRECIEVEERR;
+      return packet.data[0];
+    }
+    uint8_t sendCommand(uint8_t *data, uint16_t length) {
+      Adafruit_Fingerprint_Packet packet(FINGERPRINT_COMMANDPACKET, length, data);
+      return exchange(packet);
+    }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+/*
+  Host shim of the Arduino core for ESP32, only what the sources compiled by the native env use.
+  Time is the real monotonic clock of the host. GPIO levels and interrupts are set by the test through hostGpio().
+  ESP.getFreeHeap() is derived from the bytes allocated by new (see NativeTest.h), so heap measurements of the
+  sources work on the host as well.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <sys/types.h>
+#include <utility>
+#include "WString.h"
+#include "HardwareSerial.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "IPAddress.h"
+
+using std::min;
+using std::max;
+
+#define IRAM_ATTR
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+typedef uint8_t byte;
+
+inline unsigned long micros() {
+  return (unsigned long)esp_timer_get_time();
+}
+
+inline unsigned long millis() {
+  return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+inline void delay(uint32_t ms) {
+  vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+inline void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+inline uint32_t esp_random() {
+  return (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+}
+
+inline void yield() {
+  std::this_thread::yield();
+}
+
+/* pin levels and interrupt handlers, inputs are HIGH until the test sets them */
+class HostGpio {
+  public:
+    typedef void (*InterruptHandler)(void *arg);
+
+    void setLevel(int pin, int level) {
+      std::lock_guard<std::mutex> guard(mutex);
+      levels[pin] = level;
+    }
+    int getLevel(int pin) {
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = levels.find(pin);
+      return (it != levels.end()) ? it->second : HIGH;
+    }
+    int getMode(int pin) {
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = modes.find(pin);
+      return (it != modes.end()) ? it->second : -1;
+    }
+    void setMode(int pin, int mode) {
+      std::lock_guard<std::mutex> guard(mutex);
+      modes[pin] = mode;
+    }
+    void attach(int pin, InterruptHandler handler, void *arg, int mode) {
+      std::lock_guard<std::mutex> guard(mutex);
+      interrupts[pin] = { handler, arg, mode };
+    }
+    void detach(int pin) {
+      std::lock_guard<std::mutex> guard(mutex);
+      interrupts.erase(pin);
+    }
+    /* sets the level and runs the handler in the calling thread if the edge matches, like the GPIO ISR would */
+    void drive(int pin, int level) {
+      Interrupt interrupt = { NULL, NULL, 0 };
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = levels.find(pin);
+        int oldLevel = (it != levels.end()) ? it->second : HIGH;
+        levels[pin] = level;
+        auto handler = interrupts.find(pin);
+        if (handler != interrupts.end() && oldLevel != level) {
+          bool falling = (level == LOW);
+          if (handler->second.mode == CHANGE || (handler->second.mode == FALLING && falling) || (handler->second.mode == RISING && !falling))
+            interrupt = handler->second;
+        }
+      }
+      if (interrupt.handler != NULL)
+        interrupt.handler(interrupt.arg);
+    }
+    void reset() {
+      std::lock_guard<std::mutex> guard(mutex);
+      levels.clear();
+      modes.clear();
+      interrupts.clear();
+    }
+
+  private:
+    struct Interrupt {
+      InterruptHandler handler;
+      void *arg;
+      int mode;
+    };
+    std::mutex mutex;
+    std::map<int, int> levels;
+    std::map<int, int> modes;
+    std::map<int, Interrupt> interrupts;
+};
+
+inline HostGpio& hostGpio() {
+  static HostGpio gpio;
+  return gpio;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  hostGpio().setMode(pin, mode);
+}
+
+inline int digitalRead(uint8_t pin) {
+  return hostGpio().getLevel(pin);
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level) {
+  hostGpio().setLevel(pin, level);
+}
+
+inline void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) {
+  hostGpio().attach(pin, handler, arg, mode);
+}
+
+inline void detachInterrupt(uint8_t pin) {
+  hostGpio().detach(pin);
+}
+
+/* heap of an ESP32 after boot, reduced by what is currently allocated by new on the host */
+const uint32_t hostHeapSize = 320 * 1024;
+
+inline std::atomic<int64_t>& hostHeapUsed() {
+  static std::atomic<int64_t> used { 0 };
+  return used;
+}
+
+inline std::atomic<int64_t>& hostHeapPeak() {
+  static std::atomic<int64_t> peak { 0 };
+  return peak;
+}
+
+class EspClass {
+  public:
+    uint32_t getHeapSize() { return hostHeapSize; }
+    uint32_t getFreeHeap() {
+      int64_t used = hostHeapUsed();
+      return (used < (int64_t)hostHeapSize) ? hostHeapSize - used : 0;
+    }
+    uint32_t getMinFreeHeap() {
+      int64_t peak = hostHeapPeak();
+      return (peak < (int64_t)hostHeapSize) ? hostHeapSize - peak : 0;
+    }
+    uint32_t getMaxAllocHeap() { return getFreeHeap(); }
+    void restart() { exit(0); }
+};
+
+inline EspClass ESP;
+
+#endif
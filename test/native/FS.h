@@ -0,0 +1,136 @@
+#ifndef NATIVE_FS_H
+#define NATIVE_FS_H
+
+/*
+  Host shim of the Arduino FS API on top of an in-memory file system. Files are shared between all handles, a file
+  opened with "w" is truncated like on LittleFS. Write speed is unlimited, tests measure the sensor side only.
+*/
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct HostFileData {
+  std::vector<uint8_t> bytes;
+};
+
+class File {
+  public:
+    File() {}
+    File(const std::string &path, std::shared_ptr<HostFileData> data, bool writable, size_t position)
+      : path(path), data(data), writable(writable), pos(position) {}
+
+    explicit operator bool() const { return data != nullptr; }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t length) {
+      if (!data || !writable)
+        return 0;
+      if (pos + length > data->bytes.size())
+        data->bytes.resize(pos + length);
+      memcpy(data->bytes.data() + pos, buffer, length);
+      pos += length;
+      return length;
+    }
+    size_t read(uint8_t *buffer, size_t length) {
+      if (!data || pos >= data->bytes.size())
+        return 0;
+      size_t count = std::min(length, data->bytes.size() - pos);
+      memcpy(buffer, data->bytes.data() + pos, count);
+      pos += count;
+      return count;
+    }
+    int read() {
+      uint8_t c;
+      return (read(&c, 1) == 1) ? c : -1;
+    }
+    int available() {
+      return (data && pos < data->bytes.size()) ? data->bytes.size() - pos : 0;
+    }
+    bool seek(uint32_t offset, SeekMode mode = SeekSet) {
+      if (!data)
+        return false;
+      size_t base = (mode == SeekSet) ? 0 : (mode == SeekCur) ? pos : data->bytes.size();
+      if (base + offset > data->bytes.size())
+        return false;
+      pos = base + offset;
+      return true;
+    }
+    size_t position() const { return pos; }
+    size_t size() const { return data ? data->bytes.size() : 0; }
+    const char* name() const { return path.c_str(); }
+    void flush() {}
+    void close() { data = nullptr; }
+
+  private:
+    std::string path;
+    std::shared_ptr<HostFileData> data;
+    bool writable = false;
+    size_t pos = 0;
+};
+
+class FS {
+  public:
+    bool begin(bool formatOnFail = false) { return true; }
+    File open(const char *path, const char *mode = "r") {
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = files.find(path);
+      if (mode[0] == 'r') {
+        if (it == files.end())
+          return File();
+        return File(path, it->second, false, 0);
+      }
+      if (it == files.end() || mode[0] == 'w') {
+        files[path] = std::make_shared<HostFileData>(); // "w" truncates, the old content stays with open handles
+        it = files.find(path);
+      }
+      return File(path, it->second, true, (mode[0] == 'a') ? it->second->bytes.size() : 0);
+    }
+    File open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+    bool exists(const char *path) {
+      std::lock_guard<std::mutex> guard(mutex);
+      return files.count(path) > 0;
+    }
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path) {
+      std::lock_guard<std::mutex> guard(mutex);
+      return files.erase(path) > 0;
+    }
+    bool remove(const String &path) { return remove(path.c_str()); }
+
+    /* test side */
+    void writeFile(const char *path, const std::string &content) {
+      File file = open(path, "w");
+      file.write((const uint8_t*)content.data(), content.size());
+    }
+    std::vector<uint8_t> readFile(const char *path) {
+      std::lock_guard<std::mutex> guard(mutex);
+      auto it = files.find(path);
+      return (it != files.end()) ? it->second->bytes : std::vector<uint8_t>();
+    }
+    void reset() {
+      std::lock_guard<std::mutex> guard(mutex);
+      files.clear();
+    }
+
+  private:
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<HostFileData>> files;
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
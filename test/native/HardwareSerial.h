@@ -0,0 +1,209 @@
+#ifndef NATIVE_HARDWARESERIAL_H
+#define NATIVE_HARDWARESERIAL_H
+
+/*
+  Host shim of Print, Stream and HardwareSerial. A UART can be attached to a SerialDevice (e.g. the R503 emulator), which
+  gets every byte written by the host and delivers its answer with the time each byte arrives, so transfer time at the
+  current baud rate and processing time of the device are part of every measurement. Serial (UART0) is the console, its
+  output is dropped unless NATIVE_SERIAL_OUTPUT is set in the environment, so the Unity report stays readable.
+*/
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <type_traits>
+#include "WString.h"
+#include "freertos/FreeRTOS.h"
+
+#define SERIAL_8N1 0x800001c
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t written = 0;
+      while (size-- > 0)
+        written += write(*buffer++);
+      return written;
+    }
+    size_t write(const char *text) { return write((const uint8_t*)text, strlen(text)); }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+    size_t print(const String &text) { return write(text.c_str()); }
+    size_t print(const char *text) { return write(text); }
+    size_t print(char c) { return write((uint8_t)c); }
+    template<typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+    size_t print(T number, int base = DEC) { return print(String(number, (unsigned char)base)); }
+    size_t print(double number, int decimals = 2) { return print(String(number, (unsigned int)decimals)); }
+    size_t println() { return write("\r\n"); }
+    template<typename T>
+    size_t println(const T &value) { return print(value) + println(); }
+    template<typename T>
+    size_t println(const T &value, int format) { return print(value, format) + println(); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+      char buffer[512];
+      va_list args;
+      va_start(args, format);
+      int length = vsnprintf(buffer, sizeof(buffer), format, args);
+      va_end(args);
+      return (length > 0) ? write((const uint8_t*)buffer, strnlen(buffer, sizeof(buffer))) : 0;
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+    void setTimeout(unsigned long timeoutMs) { timeout = timeoutMs; }
+    unsigned long getTimeout() { return timeout; }
+    virtual size_t readBytes(uint8_t *buffer, size_t length) = 0;
+    size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+
+  protected:
+    unsigned long timeout = 1000;
+};
+
+class HardwareSerial;
+
+/* the other end of a UART */
+class SerialDevice {
+  public:
+    virtual ~SerialDevice() {}
+    virtual void receive(HardwareSerial &serial, const uint8_t *data, size_t length) = 0; // called for every write() of the host
+};
+
+class HardwareSerial : public Stream {
+  public:
+    explicit HardwareSerial(int uartNumber) : uartNumber(uartNumber) {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) {
+      std::lock_guard<std::mutex> guard(mutex);
+      rate = baud;
+      started = true;
+      rx.clear();
+    }
+    void end() {
+      std::lock_guard<std::mutex> guard(mutex);
+      started = false;
+    }
+    void updateBaudRate(unsigned long baud) {
+      std::lock_guard<std::mutex> guard(mutex);
+      rate = baud;
+    }
+    uint32_t baudRate() {
+      std::lock_guard<std::mutex> guard(mutex);
+      return rate;
+    }
+    size_t setRxBufferSize(size_t size) {
+      return size; // unbounded on the host
+    }
+
+    int available() override {
+      std::lock_guard<std::mutex> guard(mutex);
+      return readyCount(esp_timer_get_time());
+    }
+    int read() override {
+      std::lock_guard<std::mutex> guard(mutex);
+      if (readyCount(esp_timer_get_time()) == 0)
+        return -1;
+      uint8_t c = rx.front().value;
+      rx.pop_front();
+      return c;
+    }
+    int peek() override {
+      std::lock_guard<std::mutex> guard(mutex);
+      return (readyCount(esp_timer_get_time()) > 0) ? rx.front().value : -1;
+    }
+    /* all bytes written have left the UART */
+    void flush() override {}
+
+    using Print::write;
+    size_t write(uint8_t c) override {
+      return write(&c, 1);
+    }
+    size_t write(const uint8_t *buffer, size_t size) override {
+      if (uartNumber == 0) {
+        if (getenv("NATIVE_SERIAL_OUTPUT") != NULL)
+          fwrite(buffer, 1, size, stdout);
+        return size;
+      }
+      SerialDevice *receiver = device;
+      if (receiver != NULL && started)
+        receiver->receive(*this, buffer, size);
+      return size;
+    }
+
+    /* blocks until all bytes arrived or timeout, like the UART driver of the ESP32 */
+    size_t readBytes(uint8_t *buffer, size_t length) override {
+      std::unique_lock<std::mutex> lock(mutex);
+      int64_t deadline = esp_timer_get_time() + (int64_t)timeout * 1000;
+      while (true) {
+        int64_t now = esp_timer_get_time();
+        size_t ready = readyCount(now);
+        if (ready >= length || now >= deadline) {
+          size_t count = (ready < length) ? ready : length;
+          for (size_t i=0; i<count; i++) {
+            buffer[i] = rx.front().value;
+            rx.pop_front();
+          }
+          return count;
+        }
+        // sleep until the byte we are waiting for arrives (if it is on its way already) or the timeout
+        int64_t wakeup = deadline;
+        if (rx.size() >= length && rx[length - 1].arrivalMicros < wakeup)
+          wakeup = rx[length - 1].arrivalMicros;
+        if (wakeup > now + 5000)
+          wakeup = now + 5000;
+        delivered.wait_for(lock, std::chrono::microseconds(wakeup - now));
+        lock.unlock();
+        hostCheckDeleted();
+        lock.lock();
+      }
+    }
+    using Stream::readBytes;
+
+    /* device side */
+    void attach(SerialDevice *device) {
+      this->device = device;
+    }
+    void deliver(const uint8_t *data, size_t length, int64_t firstArrivalMicros, int64_t byteMicros) {
+      std::lock_guard<std::mutex> guard(mutex);
+      for (size_t i=0; i<length; i++)
+        rx.push_back({ data[i], firstArrivalMicros + (int64_t)i * byteMicros });
+      delivered.notify_all();
+    }
+    /* time one byte (start, 8 data and stop bit) needs on the line at the current rate */
+    int64_t getByteMicros() {
+      std::lock_guard<std::mutex> guard(mutex);
+      return (rate > 0) ? 10000000LL / rate : 0;
+    }
+
+  private:
+    struct RxByte {
+      uint8_t value;
+      int64_t arrivalMicros;
+    };
+    const int uartNumber;
+    std::mutex mutex;
+    std::condition_variable delivered;
+    std::deque<RxByte> rx;
+    unsigned long rate = 0;
+    bool started = false;
+    SerialDevice *device = NULL;
+
+    size_t readyCount(int64_t now) {
+      size_t count = 0;
+      while (count < rx.size() && rx[count].arrivalMicros <= now)
+        count++;
+      return count;
+    }
+};
+
+inline HardwareSerial Serial(0);
+inline HardwareSerial Serial1(1);
+inline HardwareSerial Serial2(2);
+
+#endif
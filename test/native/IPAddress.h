@@ -0,0 +1,32 @@
+#ifndef NATIVE_IPADDRESS_H
+#define NATIVE_IPADDRESS_H
+
+#include <cstdint>
+#include "WString.h"
+
+/* host shim of the Arduino IPAddress (IPv4 only) */
+class IPAddress {
+  public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes { a, b, c, d } {}
+    uint8_t operator[](int index) const { return bytes[index]; }
+    bool operator==(const IPAddress &other) const { return memcmp(bytes, other.bytes, sizeof(bytes)) == 0; }
+    bool fromString(const char *text) {
+      unsigned int a, b, c, d;
+      if (sscanf(text, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+        return false;
+      bytes[0] = a; bytes[1] = b; bytes[2] = c; bytes[3] = d;
+      return true;
+    }
+    bool fromString(const String &text) {
+      return fromString(text.c_str());
+    }
+    String toString() const {
+      return String(bytes[0]) + "." + bytes[1] + "." + bytes[2] + "." + bytes[3];
+    }
+
+  private:
+    uint8_t bytes[4] = { 0, 0, 0, 0 };
+};
+
+#endif
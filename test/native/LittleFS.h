@@ -0,0 +1,8 @@
+#ifndef NATIVE_LITTLEFS_H
+#define NATIVE_LITTLEFS_H
+
+#include "FS.h"
+
+inline fs::FS LittleFS;
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef NATIVE_NATIVETEST_H
+#define NATIVE_NATIVETEST_H
+
+/*
+  Support for the test programs of the native env, include it once in the test_main.cpp of a suite:
+  - counting operator new/delete, so ESP.getFreeHeap() and hostHeapPeak() reflect the allocations of the code under test
+  - notifyClients() and getTimestampString(), which are implemented in main.cpp on the device
+  - resetHost() to start every test with empty NVS, file system, GPIOs and without tasks
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include <unity.h>
+
+/* size is stored in front of every block, aligned for any type */
+static const size_t hostAllocHeader = alignof(std::max_align_t);
+
+void* operator new(size_t size) {
+  uint8_t *block = (uint8_t*)malloc(size + hostAllocHeader);
+  if (block == NULL)
+    throw std::bad_alloc();
+  *(size_t*)block = size;
+  int64_t used = hostHeapUsed().fetch_add(size) + size;
+  int64_t peak = hostHeapPeak();
+  while (used > peak && !hostHeapPeak().compare_exchange_weak(peak, used)) {}
+  return block + hostAllocHeader;
+}
+
+void operator delete(void *pointer) noexcept {
+  if (pointer == NULL)
+    return;
+  uint8_t *block = (uint8_t*)pointer - hostAllocHeader;
+  hostHeapUsed().fetch_sub(*(size_t*)block);
+  free(block);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+/* peak measurement starts now */
+inline void resetHeapPeak() {
+  hostHeapPeak() = hostHeapUsed().load();
+}
+
+inline std::vector<std::string>& notifications() {
+  static std::vector<std::string> messages;
+  return messages;
+}
+
+inline std::mutex& notificationsMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+void notifyClients(String message) {
+  std::lock_guard<std::mutex> guard(notificationsMutex());
+  notifications().push_back(message.c_str());
+}
+
+String getTimestampString() {
+  return String("2026-01-01 00:00:00");
+}
+
+/* true if one of the messages sent to the clients so far contains text */
+inline bool wasNotified(const char *text) {
+  std::lock_guard<std::mutex> guard(notificationsMutex());
+  for (const auto &message : notifications()) {
+    if (message.find(text) != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+/* polls condition until it is true or timeout, returns the condition */
+template<typename Condition>
+bool waitFor(Condition condition, uint32_t timeoutMs) {
+  unsigned long start = millis();
+  while (!condition()) {
+    if (millis() - start > timeoutMs)
+      return false;
+    delay(1);
+  }
+  return true;
+}
+
+inline void resetHost() {
+  hostDeleteTasks();
+  hostNvs().reset();
+  LittleFS.reset();
+  hostGpio().reset();
+  std::lock_guard<std::mutex> guard(notificationsMutex());
+  notifications().clear();
+}
+
+#endif
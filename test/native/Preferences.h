@@ -0,0 +1,228 @@
+#ifndef NATIVE_PREFERENCES_H
+#define NATIVE_PREFERENCES_H
+
+/*
+  Host shim of Preferences on top of an in-memory NVS. The NVS keeps the limits that matter for the sources under test:
+  15 characters per namespace and key, read-only begin() fails for a namespace that does not exist yet, and the
+  partition has room for a fixed number of 32 byte entries (a string or blob takes one entry plus one per 32 bytes of
+  data, the default 20 KB partition has 4 usable pages of 126 entries). Writes are counted, so tests can check how
+  much a change costs in flash wear.
+*/
+
+#include <Arduino.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef enum {
+  NVS_TYPE_U8 = 0x01, NVS_TYPE_I8 = 0x11, NVS_TYPE_U16 = 0x02, NVS_TYPE_I16 = 0x12, NVS_TYPE_U32 = 0x04, NVS_TYPE_I32 = 0x14,
+  NVS_TYPE_STR = 0x21, NVS_TYPE_BLOB = 0x42, NVS_TYPE_ANY = 0xff
+} nvs_type_t;
+
+class HostNvs {
+  public:
+    struct Value {
+      nvs_type_t type;
+      std::vector<uint8_t> data; // strings incl. terminating 0
+    };
+    typedef std::map<std::string, Value> Namespace;
+
+    static const size_t maxNameLength = 15;
+    static const size_t entrySize = 32;
+
+    std::recursive_mutex mutex;
+    std::map<std::string, Namespace> namespaces;
+    size_t capacityEntries = 4 * 126;
+    uint32_t writes = 0;       // successful set operations
+    uint64_t bytesWritten = 0; // data bytes of these writes
+
+    static size_t entriesFor(const Value &value) {
+      if (value.type == NVS_TYPE_STR || value.type == NVS_TYPE_BLOB)
+        return 1 + (value.data.size() + entrySize - 1) / entrySize;
+      return 1;
+    }
+
+    size_t usedEntries() {
+      size_t used = 0;
+      for (auto &space : namespaces) {
+        used++; // namespace entry
+        for (auto &item : space.second)
+          used += entriesFor(item.second);
+      }
+      return used;
+    }
+
+    /* largest blob/string that would fit right now, not counting an old value of the same key */
+    size_t getFreeBytes() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      size_t used = usedEntries();
+      return (used + 1 < capacityEntries) ? (capacityEntries - used - 1) * entrySize : 0;
+    }
+
+    bool set(const std::string &space, const std::string &key, nvs_type_t type, const uint8_t *data, size_t length) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      if (key.empty() || key.length() > maxNameLength)
+        return false;
+      Value value = { type, std::vector<uint8_t>(data, data + length) };
+      size_t used = usedEntries() + (namespaces.count(space) ? 0 : 1) + entriesFor(value);
+      auto &items = namespaces[space];
+      auto old = items.find(key);
+      if (old != items.end())
+        used -= entriesFor(old->second);
+      if (used > capacityEntries) {
+        if (items.empty())
+          namespaces.erase(space);
+        return false; // ESP_ERR_NVS_NOT_ENOUGH_SPACE
+      }
+      items[key] = value;
+      writes++;
+      bytesWritten += length;
+      return true;
+    }
+
+    void reset() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      namespaces.clear();
+      capacityEntries = 4 * 126;
+      writes = 0;
+      bytesWritten = 0;
+    }
+};
+
+inline HostNvs& hostNvs() {
+  static HostNvs nvs;
+  return nvs;
+}
+
+class Preferences {
+  public:
+    ~Preferences() { end(); }
+
+    bool begin(const char *name, bool readOnly = false, const char *partitionLabel = NULL) {
+      if (started)
+        return false;
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      if (name == NULL || strlen(name) == 0 || strlen(name) > HostNvs::maxNameLength)
+        return false;
+      if (readOnly && hostNvs().namespaces.count(name) == 0)
+        return false; // ESP_ERR_NVS_NOT_FOUND
+      space = name;
+      this->readOnly = readOnly;
+      started = true;
+      return true;
+    }
+    void end() {
+      started = false;
+    }
+
+    bool clear() {
+      if (!started || readOnly)
+        return false;
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      hostNvs().namespaces[space].clear();
+      return true;
+    }
+    bool remove(const char *key) {
+      if (!started || readOnly)
+        return false;
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      return hostNvs().namespaces[space].erase(key) > 0;
+    }
+    bool isKey(const char *key) {
+      return find(key) != NULL;
+    }
+
+    size_t putUChar(const char *key, uint8_t value) { return putNumber(key, NVS_TYPE_U8, value, sizeof(value)); }
+    size_t putUShort(const char *key, uint16_t value) { return putNumber(key, NVS_TYPE_U16, value, sizeof(value)); }
+    size_t putUInt(const char *key, uint32_t value) { return putNumber(key, NVS_TYPE_U32, value, sizeof(value)); }
+    size_t putInt(const char *key, int32_t value) { return putNumber(key, NVS_TYPE_I32, value, sizeof(value)); }
+    size_t putBool(const char *key, bool value) { return putUChar(key, value ? 1 : 0); }
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return getNumber(key, NVS_TYPE_U8, defaultValue); }
+    uint16_t getUShort(const char *key, uint16_t defaultValue = 0) { return getNumber(key, NVS_TYPE_U16, defaultValue); }
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return getNumber(key, NVS_TYPE_U32, defaultValue); }
+    int32_t getInt(const char *key, int32_t defaultValue = 0) { return getNumber(key, NVS_TYPE_I32, defaultValue); }
+    bool getBool(const char *key, bool defaultValue = false) { return getUChar(key, defaultValue ? 1 : 0) != 0; }
+
+    size_t putString(const char *key, const char *value) {
+      if (!started || readOnly || value == NULL)
+        return 0;
+      size_t length = strlen(value);
+      return hostNvs().set(space, key, NVS_TYPE_STR, (const uint8_t*)value, length + 1) ? length : 0;
+    }
+    size_t putString(const char *key, const String &value) {
+      return putString(key, value.c_str());
+    }
+    String getString(const char *key, const String &defaultValue = String()) {
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      const HostNvs::Value *value = find(key);
+      if (value == NULL || value->type != NVS_TYPE_STR)
+        return defaultValue;
+      return String((const char*)value->data.data());
+    }
+    size_t getString(const char *key, char *buffer, size_t maxLength) {
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      const HostNvs::Value *value = find(key);
+      if (value == NULL || value->type != NVS_TYPE_STR || value->data.size() > maxLength)
+        return 0;
+      memcpy(buffer, value->data.data(), value->data.size());
+      return value->data.size();
+    }
+
+    size_t putBytes(const char *key, const void *data, size_t length) {
+      if (!started || readOnly || data == NULL || length == 0)
+        return 0;
+      return hostNvs().set(space, key, NVS_TYPE_BLOB, (const uint8_t*)data, length) ? length : 0;
+    }
+    size_t getBytesLength(const char *key) {
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      const HostNvs::Value *value = find(key);
+      return (value != NULL && value->type == NVS_TYPE_BLOB) ? value->data.size() : 0;
+    }
+    size_t getBytes(const char *key, void *buffer, size_t maxLength) {
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      const HostNvs::Value *value = find(key);
+      if (value == NULL || value->type != NVS_TYPE_BLOB || value->data.size() > maxLength)
+        return 0;
+      memcpy(buffer, value->data.data(), value->data.size());
+      return value->data.size();
+    }
+
+    size_t freeEntries() {
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      size_t used = hostNvs().usedEntries();
+      return (used < hostNvs().capacityEntries) ? hostNvs().capacityEntries - used : 0;
+    }
+
+  private:
+    std::string space;
+    bool readOnly = false;
+    bool started = false;
+
+    const HostNvs::Value* find(const char *key) {
+      if (!started || key == NULL)
+        return NULL;
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      auto items = hostNvs().namespaces.find(space);
+      if (items == hostNvs().namespaces.end())
+        return NULL;
+      auto item = items->second.find(key);
+      return (item != items->second.end()) ? &item->second : NULL;
+    }
+    size_t putNumber(const char *key, nvs_type_t type, uint32_t number, size_t size) {
+      if (!started || readOnly)
+        return 0;
+      return hostNvs().set(space, key, type, (const uint8_t*)&number, sizeof(number)) ? size : 0;
+    }
+    uint32_t getNumber(const char *key, nvs_type_t type, uint32_t defaultValue) {
+      std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+      const HostNvs::Value *value = find(key);
+      if (value == NULL || value->type != type)
+        return defaultValue;
+      uint32_t number;
+      memcpy(&number, value->data.data(), sizeof(number));
+      return number;
+    }
+};
+
+#endif
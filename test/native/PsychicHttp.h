@@ -0,0 +1,75 @@
+#ifndef NATIVE_PSYCHICHTTP_H
+#define NATIVE_PSYCHICHTTP_H
+
+/*
+  Host shim of the PsychicHttp request/response classes used for streamed pages. The request records everything the
+  response sends (status, headers, chunks and the time of the first chunk), so tests and benchmarks can check the
+  output and measure time to first byte. A client that goes away is simulated by failing a chunk.
+*/
+
+#include <Arduino.h>
+#include <FS.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+class PsychicRequest {
+  public:
+    // recorded response
+    int code = 0;
+    std::string contentType;
+    std::vector<std::pair<std::string, std::string>> headers;
+    bool headersSent = false;
+    std::string body;
+    int chunks = 0;
+    bool finished = false;
+    int64_t startMicros = esp_timer_get_time();
+    int64_t firstChunkMicros = 0;
+    int failChunk = -1; // index of the chunk that fails (client gone), -1 = never
+
+    std::string getHeader(const char *name) const {
+      for (const auto &header : headers) {
+        if (header.first == name)
+          return header.second;
+      }
+      return "";
+    }
+};
+
+class PsychicResponse {
+  public:
+    explicit PsychicResponse(PsychicRequest *request) : request(request) {}
+
+    void setCode(int code) { request->code = code; }
+    void setContentType(const char *contentType) { request->contentType = contentType; }
+    void addHeader(const char *field, const char *value) { request->headers.emplace_back(field, value); }
+    void setContent(const char *content) { this->content = content; }
+    void sendHeaders() { request->headersSent = true; }
+    esp_err_t sendChunk(uint8_t *chunk, size_t length) {
+      if (!request->headersSent || request->finished)
+        return ESP_ERR_INVALID_STATE;
+      if (request->chunks == request->failChunk)
+        return ESP_FAIL;
+      if (request->chunks == 0)
+        request->firstChunkMicros = esp_timer_get_time();
+      request->chunks++;
+      request->body.append((const char*)chunk, length);
+      return ESP_OK;
+    }
+    esp_err_t finishChunking() {
+      request->finished = true;
+      return ESP_OK;
+    }
+    esp_err_t send() {
+      sendHeaders();
+      request->body = content;
+      request->finished = true;
+      return ESP_OK;
+    }
+
+  private:
+    PsychicRequest *request;
+    std::string content;
+};
+
+#endif
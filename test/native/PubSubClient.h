@@ -0,0 +1,48 @@
+#ifndef NATIVE_PUBSUBCLIENT_H
+#define NATIVE_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+  Host shim of PubSubClient: publish() records the messages and takes publishMicros, the time the TCP write of a message
+  takes on the device (lwIP copies it into the send buffer). Messages larger than the buffer fail like on the device.
+*/
+class PubSubClient {
+  public:
+    std::vector<std::pair<std::string, std::string>> messages;
+    uint32_t publishMicros = 0;
+    bool isConnected = true;
+
+    bool publish(const char *topic, const char *payload) {
+      if (!isConnected || 7 + strlen(topic) + strlen(payload) > bufferSize)
+        return false;
+      if (publishMicros > 0)
+        delayMicroseconds(publishMicros);
+      messages.emplace_back(topic, payload);
+      return true;
+    }
+    bool connected() { return isConnected; }
+    uint16_t getBufferSize() { return bufferSize; }
+    bool setBufferSize(uint16_t size) {
+      bufferSize = size;
+      return true;
+    }
+
+    /* number of messages published to topic */
+    int count(const char *topic) {
+      int n = 0;
+      for (const auto &message : messages) {
+        if (message.first == topic)
+          n++;
+      }
+      return n;
+    }
+
+  private:
+    uint16_t bufferSize = 256;
+};
+
+#endif
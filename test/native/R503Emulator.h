@@ -0,0 +1,535 @@
+#ifndef NATIVE_R503EMULATOR_H
+#define NATIVE_R503EMULATOR_H
+
+/*
+  Emulator of an R503 fingerprint sensor on the other end of a shim UART. It speaks the packet protocol (start code,
+  address, type, length, checksum) and implements the commands used by FingerprintManager and the Adafruit library:
+  imaging, feature extraction into char buffers, ranged search, model creation, template store with upload/download,
+  index table, notepad, LED ring, system parameters and the baud rate register.
+
+  Fingers are identified by a key: placeFinger(key) puts a finger on the sensor, its template is derived from the key,
+  so the same finger always matches the template it was enrolled with. Timing: every answer arrives after the transfer
+  time of request and answer at the current baud rate plus a configurable processing time per command (zero by
+  default, useR503Timings() sets typical values of the datasheet). Faults are injected per command: a different
+  confirmation code (e.g. FINGERPRINT_IMAGEMESS), no answer at all, or an answer with a broken checksum (both end up
+  as FINGERPRINT_PACKETRECIEVEERR on the host side).
+
+  Thread safe: the sensor task talks to the emulator while the test thread moves fingers or injects faults.
+*/
+
+#include <Adafruit_Fingerprint.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class R503Emulator : public SerialDevice {
+  public:
+    static constexpr uint8_t cmdWriteNotepad = 0x18;
+    static constexpr uint8_t cmdReadNotepad = 0x19;
+    static constexpr uint8_t cmdDownChar = 0x09;
+    static constexpr uint8_t cmdReadIndexTable = 0x1F;
+
+    enum class FaultType { returnCode, noReply, badChecksum };
+
+    struct LedState {
+      uint8_t control = 0;
+      uint8_t speed = 0;
+      uint8_t color = 0;
+      uint8_t count = 0;
+    };
+
+    struct Search {
+      uint16_t start;
+      uint16_t count;
+      uint8_t result;
+    };
+
+    R503Emulator(HardwareSerial &serial, uint16_t capacity = 200, uint32_t baudRate = 57600)
+      : serial(serial), capacity(capacity), baudRate(baudRate) {
+      serial.attach(this);
+    }
+    ~R503Emulator() {
+      serial.attach(NULL);
+    }
+
+    /* typical processing times of the R503 (datasheet: imaging < 0.2 s, search 1:N < 0.3 s for 200 slots) */
+    void useR503Timings() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      delays[FINGERPRINT_GETIMAGE] = 150000;
+      delays[FINGERPRINT_IMAGE2TZ] = 90000;
+      delays[FINGERPRINT_REGMODEL] = 60000;
+      delays[FINGERPRINT_STORE] = 40000;
+      delays[FINGERPRINT_LOAD] = 15000;
+      delays[FINGERPRINT_DELETE] = 30000;
+      delays[FINGERPRINT_EMPTY] = 200000;
+      delays[cmdWriteNotepad] = 30000;
+      searchBaseMicros = 2000;
+      searchMicrosPerSlot = 1200;
+    }
+    void setCommandDelay(uint8_t command, uint32_t micros) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      delays[command] = micros;
+    }
+    /* search time grows with the number of slots searched */
+    void setSearchTiming(uint32_t baseMicros, uint32_t microsPerSlot) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      searchBaseMicros = baseMicros;
+      searchMicrosPerSlot = microsPerSlot;
+    }
+
+    /* "times" commands of this type fail, after "after" commands of this type succeeded */
+    void injectFault(uint8_t command, FaultType type, uint8_t returnCode = FINGERPRINT_PACKETRECIEVEERR, int times = 1, int after = 0) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      for (int i=0; i<times; i++)
+        faults[command].push_back({ type, returnCode, (i == 0) ? after : 0 });
+    }
+    void injectReturnCode(uint8_t command, uint8_t returnCode, int times = 1, int after = 0) {
+      injectFault(command, FaultType::returnCode, returnCode, times, after);
+    }
+    void clearFaults() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      faults.clear();
+    }
+    /* unplugged sensor: nothing is answered */
+    void setConnected(bool connected) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      this->connected = connected;
+    }
+    /* some modules accept a new baud rate but only use it after a power cycle */
+    void setIgnoreBaudRateChange(bool ignore) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      ignoreBaudRateChange = ignore;
+    }
+
+    void placeFinger(uint32_t key) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      fingerKey = key;
+    }
+    void liftFinger() {
+      placeFinger(0);
+    }
+    uint32_t getFingerKey() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return fingerKey;
+    }
+
+    /* template store */
+    static std::vector<uint8_t> makeTemplate(uint32_t key, size_t size = 1536) {
+      std::vector<uint8_t> data(size);
+      for (size_t i=0; i<size; i++)
+        data[i] = (uint8_t)(key * 31 + i * 7);
+      memcpy(data.data(), &key, sizeof(key)); // little endian key first
+      return data;
+    }
+    static uint32_t keyOf(const std::vector<uint8_t> &data) {
+      uint32_t key = 0;
+      if (data.size() >= sizeof(key))
+        memcpy(&key, data.data(), sizeof(key));
+      return key;
+    }
+    void storeTemplate(uint16_t id, uint32_t key) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      templates[id] = makeTemplate(key, templateSize);
+    }
+    bool hasTemplate(uint16_t id) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return templates.count(id) > 0;
+    }
+    std::vector<uint8_t> getTemplate(uint16_t id) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      auto it = templates.find(id);
+      return (it != templates.end()) ? it->second : std::vector<uint8_t>();
+    }
+    uint32_t getTemplateKey(uint16_t id) {
+      return keyOf(getTemplate(id));
+    }
+    size_t getTemplateCount() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return templates.size();
+    }
+    void setTemplateSize(size_t size) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      templateSize = size;
+    }
+
+    /* inspection */
+    uint32_t getCommandCount(uint8_t command) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return commandCounts[command];
+    }
+    uint32_t getTotalCommandCount() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      uint32_t total = 0;
+      for (int i=0; i<256; i++)
+        total += commandCounts[i];
+      return total;
+    }
+    void resetCommandCounts() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      memset(commandCounts, 0, sizeof(commandCounts));
+      searches.clear();
+    }
+    std::vector<Search> getSearches() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return searches;
+    }
+    uint32_t getBaudRate() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return baudRate;
+    }
+    LedState getLed() {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return led;
+    }
+    std::vector<uint8_t> getNotepad(uint8_t page) {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      return std::vector<uint8_t>(notepad[page & 0x0F], notepad[page & 0x0F] + 32);
+    }
+
+    void receive(HardwareSerial &from, const uint8_t *data, size_t length) override {
+      std::lock_guard<std::recursive_mutex> guard(mutex);
+      if (!connected || from.baudRate() != baudRate) {
+        input.clear(); // garbage at a wrong rate
+        return;
+      }
+      input.insert(input.end(), data, data + length);
+      while (parsePacket()) {}
+    }
+
+  private:
+    struct Fault {
+      FaultType type;
+      uint8_t returnCode;
+      int skip; // commands to pass before this fault
+    };
+
+    HardwareSerial &serial;
+    std::recursive_mutex mutex;
+    uint16_t capacity;
+    uint32_t baudRate;
+    const uint32_t address = 0xFFFFFFFF;
+    uint16_t securityLevel = 3;
+    uint8_t packetSizeCode = 2; // 128 bytes
+    size_t templateSize = 1536;
+    bool connected = true;
+    bool ignoreBaudRateChange = false;
+
+    uint32_t fingerKey = 0; // 0 = no finger on the sensor
+    uint32_t imageKey = 0;  // finger in the image buffer, 0 = no image
+    std::vector<uint8_t> charBuffers[7]; // 1..6
+    std::map<uint16_t, std::vector<uint8_t>> templates;
+    uint8_t notepad[16][32] = {};
+    LedState led;
+    int downloadBuffer = 0; // char buffer receiving data packets after DOWNCHAR, 0 = none
+    std::vector<uint8_t> download;
+
+    std::map<uint8_t, uint32_t> delays;
+    uint32_t searchBaseMicros = 0;
+    uint32_t searchMicrosPerSlot = 0;
+    std::map<uint8_t, std::deque<Fault>> faults;
+    uint32_t commandCounts[256] = {};
+    std::vector<Search> searches;
+
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output; // answer to the current command
+    int64_t busyUntilMicros = 0;
+
+    uint16_t getPacketLength() {
+      return 32 << packetSizeCode;
+    }
+
+    /* one complete packet from the input, false if more bytes are needed */
+    bool parsePacket() {
+      while (input.size() >= 2 && !(input[0] == 0xEF && input[1] == 0x01))
+        input.erase(input.begin()); // out of sync
+      if (input.size() < 9)
+        return false;
+      uint16_t wireLength = ((uint16_t)input[7] << 8) | input[8];
+      if (input.size() < 9u + wireLength)
+        return false;
+      std::vector<uint8_t> packet(input.begin(), input.begin() + 9 + wireLength);
+      input.erase(input.begin(), input.begin() + 9 + wireLength);
+
+      uint32_t packetAddress = ((uint32_t)packet[2] << 24) | ((uint32_t)packet[3] << 16) | ((uint32_t)packet[4] << 8) | packet[5];
+      if (packetAddress != address || wireLength < 2)
+        return true; // not for us
+      uint8_t type = packet[6];
+      uint16_t sum = type + packet[7] + packet[8];
+      for (uint16_t i=0; i<wireLength - 2; i++)
+        sum += packet[9 + i];
+      bool checksumOk = (sum == (((uint16_t)packet[7 + wireLength] << 8) | packet[8 + wireLength]));
+      std::vector<uint8_t> payload(packet.begin() + 9, packet.end() - 2);
+      int64_t arrivalMicros = esp_timer_get_time() + (int64_t)packet.size() * serial.getByteMicros();
+
+      if (type == FINGERPRINT_COMMANDPACKET) {
+        if (!checksumOk || payload.empty()) {
+          answer(arrivalMicros, 0, { FINGERPRINT_PACKETRECIEVEERR });
+          return true;
+        }
+        execute(payload, arrivalMicros);
+      } else if ((type == FINGERPRINT_DATAPACKET || type == FINGERPRINT_ENDDATAPACKET) && downloadBuffer != 0) {
+        download.insert(download.end(), payload.begin(), payload.end()); // data packets are not acknowledged
+        if (type == FINGERPRINT_ENDDATAPACKET) {
+          charBuffers[downloadBuffer] = download;
+          downloadBuffer = 0;
+          download.clear();
+        }
+      }
+      return true;
+    }
+
+    void appendPacket(uint8_t type, const uint8_t *payload, size_t length) {
+      uint16_t wireLength = length + 2;
+      uint8_t header[9] = { 0xEF, 0x01, (uint8_t)(address >> 24), (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address,
+        type, (uint8_t)(wireLength >> 8), (uint8_t)wireLength };
+      uint16_t sum = type + (wireLength >> 8) + (wireLength & 0xFF);
+      for (size_t i=0; i<length; i++)
+        sum += payload[i];
+      output.insert(output.end(), header, header + sizeof(header));
+      output.insert(output.end(), payload, payload + length);
+      output.push_back((uint8_t)(sum >> 8));
+      output.push_back((uint8_t)(sum & 0xFF));
+    }
+
+    /* acknowledge packet with the confirmation code first, delivered after the processing time */
+    void answer(int64_t arrivalMicros, uint32_t processingMicros, std::vector<uint8_t> ack, bool badChecksum = false) {
+      output.clear();
+      appendPacket(FINGERPRINT_ACKPACKET, ack.data(), ack.size());
+      if (badChecksum)
+        output.back() ^= 0x5A;
+      flushOutput(arrivalMicros, processingMicros);
+    }
+
+    void flushOutput(int64_t arrivalMicros, uint32_t processingMicros) {
+      int64_t byteMicros = serial.getByteMicros();
+      int64_t start = std::max(arrivalMicros, busyUntilMicros) + processingMicros;
+      serial.deliver(output.data(), output.size(), start + byteMicros, byteMicros);
+      busyUntilMicros = start + (int64_t)output.size() * byteMicros;
+      output.clear();
+    }
+
+    uint32_t getDelay(uint8_t command) {
+      auto it = delays.find(command);
+      return (it != delays.end()) ? it->second : 0;
+    }
+
+    static bool validBuffer(uint8_t buffer) {
+      return buffer >= 1 && buffer <= 6;
+    }
+
+    void execute(const std::vector<uint8_t> &command, int64_t arrivalMicros) {
+      uint8_t code = command[0];
+      commandCounts[code]++;
+      uint32_t processingMicros = getDelay(code);
+
+      auto fault = faults.find(code);
+      if (fault != faults.end() && !fault->second.empty() && fault->second.front().skip > 0) {
+        fault->second.front().skip--;
+      } else if (fault != faults.end() && !fault->second.empty()) {
+        Fault next = fault->second.front();
+        fault->second.pop_front();
+        if (next.type == FaultType::noReply)
+          return;
+        if (next.type == FaultType::badChecksum) {
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK }, true);
+          return;
+        }
+        if (code == FINGERPRINT_SEARCH || code == FINGERPRINT_HISPEEDSEARCH)
+          searches.push_back({ (uint16_t)((command[2] << 8) | command[3]), (uint16_t)((command[4] << 8) | command[5]), next.returnCode });
+        answer(arrivalMicros, processingMicros, { next.returnCode });
+        return;
+      }
+
+      auto arg = [&command](size_t index) -> uint8_t { return (index < command.size()) ? command[index] : 0; };
+      switch (code) {
+        case FINGERPRINT_VERIFYPASSWORD: {
+          uint32_t password = ((uint32_t)arg(1) << 24) | ((uint32_t)arg(2) << 16) | ((uint32_t)arg(3) << 8) | arg(4);
+          answer(arrivalMicros, processingMicros, { (uint8_t)((password == 0) ? FINGERPRINT_OK : FINGERPRINT_PASSFAIL) });
+          break;
+        }
+        case FINGERPRINT_READSYSPARAM: {
+          uint16_t baudFactor = baudRate / 9600;
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK, 0x00, 0x00, 0x00, 0x09, (uint8_t)(capacity >> 8), (uint8_t)capacity,
+            (uint8_t)(securityLevel >> 8), (uint8_t)securityLevel, (uint8_t)(address >> 24), (uint8_t)(address >> 16), (uint8_t)(address >> 8),
+            (uint8_t)address, 0x00, packetSizeCode, (uint8_t)(baudFactor >> 8), (uint8_t)baudFactor });
+          break;
+        }
+        case FINGERPRINT_TEMPLATECOUNT:
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK, (uint8_t)(templates.size() >> 8), (uint8_t)templates.size() });
+          break;
+        case FINGERPRINT_GETIMAGE:
+          imageKey = fingerKey;
+          answer(arrivalMicros, processingMicros, { (uint8_t)((fingerKey != 0) ? FINGERPRINT_OK : FINGERPRINT_NOFINGER) });
+          break;
+        case FINGERPRINT_IMAGE2TZ:
+          if (!validBuffer(arg(1))) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_PACKETRESPONSEFAIL });
+          } else if (imageKey == 0) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_INVALIDIMAGE });
+          } else {
+            charBuffers[arg(1)] = makeTemplate(imageKey, templateSize);
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          }
+          break;
+        case FINGERPRINT_SEARCH:
+        case FINGERPRINT_HISPEEDSEARCH: {
+          uint16_t start = ((uint16_t)arg(2) << 8) | arg(3);
+          uint16_t count = ((uint16_t)arg(4) << 8) | arg(5);
+          uint32_t key = validBuffer(arg(1)) ? keyOf(charBuffers[arg(1)]) : 0;
+          processingMicros += searchBaseMicros + searchMicrosPerSlot * count;
+          uint8_t result = FINGERPRINT_NOTFOUND;
+          uint16_t id = 0;
+          for (auto it = templates.lower_bound(start); key != 0 && it != templates.end() && it->first < (uint32_t)start + count; ++it) {
+            if (keyOf(it->second) == key) {
+              result = FINGERPRINT_OK;
+              id = it->first;
+              break;
+            }
+          }
+          searches.push_back({ start, count, result });
+          uint16_t score = (result == FINGERPRINT_OK) ? 100 + key % 100 : 0;
+          answer(arrivalMicros, processingMicros, { result, (uint8_t)(id >> 8), (uint8_t)id, (uint8_t)(score >> 8), (uint8_t)score });
+          break;
+        }
+        case FINGERPRINT_REGMODEL: {
+          // combines all char buffers with features, they all have to be of the same finger
+          uint32_t key = 0;
+          uint8_t result = FINGERPRINT_OK;
+          for (int i=1; i<=6; i++) {
+            if (charBuffers[i].empty())
+              continue;
+            if (key != 0 && keyOf(charBuffers[i]) != key)
+              result = FINGERPRINT_ENROLLMISMATCH;
+            key = keyOf(charBuffers[i]);
+          }
+          if (key == 0)
+            result = FINGERPRINT_ENROLLMISMATCH;
+          if (result == FINGERPRINT_OK) {
+            charBuffers[1] = makeTemplate(key, templateSize);
+            for (int i=2; i<=6; i++)
+              charBuffers[i].clear();
+          }
+          answer(arrivalMicros, processingMicros, { result });
+          break;
+        }
+        case FINGERPRINT_STORE: {
+          uint16_t id = ((uint16_t)arg(2) << 8) | arg(3);
+          uint8_t result = FINGERPRINT_OK;
+          if (id >= capacity)
+            result = FINGERPRINT_BADLOCATION;
+          else if (!validBuffer(arg(1)) || charBuffers[arg(1)].empty())
+            result = FINGERPRINT_PACKETRESPONSEFAIL;
+          else
+            templates[id] = charBuffers[arg(1)];
+          answer(arrivalMicros, processingMicros, { result });
+          break;
+        }
+        case FINGERPRINT_LOAD: {
+          uint16_t id = ((uint16_t)arg(2) << 8) | arg(3);
+          auto it = templates.find(id);
+          if (id >= capacity) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_BADLOCATION });
+          } else if (it == templates.end() || !validBuffer(arg(1))) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_DBREADFAIL });
+          } else {
+            charBuffers[arg(1)] = it->second;
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          }
+          break;
+        }
+        case FINGERPRINT_UPLOAD: {
+          if (!validBuffer(arg(1)) || charBuffers[arg(1)].empty()) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_UPLOADFEATUREFAIL });
+            break;
+          }
+          // acknowledge, followed by the template in data packets, the last one as end packet
+          const std::vector<uint8_t> &data = charBuffers[arg(1)];
+          output.clear();
+          uint8_t ok = FINGERPRINT_OK;
+          appendPacket(FINGERPRINT_ACKPACKET, &ok, 1);
+          for (size_t offset=0; offset<data.size(); offset+=getPacketLength()) {
+            size_t length = std::min((size_t)getPacketLength(), data.size() - offset);
+            appendPacket((offset + length < data.size()) ? FINGERPRINT_DATAPACKET : FINGERPRINT_ENDDATAPACKET, data.data() + offset, length);
+          }
+          flushOutput(arrivalMicros, processingMicros);
+          break;
+        }
+        case cmdDownChar:
+          if (!validBuffer(arg(1))) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_PACKETRESPONSEFAIL });
+          } else {
+            downloadBuffer = arg(1);
+            download.clear();
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          }
+          break;
+        case FINGERPRINT_DELETE: {
+          uint16_t id = ((uint16_t)arg(1) << 8) | arg(2);
+          uint16_t count = ((uint16_t)arg(3) << 8) | arg(4);
+          if ((uint32_t)id + count > capacity) {
+            answer(arrivalMicros, processingMicros, { FINGERPRINT_BADLOCATION });
+            break;
+          }
+          for (uint16_t i=0; i<count; i++)
+            templates.erase(id + i);
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          break;
+        }
+        case FINGERPRINT_EMPTY:
+          templates.clear();
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          break;
+        case FINGERPRINT_WRITE_REG: {
+          uint8_t result = FINGERPRINT_OK;
+          uint32_t newBaudRate = baudRate;
+          if (arg(1) == FINGERPRINT_BAUD_REG_ADDR && arg(2) >= 1 && arg(2) <= 12)
+            newBaudRate = arg(2) * 9600;
+          else if (arg(1) == FINGERPRINT_SECURITY_REG_ADDR && arg(2) >= 1 && arg(2) <= 5)
+            securityLevel = arg(2);
+          else if (arg(1) == FINGERPRINT_PACKET_REG_ADDR && arg(2) <= 3)
+            packetSizeCode = arg(2);
+          else
+            result = FINGERPRINT_INVALIDREG;
+          answer(arrivalMicros, processingMicros, { result }); // still at the old rate
+          if (!ignoreBaudRateChange)
+            baudRate = newBaudRate;
+          break;
+        }
+        case cmdReadIndexTable: {
+          std::vector<uint8_t> ack(33, 0);
+          ack[0] = FINGERPRINT_OK;
+          for (auto &entry : templates) {
+            if (entry.first / 256 == arg(1))
+              ack[1 + (entry.first % 256) / 8] |= 1 << (entry.first % 8);
+          }
+          answer(arrivalMicros, processingMicros, ack);
+          break;
+        }
+        case cmdWriteNotepad:
+          memset(notepad[arg(1) & 0x0F], 0, 32);
+          for (size_t i=0; i<32 && i + 2 < command.size(); i++)
+            notepad[arg(1) & 0x0F][i] = command[i + 2];
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          break;
+        case cmdReadNotepad: {
+          std::vector<uint8_t> ack(1, FINGERPRINT_OK);
+          ack.insert(ack.end(), notepad[arg(1) & 0x0F], notepad[arg(1) & 0x0F] + 32);
+          answer(arrivalMicros, processingMicros, ack);
+          break;
+        }
+        case FINGERPRINT_AURALEDCONFIG:
+          led.control = arg(1);
+          led.speed = arg(2);
+          led.color = arg(3);
+          led.count = arg(4);
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_OK });
+          break;
+        default:
+          answer(arrivalMicros, processingMicros, { FINGERPRINT_PACKETRESPONSEFAIL });
+          break;
+      }
+    }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef NATIVE_SENSORFIXTURE_H
+#define NATIVE_SENSORFIXTURE_H
+
+/*
+  FingerprintManager connected to an emulated R503 on Serial2, shared by the sensor test suites.
+  Fingers enrolled before connect() are stored on the emulator and named in NVS like a previous enrollment would have done.
+*/
+
+#include "NativeTest.h"
+#include "R503Emulator.h"
+#include "FingerprintManager.h"
+#include "FingerNameTable.h"
+
+struct SensorFixture {
+  R503Emulator sensor;
+  FingerprintManager manager;
+
+  explicit SensorFixture(uint16_t capacity = 200, uint32_t baudRate = 57600)
+    : sensor(Serial2, capacity, baudRate), manager(Serial2, defaultTouchRingPin) {}
+
+  /* template of finger "key" in slot id, named in NVS if name is not NULL */
+  void enroll(uint16_t id, uint32_t key, const char *name) {
+    sensor.storeTemplate(id, key);
+    if (name != NULL)
+      nameFinger(id, name);
+  }
+  void nameFinger(uint16_t id, const char *name) {
+    FingerNameTable names;
+    names.loadFromPrefs("fingerList");
+    names.set(id, name);
+    names.saveToPrefs("fingerList");
+  }
+
+  /* finger on the sensor and ring touched (ring is LOW while touched) */
+  void touch(uint32_t key) {
+    sensor.placeFinger(key);
+    hostGpio().setLevel(defaultTouchRingPin, LOW);
+  }
+  void release() {
+    sensor.liftFinger();
+    hostGpio().setLevel(defaultTouchRingPin, HIGH);
+  }
+};
+
+#endif
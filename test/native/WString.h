@@ -0,0 +1,140 @@
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+
+/*
+  Host shim of the Arduino String, backed by std::string. Only the part of the API used by the sources under test.
+  Numbers are formatted like the ESP32 core does (floats with 2 decimals by default).
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class String {
+  public:
+    String(const char *text = "") : text(text != NULL ? text : "") {}
+    String(const String &other) = default;
+    String(String &&other) = default;
+    explicit String(char c) : text(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : text(format((unsigned long long)value, base)) {}
+    explicit String(int value, unsigned char base = 10) : text(formatSigned(value, base)) {}
+    explicit String(unsigned int value, unsigned char base = 10) : text(format((unsigned long long)value, base)) {}
+    explicit String(long value, unsigned char base = 10) : text(formatSigned(value, base)) {}
+    explicit String(unsigned long value, unsigned char base = 10) : text(format((unsigned long long)value, base)) {}
+    explicit String(long long value, unsigned char base = 10) : text(formatSigned(value, base)) {}
+    explicit String(unsigned long long value, unsigned char base = 10) : text(format(value, base)) {}
+    explicit String(float value, unsigned int decimals = 2) : text(formatFloat(value, decimals)) {}
+    explicit String(double value, unsigned int decimals = 2) : text(formatFloat(value, decimals)) {}
+
+    String& operator=(const String &other) = default;
+    String& operator=(String &&other) = default;
+    String& operator=(const char *other) { text = (other != NULL) ? other : ""; return *this; }
+
+    const char* c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.length(); }
+    bool isEmpty() const { return text.empty(); }
+    bool reserve(unsigned int size) { text.reserve(size); return true; }
+    char charAt(unsigned int index) const { return (index < text.length()) ? text[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return text[index]; }
+
+    bool concat(const String &other) { text += other.text; return true; }
+    bool concat(const char *other) { text += (other != NULL) ? other : ""; return true; }
+    bool concat(char c) { text += c; return true; }
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    bool concat(T value) { return concat(String(value)); }
+
+    String& operator+=(const String &other) { concat(other); return *this; }
+    String& operator+=(const char *other) { concat(other); return *this; }
+    String& operator+=(char c) { concat(c); return *this; }
+    template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    String& operator+=(T value) { concat(value); return *this; }
+
+    bool equals(const String &other) const { return text == other.text; }
+    bool equals(const char *other) const { return text == (other != NULL ? other : ""); }
+    bool operator==(const String &other) const { return equals(other); }
+    bool operator==(const char *other) const { return equals(other); }
+    bool operator!=(const String &other) const { return !equals(other); }
+    bool operator!=(const char *other) const { return !equals(other); }
+    bool operator<(const String &other) const { return text < other.text; }
+    bool startsWith(const String &prefix) const { return text.compare(0, prefix.text.length(), prefix.text) == 0; }
+    bool endsWith(const String &suffix) const {
+      return text.length() >= suffix.text.length() && text.compare(text.length() - suffix.text.length(), suffix.text.length(), suffix.text) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return toIndex(text.find(c, from)); }
+    int indexOf(const String &part, unsigned int from = 0) const { return toIndex(text.find(part.text, from)); }
+    int lastIndexOf(char c) const { return toIndex(text.rfind(c)); }
+    int lastIndexOf(const String &part) const { return toIndex(text.rfind(part.text)); }
+    String substring(unsigned int from) const { return (from < text.length()) ? String(text.substr(from).c_str()) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to)
+        std::swap(from, to);
+      return (from < text.length()) ? String(text.substr(from, to - from).c_str()) : String();
+    }
+    void replace(const String &find, const String &replacement) {
+      if (find.isEmpty())
+        return;
+      size_t pos = 0;
+      while ((pos = text.find(find.text, pos)) != std::string::npos) {
+        text.replace(pos, find.text.length(), replacement.text);
+        pos += replacement.text.length();
+      }
+    }
+    void trim() {
+      size_t start = text.find_first_not_of(" \t\r\n");
+      size_t end = text.find_last_not_of(" \t\r\n");
+      text = (start == std::string::npos) ? "" : text.substr(start, end - start + 1);
+    }
+    void toLowerCase() { for (char &c : text) c = tolower(c); }
+    void toUpperCase() { for (char &c : text) c = toupper(c); }
+    long toInt() const { return atol(text.c_str()); }
+    float toFloat() const { return atof(text.c_str()); }
+
+  private:
+    std::string text;
+
+    static int toIndex(size_t pos) { return (pos == std::string::npos) ? -1 : (int)pos; }
+    static std::string format(unsigned long long value, unsigned char base) {
+      if (base < 2 || base > 36)
+        base = 10;
+      char buffer[72];
+      int pos = sizeof(buffer) - 1;
+      buffer[pos] = 0;
+      do {
+        int digit = value % base;
+        buffer[--pos] = (digit < 10) ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+      } while (value > 0);
+      return std::string(buffer + pos);
+    }
+    static std::string formatSigned(long long value, unsigned char base) {
+      if (base == 10 && value < 0)
+        return "-" + format((unsigned long long)(-(value + 1)) + 1, base);
+      return format((unsigned long long)value, base);
+    }
+    static std::string formatFloat(double value, unsigned int decimals) {
+      char buffer[64];
+      snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+      return std::string(buffer);
+    }
+};
+
+inline String operator+(const String &left, const String &right) { String result(left); result += right; return result; }
+inline String operator+(const String &left, const char *right) { String result(left); result += right; return result; }
+inline String operator+(const char *left, const String &right) { String result(left); result += right; return result; }
+inline String operator+(const String &left, char right) { String result(left); result += right; return result; }
+template<typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+inline String operator+(const String &left, T right) { String result(left); result += right; return result; }
+
+#define F(text) (text) // no separate flash address space on the host
+
+#endif
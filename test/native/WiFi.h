@@ -0,0 +1,7 @@
+#ifndef NATIVE_WIFI_H
+#define NATIVE_WIFI_H
+
+#include <Arduino.h>
+#include "esp_wifi.h"
+
+#endif
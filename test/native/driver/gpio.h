@@ -0,0 +1,27 @@
+#ifndef NATIVE_DRIVER_GPIO_H
+#define NATIVE_DRIVER_GPIO_H
+
+#include "esp_err.h"
+
+/* host shim of the GPIO driver, wakeup configuration is accepted and ignored */
+
+typedef int gpio_num_t;
+
+typedef enum {
+  GPIO_INTR_DISABLE = 0,
+  GPIO_INTR_POSEDGE = 1,
+  GPIO_INTR_NEGEDGE = 2,
+  GPIO_INTR_ANYEDGE = 3,
+  GPIO_INTR_LOW_LEVEL = 4,
+  GPIO_INTR_HIGH_LEVEL = 5,
+} gpio_int_type_t;
+
+inline esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type) {
+  return ESP_OK;
+}
+
+inline esp_err_t gpio_wakeup_disable(gpio_num_t pin) {
+  return ESP_OK;
+}
+
+#endif
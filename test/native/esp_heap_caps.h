@@ -0,0 +1,18 @@
+#ifndef NATIVE_ESP_HEAP_CAPS_H
+#define NATIVE_ESP_HEAP_CAPS_H
+
+#include <Arduino.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+/* no fragmentation on the host, the largest block is all free heap */
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return ESP.getFreeHeap();
+}
+
+inline size_t heap_caps_get_free_size(uint32_t caps) {
+  return ESP.getFreeHeap();
+}
+
+#endif
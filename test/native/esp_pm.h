@@ -0,0 +1,49 @@
+#ifndef NATIVE_ESP_PM_H
+#define NATIVE_ESP_PM_H
+
+/*
+  Host shim of the power management locks. Locks can be created and are counted, so tests can check that every acquire
+  is paired with a release. esp_pm_configure() reports ESP_ERR_NOT_SUPPORTED like a build without CONFIG_PM_ENABLE.
+*/
+
+#include <atomic>
+#include "esp_err.h"
+
+typedef enum { ESP_PM_CPU_FREQ_MAX, ESP_PM_APB_FREQ_MAX, ESP_PM_NO_LIGHT_SLEEP } esp_pm_lock_type_t;
+
+struct HostPmLock {
+  esp_pm_lock_type_t type;
+  std::atomic<int> count { 0 };
+};
+typedef HostPmLock* esp_pm_lock_handle_t;
+
+typedef struct {
+  int max_freq_mhz;
+  int min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+inline esp_err_t esp_pm_configure(const void *config) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+inline esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char *name, esp_pm_lock_handle_t *handle) {
+  HostPmLock *lock = new HostPmLock();
+  lock->type = type;
+  *handle = lock;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+  handle->count++;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+  if (handle->count == 0)
+    return ESP_ERR_INVALID_STATE;
+  handle->count--;
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef NATIVE_ESP_SLEEP_H
+#define NATIVE_ESP_SLEEP_H
+
+#include "esp_err.h"
+
+/* host shim, there is no light sleep on the host */
+inline esp_err_t esp_sleep_enable_gpio_wakeup() {
+  return ESP_OK;
+}
+
+#endif
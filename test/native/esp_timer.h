@@ -0,0 +1,6 @@
+#ifndef NATIVE_ESP_TIMER_H
+#define NATIVE_ESP_TIMER_H
+
+#include "freertos/FreeRTOS.h" // esp_timer_get_time() lives next to the tick clock of the shim
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef NATIVE_ESP_WIFI_H
+#define NATIVE_ESP_WIFI_H
+
+#include "esp_err.h"
+
+/* host shim, only the power save setting used by PowerManager */
+
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+
+inline esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) {
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+
+/*
+  Host shim of the FreeRTOS API used by the sources under test: tasks are std::threads, queues and semaphores are
+  condition variable protected deques, one tick is one millisecond. Blocking calls wake up every few milliseconds to
+  check whether their task was deleted by hostDeleteTasks(), the task then unwinds by an exception. This way a test can
+  stop a sensor task that is blocked in the middle of a UART read.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskIDLE_PRIORITY 0
+#define ARDUINO_RUNNING_CORE 1
+
+enum eNotifyAction { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite };
+
+struct HostTaskDeleted {}; // thrown inside a task that was deleted from another task
+
+struct HostTask {
+  std::string name;
+  TaskFunction_t function = NULL;
+  void *arg = NULL;
+  std::thread thread;
+  std::atomic<bool> deleteRequested { false };
+  std::mutex mutex;
+  std::condition_variable changed;
+  uint32_t notifyValue = 0;
+  bool notifyPending = false;
+};
+typedef HostTask* TaskHandle_t;
+
+struct HostQueue {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  size_t length;
+  size_t itemSize;
+};
+typedef HostQueue* QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+
+/* critical sections may nest (like on the same core of the ESP32) */
+struct portMUX_TYPE {
+  std::recursive_mutex mutex;
+  portMUX_TYPE() {}
+  portMUX_TYPE(const portMUX_TYPE &) {}
+  portMUX_TYPE& operator=(const portMUX_TYPE &) { return *this; }
+};
+#define portMUX_INITIALIZER_UNLOCKED portMUX_TYPE()
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL_ISR(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL_ISR(mux) (mux)->mutex.unlock()
+#define portYIELD_FROM_ISR(...) ((void)0)
+#define taskYIELD() std::this_thread::yield()
+
+inline std::chrono::steady_clock::time_point hostStartTime() {
+  static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  return start;
+}
+
+inline int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStartTime()).count();
+}
+
+/* all tasks created so far, the main thread (setup/loop, test runner) gets its own handle on first use */
+inline std::mutex& hostTaskListMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline std::vector<HostTask*>& hostTaskList() {
+  static std::vector<HostTask*> tasks;
+  return tasks;
+}
+
+inline HostTask*& hostCurrentTaskSlot() {
+  thread_local HostTask *current = NULL;
+  return current;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+  HostTask *&current = hostCurrentTaskSlot();
+  if (current == NULL) {
+    current = new HostTask(); // never deleted, lives as long as the thread
+    current->name = "main";
+  }
+  return current;
+}
+
+inline void hostCheckDeleted() {
+  if (xTaskGetCurrentTaskHandle()->deleteRequested)
+    throw HostTaskDeleted();
+}
+
+/* waits until predicate() is true or timeout, in short slices so a deletion of the waiting task is noticed */
+template<typename Predicate>
+bool hostWait(std::unique_lock<std::mutex> &lock, std::condition_variable &changed, TickType_t ticks, Predicate predicate) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks);
+  while (!predicate()) {
+    hostCheckDeleted();
+    auto now = std::chrono::steady_clock::now();
+    if (ticks != portMAX_DELAY && now >= deadline)
+      return false;
+    auto slice = now + std::chrono::milliseconds(5);
+    changed.wait_until(lock, (ticks != portMAX_DELAY && deadline < slice) ? deadline : slice);
+  }
+  return true;
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+  HostTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  hostWait(lock, task->changed, ticks, [] { return false; });
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority,
+  TaskHandle_t *handle, BaseType_t core) {
+  HostTask *task = new HostTask();
+  task->name = name;
+  task->function = function;
+  task->arg = arg;
+  if (handle != NULL)
+    *handle = task; // before the task runs, like the real scheduler does with a higher priority task
+  {
+    std::lock_guard<std::mutex> guard(hostTaskListMutex());
+    hostTaskList().push_back(task);
+  }
+  task->thread = std::thread([task] {
+    hostCurrentTaskSlot() = task;
+    try {
+      task->function(task->arg);
+    } catch (HostTaskDeleted &) {
+    }
+  });
+  return pdPASS;
+}
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth, void *arg, UBaseType_t priority, TaskHandle_t *handle) {
+  return xTaskCreatePinnedToCore(function, name, stackDepth, arg, priority, handle, ARDUINO_RUNNING_CORE);
+}
+
+/* a task deleting itself unwinds immediately, other tasks are stopped at their next blocking call and joined */
+inline void vTaskDelete(TaskHandle_t handle) {
+  HostTask *task = (handle != NULL) ? handle : xTaskGetCurrentTaskHandle();
+  task->deleteRequested = true;
+  if (task == xTaskGetCurrentTaskHandle())
+    throw HostTaskDeleted();
+  task->changed.notify_all();
+  if (task->thread.joinable())
+    task->thread.join();
+  std::lock_guard<std::mutex> guard(hostTaskListMutex());
+  for (size_t i=0; i<hostTaskList().size(); i++) {
+    if (hostTaskList()[i] == task)
+      hostTaskList().erase(hostTaskList().begin() + i);
+  }
+}
+
+/* stops all tasks created by the code under test, for the tearDown() of a test */
+inline void hostDeleteTasks() {
+  while (true) {
+    HostTask *task = NULL;
+    {
+      std::lock_guard<std::mutex> guard(hostTaskListMutex());
+      if (hostTaskList().empty())
+        return;
+      task = hostTaskList().back();
+    }
+    vTaskDelete(task);
+  }
+}
+
+inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  std::lock_guard<std::mutex> guard(task->mutex);
+  bool wasPending = task->notifyPending;
+  switch (action) {
+    case eSetBits: task->notifyValue |= value; break;
+    case eIncrement: task->notifyValue++; break;
+    case eSetValueWithOverwrite: task->notifyValue = value; break;
+    case eSetValueWithoutOverwrite:
+      if (wasPending)
+        return pdFAIL;
+      task->notifyValue = value;
+      break;
+    case eNoAction: break;
+  }
+  task->notifyPending = true;
+  task->changed.notify_all();
+  return pdPASS;
+}
+
+inline BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *higherPriorityTaskWoken) {
+  if (higherPriorityTaskWoken != NULL)
+    *higherPriorityTaskWoken = pdFALSE;
+  return xTaskNotify(task, value, action);
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  return xTaskNotify(task, 0, eIncrement);
+}
+
+inline BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticks) {
+  HostTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  if (!task->notifyPending)
+    task->notifyValue &= ~clearOnEntry;
+  bool notified = hostWait(lock, task->changed, ticks, [task] { return task->notifyPending; });
+  if (value != NULL)
+    *value = task->notifyValue;
+  if (notified)
+    task->notifyValue &= ~clearOnExit;
+  task->notifyPending = false;
+  return notified ? pdTRUE : pdFALSE;
+}
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  HostTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+  hostWait(lock, task->changed, ticks, [task] { return task->notifyValue != 0; });
+  uint32_t value = task->notifyValue;
+  if (value != 0)
+    task->notifyValue = clearOnExit ? 0 : value - 1;
+  task->notifyPending = false;
+  return value;
+}
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  HostQueue *queue = new HostQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+inline void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!hostWait(lock, queue->changed, ticks, [queue] { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+  const uint8_t *bytes = (const uint8_t*)item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken) {
+  if (higherPriorityTaskWoken != NULL)
+    *higherPriorityTaskWoken = pdFALSE;
+  return xQueueSend(queue, item, 0);
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!hostWait(lock, queue->changed, ticks, [queue] { return !queue->items.empty(); }))
+    return pdFALSE;
+  if (queue->itemSize > 0 && item != NULL)
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> guard(queue->mutex);
+  return queue->items.size();
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xQueueCreate(1, 0);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t semaphore = xQueueCreate(1, 0);
+  xQueueSend(semaphore, NULL, 0); // mutexes are created available
+  return semaphore;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+  return xQueueReceive(semaphore, NULL, ticks);
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  return xQueueSend(semaphore, NULL, 0);
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+  vQueueDelete(semaphore);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef NATIVE_HAL_GPIO_LL_H
+#define NATIVE_HAL_GPIO_LL_H
+
+#include "driver/gpio.h"
+
+/* host shim of the GPIO low level layer, the register block is a dummy */
+
+typedef struct {
+  int unused;
+} gpio_dev_t;
+
+inline gpio_dev_t GPIO;
+
+inline void gpio_ll_set_intr_type(gpio_dev_t *hw, gpio_num_t pin, gpio_int_type_t type) {
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef NATIVE_NVS_H
+#define NATIVE_NVS_H
+
+/* host shim of the NVS entry iterator (ESP-IDF 4.4 API) over the in-memory NVS of the Preferences shim */
+
+#include <Preferences.h>
+
+typedef struct {
+  char namespace_name[16];
+  char key[16];
+  nvs_type_t type;
+} nvs_entry_info_t;
+
+struct HostNvsIterator {
+  std::vector<nvs_entry_info_t> entries; // snapshot taken by nvs_entry_find()
+  size_t position = 0;
+};
+typedef HostNvsIterator* nvs_iterator_t;
+
+inline nvs_iterator_t nvs_entry_find(const char *partitionName, const char *namespaceName, nvs_type_t type) {
+  std::lock_guard<std::recursive_mutex> guard(hostNvs().mutex);
+  HostNvsIterator *it = new HostNvsIterator();
+  for (auto &space : hostNvs().namespaces) {
+    if (namespaceName != NULL && space.first != namespaceName)
+      continue;
+    for (auto &item : space.second) {
+      if (type != NVS_TYPE_ANY && item.second.type != type)
+        continue;
+      nvs_entry_info_t info;
+      snprintf(info.namespace_name, sizeof(info.namespace_name), "%s", space.first.c_str());
+      snprintf(info.key, sizeof(info.key), "%s", item.first.c_str());
+      info.type = item.second.type;
+      it->entries.push_back(info);
+    }
+  }
+  if (it->entries.empty()) {
+    delete it;
+    return NULL;
+  }
+  return it;
+}
+
+inline void nvs_entry_info(nvs_iterator_t it, nvs_entry_info_t *info) {
+  *info = it->entries[it->position];
+}
+
+/* releases the iterator and returns NULL at the end, like ESP-IDF 4.4 */
+inline nvs_iterator_t nvs_entry_next(nvs_iterator_t it) {
+  if (++it->position < it->entries.size())
+    return it;
+  delete it;
+  return NULL;
+}
+
+inline void nvs_release_iterator(nvs_iterator_t it) {
+  delete it;
+}
+
+#endif
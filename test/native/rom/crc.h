@@ -0,0 +1,18 @@
+#ifndef NATIVE_ROM_CRC_H
+#define NATIVE_ROM_CRC_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* CRC32 (IEEE 802.3, reflected) like crc32_le() of the ESP32 ROM, including the inversion before and after */
+inline uint32_t crc32_le(uint32_t crc, const uint8_t *buffer, uint32_t length) {
+  crc = ~crc;
+  for (uint32_t i=0; i<length; i++) {
+    crc ^= buffer[i];
+    for (int bit=0; bit<8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+  Enrollment state machine on the sensor task against the emulated sensor. The progress callback plays the user: it places
+  the finger when a sample is requested and lifts it when asked to.
+*/
+
+#include "SensorFixture.h"
+#include <atomic>
+
+SensorFixture *fixture = NULL;
+std::atomic<uint32_t> fingerKey;
+std::atomic<int> mismatchSample;
+std::atomic<bool> done;
+std::atomic<int> doneResult;
+std::atomic<int> doneReturnCode;
+std::atomic<int> lastStatus;
+std::atomic<int> samplesTaken;
+
+void onProgress(const EnrollProgress &progress) {
+  lastStatus = (int)progress.status;
+  if (progress.status == EnrollStatus::waitForFinger && fingerKey != 0)
+    fixture->sensor.placeFinger((progress.sample == mismatchSample) ? fingerKey + 1 : (uint32_t)fingerKey);
+  else if (progress.status == EnrollStatus::liftFinger)
+    fixture->sensor.liftFinger();
+  else if (progress.status == EnrollStatus::sampleTaken)
+    samplesTaken++;
+}
+
+void onDone(NewFinger newFinger) {
+  doneResult = (int)newFinger.enrollResult;
+  doneReturnCode = newFinger.returnCode;
+  done = true;
+}
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+  fingerKey = 0x7777;
+  mismatchSample = 0;
+  done = false;
+  doneResult = -1;
+  doneReturnCode = -1;
+  lastStatus = -1;
+  samplesTaken = 0;
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.setEnrollProgressCallback(onProgress);
+  fixture->manager.startSensorTask(TouchWakeup::polling);
+}
+
+void tearDown() {
+  hostDeleteTasks();
+  delete fixture;
+  fixture = NULL;
+}
+
+void test_enroll_stores_template_and_name() {
+  uint32_t generation = fixture->manager.getFingerListGeneration();
+  fixture->manager.startEnrollment(12, "Dave", onDone);
+  TEST_ASSERT_TRUE(waitFor([] { return done.load(); }, 5000));
+  TEST_ASSERT_EQUAL((int)EnrollResult::ok, doneResult);
+  TEST_ASSERT_EQUAL((int)EnrollStatus::done, lastStatus);
+  TEST_ASSERT_EQUAL(5, samplesTaken);
+  TEST_ASSERT_EQUAL_UINT32(0x7777, fixture->sensor.getTemplateKey(12));
+  TEST_ASSERT_FALSE(fixture->manager.isEnrolling());
+  TEST_ASSERT_EQUAL(1, fixture->manager.getFingerCount()); // published by the sensor task
+  TEST_ASSERT_NOT_EQUAL(generation, fixture->manager.getFingerListGeneration());
+
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL_STRING("Dave", names.find(12));
+
+  // the new finger is recognized by the next scan
+  fixture->touch(0x7777);
+  Match match;
+  TEST_ASSERT_TRUE(waitFor([&] { return fixture->manager.getNextMatch(match) && match.scanResult == ScanResult::matchFound; }, 2000));
+  TEST_ASSERT_EQUAL_UINT16(12, match.matchId);
+}
+
+void test_messy_sample_fails_enrollment() {
+  fixture->sensor.injectReturnCode(FINGERPRINT_IMAGE2TZ, FINGERPRINT_IMAGEMESS);
+  fixture->manager.startEnrollment(12, "Dave", onDone);
+  TEST_ASSERT_TRUE(waitFor([] { return done.load(); }, 5000));
+  TEST_ASSERT_EQUAL((int)EnrollResult::error, doneResult);
+  TEST_ASSERT_EQUAL(FINGERPRINT_IMAGEMESS, doneReturnCode);
+  TEST_ASSERT_EQUAL((int)EnrollStatus::failed, lastStatus);
+  TEST_ASSERT_FALSE(fixture->sensor.hasTemplate(12));
+  TEST_ASSERT_EQUAL(0, fixture->manager.getFingerCount());
+}
+
+void test_different_fingers_fail_enrollment() {
+  mismatchSample = 3;
+  fixture->manager.startEnrollment(12, "Dave", onDone);
+  TEST_ASSERT_TRUE(waitFor([] { return done.load(); }, 5000));
+  TEST_ASSERT_EQUAL((int)EnrollResult::error, doneResult);
+  TEST_ASSERT_EQUAL(FINGERPRINT_ENROLLMISMATCH, doneReturnCode);
+  TEST_ASSERT_FALSE(fixture->sensor.hasTemplate(12));
+}
+
+void test_flash_error_on_store_fails_enrollment() {
+  fixture->sensor.injectReturnCode(FINGERPRINT_STORE, FINGERPRINT_FLASHERR);
+  fixture->manager.startEnrollment(12, "Dave", onDone);
+  TEST_ASSERT_TRUE(waitFor([] { return done.load(); }, 5000));
+  TEST_ASSERT_EQUAL((int)EnrollResult::error, doneResult);
+  TEST_ASSERT_EQUAL(FINGERPRINT_FLASHERR, doneReturnCode);
+  TEST_ASSERT_EQUAL(0, fixture->manager.getFingerCount()); // no name without template
+}
+
+void test_cancel_while_waiting_for_finger() {
+  fingerKey = 0; // nobody places a finger
+  fixture->manager.startEnrollment(12, "Dave", onDone);
+  TEST_ASSERT_TRUE(waitFor([] { return lastStatus == (int)EnrollStatus::waitForFinger; }, 2000));
+  TEST_ASSERT_TRUE(fixture->manager.isEnrolling());
+  fixture->manager.cancelEnrollment();
+  TEST_ASSERT_TRUE(done);
+  TEST_ASSERT_EQUAL((int)EnrollStatus::cancelled, lastStatus);
+  TEST_ASSERT_FALSE(fixture->manager.isEnrolling());
+  TEST_ASSERT_TRUE(wasNotified("cancelled"));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_enroll_stores_template_and_name);
+  RUN_TEST(test_messy_sample_fails_enrollment);
+  RUN_TEST(test_different_fingers_fail_enrollment);
+  RUN_TEST(test_flash_error_on_store_fails_enrollment);
+  RUN_TEST(test_cancel_while_waiting_for_finger);
+  return UNITY_END();
+}
@@ -0,0 +1,171 @@
+/*
+  Sensor replacement: export of the templates and names of one emulated sensor to LittleFS and import into a new one,
+  including an import that is interrupted and resumed. While a job runs other callers of the sensor task fail fast.
+*/
+
+#include "SensorFixture.h"
+
+SensorFixture *fixture = NULL;
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+}
+
+void tearDown() {
+  hostDeleteTasks();
+  delete fixture;
+  fixture = NULL;
+}
+
+/* exports fingers 1, 2 and 40 of the current sensor and connects a new, empty one (file system is kept) */
+void exportAndReplaceSensor(uint16_t newCapacity = 200) {
+  fixture->enroll(1, 0x101, "Alice");
+  fixture->enroll(2, 0x102, "Bob");
+  fixture->enroll(40, 0x140, "Carol");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.exportSensorDB();
+  TEST_ASSERT_TRUE(wasNotified("Export of 3 fingerprints finished"));
+  TEST_ASSERT_TRUE(LittleFS.exists("/sensordb.bin"));
+
+  delete fixture;
+  hostNvs().reset();
+  fixture = new SensorFixture(newCapacity);
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+}
+
+void test_export_import_round_trip() {
+  std::vector<uint8_t> original = R503Emulator::makeTemplate(0x140);
+  exportAndReplaceSensor();
+
+  fixture->manager.importSensorDB(false);
+  TEST_ASSERT_TRUE(wasNotified("Import of 3 fingerprints finished"));
+  TEST_ASSERT_EQUAL_UINT32(3, fixture->sensor.getTemplateCount());
+  TEST_ASSERT_EQUAL_UINT32(0x101, fixture->sensor.getTemplateKey(1));
+  TEST_ASSERT_EQUAL_UINT32(0x102, fixture->sensor.getTemplateKey(2));
+  std::vector<uint8_t> imported = fixture->sensor.getTemplate(40);
+  TEST_ASSERT_EQUAL(original.size(), imported.size());
+  TEST_ASSERT_TRUE(original == imported); // byte for byte, although re-chunked
+
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL(3, names.size());
+  TEST_ASSERT_EQUAL_STRING("Carol", names.find(40));
+}
+
+void test_interrupted_import_resumes_after_last_stored_template() {
+  exportAndReplaceSensor();
+
+  fixture->sensor.injectReturnCode(FINGERPRINT_STORE, FINGERPRINT_FLASHERR, 1, 2); // third template fails
+  fixture->manager.importSensorDB(false);
+  TEST_ASSERT_TRUE(wasNotified("storing template #40 failed"));
+  TEST_ASSERT_TRUE(wasNotified("interrupted after 2 fingerprints"));
+  TEST_ASSERT_EQUAL_UINT32(2, fixture->sensor.getTemplateCount());
+  Preferences preferences;
+  preferences.begin("sensorDB", true);
+  TEST_ASSERT_EQUAL_UINT16(2, preferences.getUShort("importedId", 0));
+  preferences.end();
+
+  fixture->sensor.resetCommandCounts();
+  fixture->manager.importSensorDB(true);
+  TEST_ASSERT_TRUE(wasNotified("resuming after #2"));
+  TEST_ASSERT_TRUE(wasNotified("Import of 1 fingerprints finished"));
+  TEST_ASSERT_EQUAL_UINT32(1, fixture->sensor.getCommandCount(FINGERPRINT_DOWNCHAR)); // only the missing one was transferred
+  TEST_ASSERT_EQUAL_UINT32(3, fixture->sensor.getTemplateCount());
+  TEST_ASSERT_EQUAL(3, fixture->manager.getFingerCount());
+  preferences.begin("sensorDB", true);
+  TEST_ASSERT_FALSE(preferences.isKey("importedId"));
+  preferences.end();
+}
+
+void test_import_without_export_file_fails() {
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.importSensorDB(false);
+  TEST_ASSERT_TRUE(wasNotified("no valid export found"));
+  TEST_ASSERT_EQUAL_UINT32(0, fixture->sensor.getCommandCount(FINGERPRINT_DOWNCHAR));
+}
+
+void test_import_into_smaller_sensor_is_rejected_before_writing() {
+  exportAndReplaceSensor(20); // #40 does not fit
+
+  fixture->manager.importSensorDB(false);
+  TEST_ASSERT_TRUE(wasNotified("the export contains #40, but this sensor stores only 20 fingerprints"));
+  TEST_ASSERT_EQUAL_UINT32(0, fixture->sensor.getCommandCount(FINGERPRINT_DOWNCHAR));
+  TEST_ASSERT_EQUAL_UINT32(0, fixture->sensor.getTemplateCount());
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL(0, names.size());
+  Preferences preferences;
+  preferences.begin("sensorDB", true);
+  TEST_ASSERT_FALSE(preferences.isKey("importedId"));
+  preferences.end();
+}
+
+void test_templates_without_name_are_exported() {
+  fixture->enroll(1, 0x101, "Alice");
+  fixture->enroll(7, 0x107, NULL); // names lost, template still on the sensor
+  fixture->nameFinger(9, "Ghost"); // name without template is not exported
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.exportSensorDB();
+  TEST_ASSERT_TRUE(wasNotified("Export of 2 fingerprints finished"));
+
+  delete fixture;
+  hostNvs().reset();
+  fixture = new SensorFixture();
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.importSensorDB(false);
+  TEST_ASSERT_EQUAL_UINT32(0x107, fixture->sensor.getTemplateKey(7));
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL(2, names.size());
+  TEST_ASSERT_EQUAL_STRING("#7", names.find(7));
+}
+
+void test_failed_upload_removes_partial_export() {
+  fixture->enroll(1, 0x101, "Alice");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->sensor.injectFault(FINGERPRINT_UPLOAD, R503Emulator::FaultType::noReply);
+  fixture->manager.exportSensorDB();
+  TEST_ASSERT_TRUE(wasNotified("upload of template #1 failed"));
+  TEST_ASSERT_FALSE(LittleFS.exists("/sensordb.bin"));
+}
+
+/* the web server must not wait for the whole export, calls fail after commandStartTimeoutMs and are not executed later */
+void test_finger_updates_fail_fast_while_export_runs() {
+  fixture->enroll(1, 0x101, "Alice");
+  fixture->enroll(2, 0x102, "Bob");
+  for (int id=3; id<=8; id++)
+    fixture->enroll(id, 0x100 + id, NULL);
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->sensor.setCommandDelay(FINGERPRINT_UPLOAD, 800000); // more than 6 s for the export
+  fixture->manager.startSensorTask(TouchWakeup::interrupt);
+  fixture->manager.exportSensorDB();
+  TEST_ASSERT_TRUE(waitFor([] { return wasNotified("Export of fingerprints started"); }, 1000));
+
+  unsigned long start = millis();
+  TEST_ASSERT_TRUE(fixture->manager.renameFinger(1, "Mallory") == FingerUpdateResult::busy);
+  char buffer[256];
+  JsonWriter json(buffer, sizeof(buffer));
+  int total;
+  TEST_ASSERT_EQUAL(-1, fixture->manager.writeFingerList(json, 0, 10, total));
+  TEST_ASSERT_LESS_THAN(5000, millis() - start);
+
+  TEST_ASSERT_TRUE(waitFor([] { return wasNotified("Export of 8 fingerprints finished"); }, 10000));
+  TEST_ASSERT_TRUE(fixture->manager.renameFinger(2, "Robert") == FingerUpdateResult::ok); // sensor task is free again
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL_STRING("Alice", names.find(1)); // the cancelled rename was dropped
+  TEST_ASSERT_EQUAL_STRING("Robert", names.find(2));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_export_import_round_trip);
+  RUN_TEST(test_interrupted_import_resumes_after_last_stored_template);
+  RUN_TEST(test_import_without_export_file_fails);
+  RUN_TEST(test_import_into_smaller_sensor_is_rejected_before_writing);
+  RUN_TEST(test_templates_without_name_are_exported);
+  RUN_TEST(test_failed_upload_removes_partial_export);
+  RUN_TEST(test_finger_updates_fail_fast_while_export_runs);
+  return UNITY_END();
+}
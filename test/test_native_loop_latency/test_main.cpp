@@ -0,0 +1,131 @@
+/*
+  loop() must stay below maxLoopMicros (20 ms) while the sensor task scans with R503 timings. main.cpp does not build on
+  the host, so the test runs ScanPublisher::loop(), the scan part of every loop() iteration on the device: taking the
+  scan results, checking the pairing code read by the sensor task against the stored one, publishing the results, stats
+  and log messages by MQTT and releasing the scan power lock. None of it may wait for the sensor.
+*/
+
+#include "SensorFixture.h"
+#include "ScanPublisher.h"
+
+const int64_t maxLoopMicros = 20000;
+const uint32_t mqttPublishMicros = 1000; // TCP write of one message on the device
+const int doorbellPin = 19;
+const char *pairingCode = "0123456789abcdef0123456789abcdef";
+
+SensorFixture *fixture = NULL;
+SettingsManager *settingsManager = NULL;
+PubSubClient *mqttClient = NULL;
+LogBuffer::Entry logSlots[20];
+LogBuffer *logBuffer = NULL;
+volatile bool mqttConnecting = false;
+Sensor *sensor = NULL;
+ScanPublisher *publisher = NULL;
+int pairingJobs = 0;
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+  fixture->enroll(1, 0x101, "Alice");
+  fixture->enroll(2, 0x102, "Bob");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  TEST_ASSERT_TRUE(fixture->manager.setPairingCode(pairingCode));
+  fixture->sensor.useR503Timings();
+  fixture->manager.startSensorTask(TouchWakeup::polling);
+
+  settingsManager = new SettingsManager();
+  settingsManager->updateAppSettings([](AppSettings &settings) {
+    settings.sensorPairingCode = pairingCode;
+    settings.sensorPairingValid = true;
+  });
+  mqttClient = new PubSubClient();
+  mqttClient->publishMicros = mqttPublishMicros;
+  logBuffer = new LogBuffer(logSlots, 20);
+  sensor = new Sensor{ fixture->manager, doorbellPin, "", false, 0, Match() };
+  publisher = new ScanPublisher(sensor, 1, *settingsManager, *mqttClient, *logBuffer, mqttConnecting);
+  publisher->setStatsSource([]() { return fixture->manager.getMetrics().toJson(); }, 1000);
+  pairingJobs = 0;
+  publisher->setPairingStarter([](PairingJob job) {
+    pairingJobs++;
+    return true;
+  });
+}
+
+void tearDown() {
+  hostDeleteTasks();
+  delete publisher;
+  delete sensor;
+  delete logBuffer;
+  delete mqttClient;
+  delete settingsManager;
+  delete fixture;
+  fixture = NULL;
+}
+
+int countNotified(const char *text) {
+  std::lock_guard<std::mutex> guard(notificationsMutex());
+  int n = 0;
+  for (const auto &message : notifications()) {
+    if (message.find(text) != std::string::npos)
+      n++;
+  }
+  return n;
+}
+
+/* runs loop() for durationMs and returns the longest iteration, the finger on the sensor changes after every result */
+int64_t runLoop(uint32_t durationMs, const std::vector<uint32_t> &keys) {
+  int64_t maxMicros = 0;
+  size_t next = 0;
+  int results = 0;
+  fixture->touch(keys[next++ % keys.size()]);
+  unsigned long start = millis();
+  while (millis() - start < durationMs) {
+    logBuffer->append("log message of another task");
+    int64_t iterationStart = esp_timer_get_time();
+    publisher->loop(true);
+    maxMicros = max(maxMicros, esp_timer_get_time() - iterationStart);
+    int resultsNow = countNotified("Match Found");
+    if (resultsNow != results) {
+      results = resultsNow;
+      fixture->touch(keys[next++ % keys.size()]);
+    }
+    delay(1); // loop() yields to the other tasks between iterations
+  }
+  char message[160];
+  snprintf(message, sizeof(message), "loop: max %u us per iteration, %d results, %d MQTT messages", (unsigned int)maxMicros,
+    results, (int)mqttClient->messages.size());
+  TEST_MESSAGE(message);
+  return maxMicros;
+}
+
+void test_loop_does_not_wait_for_sensor() {
+  int64_t maxMicros = runLoop(5000, { 0x999, 0x101 }); // unknown finger first, its hold-off is shorter
+  bool matchPublished = false;
+  for (const auto &message : mqttClient->messages)
+    matchPublished |= (message.first == "fingerprintDoorbell/matchName" && message.second == "Alice");
+  TEST_ASSERT_TRUE(matchPublished);
+  TEST_ASSERT_GREATER_OR_EQUAL(1, mqttClient->count("fingerprintDoorbell/ring"));
+  TEST_ASSERT_GREATER_OR_EQUAL(2, mqttClient->count("fingerprintDoorbell/stats"));
+  TEST_ASSERT_GREATER_OR_EQUAL(100, mqttClient->count("fingerprintDoorbell/lastLogMessage"));
+  TEST_ASSERT_FALSE(wasNotified("Security issue")); // every match carries the pairing code of the sensor
+  TEST_ASSERT_EQUAL(0, pairingJobs);
+  TEST_ASSERT_LESS_THAN(maxLoopMicros, maxMicros);
+}
+
+void test_pairing_code_read_error_is_not_published() {
+  fixture->sensor.injectFault(R503Emulator::cmdReadNotepad, R503Emulator::FaultType::noReply, FINGERPRINT_PACKETRECIEVEERR, 100);
+  int64_t maxMicros = runLoop(3000, { 0x101 });
+  TEST_ASSERT_TRUE(wasNotified("Match Found"));
+  TEST_ASSERT_TRUE(wasNotified("Security issue"));
+  for (const auto &message : mqttClient->messages)
+    TEST_ASSERT_TRUE(message.second != "Alice");
+  TEST_ASSERT_EQUAL(0, pairingJobs); // an unreadable code does not invalidate the pairing
+  TEST_ASSERT_LESS_THAN(maxLoopMicros, maxMicros);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_loop_does_not_wait_for_sensor);
+  RUN_TEST(test_pairing_code_read_error_is_not_published);
+  return UNITY_END();
+}
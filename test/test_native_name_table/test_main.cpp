@@ -0,0 +1,156 @@
+/*
+  Persistence of the finger names in NVS: one chunk per 256 slots, only changed chunks are rewritten, and the single blob
+  of earlier versions is migrated.
+*/
+
+#include "NativeTest.h"
+#include "FingerNameTable.h"
+#include "rom/crc.h"
+
+const char *prefsNamespace = "fingerList";
+
+void setUp() {
+  resetHost();
+}
+
+void tearDown() {
+}
+
+/* names for every third slot of a sensor with 1000 slots (4 chunks) */
+void saveLargeTable() {
+  FingerNameTable names;
+  for (int id=1; id<=1000; id+=3)
+    names.set(id, (String("Finger ") + id).c_str());
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+}
+
+size_t getStoredBytes(const char *key) {
+  Preferences preferences;
+  preferences.begin(prefsNamespace, true);
+  size_t length = preferences.getBytesLength(key);
+  preferences.end();
+  return length;
+}
+
+void test_table_is_stored_in_chunks_of_256_slots() {
+  saveLargeTable();
+  TEST_ASSERT_EQUAL_UINT32(4, hostNvs().writes);
+  TEST_ASSERT_GREATER_THAN(0, getStoredBytes("names3"));
+  TEST_ASSERT_EQUAL(0, getStoredBytes("names4"));
+
+  FingerNameTable names;
+  TEST_ASSERT_TRUE(names.loadFromPrefs(prefsNamespace) == FingerNameTable::LoadResult::chunks);
+  TEST_ASSERT_EQUAL(334, names.size());
+  TEST_ASSERT_EQUAL_STRING("Finger 1", names.find(1));
+  TEST_ASSERT_EQUAL_STRING("Finger 256", names.find(256));
+  TEST_ASSERT_EQUAL_STRING("Finger 1000", names.find(1000));
+  TEST_ASSERT_NULL(names.find(2));
+}
+
+void test_rename_rewrites_only_its_chunk() {
+  saveLargeTable();
+  size_t chunkBytes = getStoredBytes("names2");
+  FingerNameTable names;
+  names.loadFromPrefs(prefsNamespace);
+  hostNvs().writes = 0;
+  hostNvs().bytesWritten = 0;
+
+  names.set(601, "Grace");
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+  TEST_ASSERT_EQUAL_UINT32(1, hostNvs().writes);
+  TEST_ASSERT_LESS_OR_EQUAL(chunkBytes, hostNvs().bytesWritten);
+
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace)); // nothing changed
+  TEST_ASSERT_EQUAL_UINT32(1, hostNvs().writes);
+
+  FingerNameTable reloaded;
+  reloaded.loadFromPrefs(prefsNamespace);
+  TEST_ASSERT_EQUAL_STRING("Grace", reloaded.find(601));
+  TEST_ASSERT_EQUAL(334, reloaded.size());
+}
+
+void test_chunk_without_names_is_removed() {
+  FingerNameTable names;
+  names.set(3, "Alice");
+  names.set(300, "Bob");
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+  names.remove(300);
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+  TEST_ASSERT_EQUAL(0, getStoredBytes("names1"));
+
+  names.clear();
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+  FingerNameTable reloaded;
+  TEST_ASSERT_TRUE(reloaded.loadFromPrefs(prefsNamespace) == FingerNameTable::LoadResult::empty);
+  TEST_ASSERT_EQUAL(0, reloaded.size());
+}
+
+void test_corrupt_chunk_loses_only_its_names() {
+  saveLargeTable();
+  Preferences preferences;
+  preferences.begin(prefsNamespace, false);
+  std::vector<uint8_t> chunk(preferences.getBytesLength("names1"));
+  preferences.getBytes("names1", chunk.data(), chunk.size());
+  chunk[chunk.size() / 2] ^= 0x55;
+  preferences.putBytes("names1", chunk.data(), chunk.size());
+  preferences.end();
+
+  FingerNameTable names;
+  TEST_ASSERT_TRUE(names.loadFromPrefs(prefsNamespace) == FingerNameTable::LoadResult::corrupt);
+  TEST_ASSERT_EQUAL_STRING("Finger 1", names.find(1));
+  TEST_ASSERT_NULL(names.find(256));
+  TEST_ASSERT_EQUAL_STRING("Finger 514", names.find(514));
+}
+
+void test_full_nvs_fails_and_is_retried() {
+  FingerNameTable names;
+  names.set(1, "Alice");
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+  hostNvs().capacityEntries = hostNvs().usedEntries(); // no room for a new key
+  names.set(700, "Bob");
+  TEST_ASSERT_FALSE(names.saveToPrefs(prefsNamespace));
+
+  hostNvs().capacityEntries = 4 * 126;
+  TEST_ASSERT_TRUE(names.saveToPrefs(prefsNamespace));
+  FingerNameTable reloaded;
+  reloaded.loadFromPrefs(prefsNamespace);
+  TEST_ASSERT_EQUAL_STRING("Bob", reloaded.find(700));
+}
+
+/* the single blob "names" written by the previous version: header, entries {id, offset, length}, names, CRC32 */
+void test_single_blob_is_migrated() {
+  const char arena[] = "Alice\0Bob";
+  const uint16_t blobEntries[] = { 5, 0, 5, 900, 6, 3 };
+  std::vector<uint8_t> blob = { 1, 0, 2, 0, sizeof(arena), 0 };
+  blob.insert(blob.end(), (const uint8_t*)blobEntries, (const uint8_t*)blobEntries + sizeof(blobEntries));
+  blob.insert(blob.end(), (const uint8_t*)arena, (const uint8_t*)arena + sizeof(arena));
+  uint32_t crc = crc32_le(0, blob.data(), blob.size());
+  blob.insert(blob.end(), (const uint8_t*)&crc, (const uint8_t*)&crc + sizeof(crc));
+  Preferences preferences;
+  preferences.begin(prefsNamespace, false);
+  preferences.putBytes("names", blob.data(), blob.size());
+  preferences.end();
+
+  FingerNameTable names;
+  TEST_ASSERT_TRUE(names.loadFromPrefs(prefsNamespace) == FingerNameTable::LoadResult::migrated);
+  TEST_ASSERT_EQUAL_STRING("Alice", names.find(5));
+  TEST_ASSERT_EQUAL_STRING("Bob", names.find(900));
+  TEST_ASSERT_EQUAL(0, getStoredBytes("names"));
+  TEST_ASSERT_GREATER_THAN(0, getStoredBytes("names0"));
+  TEST_ASSERT_GREATER_THAN(0, getStoredBytes("names3"));
+
+  FingerNameTable reloaded;
+  TEST_ASSERT_TRUE(reloaded.loadFromPrefs(prefsNamespace) == FingerNameTable::LoadResult::chunks);
+  TEST_ASSERT_EQUAL(2, reloaded.size());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_table_is_stored_in_chunks_of_256_slots);
+  RUN_TEST(test_rename_rewrites_only_its_chunk);
+  RUN_TEST(test_chunk_without_names_is_removed);
+  RUN_TEST(test_corrupt_chunk_loses_only_its_names);
+  RUN_TEST(test_full_nvs_fails_and_is_retried);
+  RUN_TEST(test_single_blob_is_migrated);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+/*
+  Reconciliation of the finger names with the index table of the emulated sensor, the migration of names stored as
+  one NVS key per finger by earlier versions, and deleteFinger()/renameFinger() checking the slot on the sensor.
+*/
+
+#include "SensorFixture.h"
+
+SensorFixture *fixture = NULL;
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+}
+
+void tearDown() {
+  hostDeleteTasks();
+  delete fixture;
+  fixture = NULL;
+}
+
+/* connects, starts the sensor task and waits for the reconciliation started by connect() */
+String connectAndReconcile() {
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.startSensorTask(TouchWakeup::interrupt);
+  String report;
+  waitFor([&] { report = fixture->manager.getReconcileReport(); return report.indexOf("\"state\":\"running\"") < 0; }, 3000);
+  return report;
+}
+
+void test_legacy_names_are_migrated() {
+  fixture->sensor.storeTemplate(3, 0x33);
+  fixture->sensor.storeTemplate(14, 0x44);
+  Preferences preferences;
+  preferences.begin("fingerList", false);
+  preferences.putString("3", "Eve");
+  preferences.putString("14", "Frank");
+  preferences.end();
+
+  String report = connectAndReconcile();
+  TEST_ASSERT_TRUE(report.indexOf("\"state\":\"done\"") >= 0);
+  TEST_ASSERT_TRUE(report.indexOf("\"unnamed\":[],\"ghosts\":[]") >= 0);
+  TEST_ASSERT_EQUAL(2, fixture->manager.getFingerCount());
+
+  preferences.begin("fingerList", true);
+  TEST_ASSERT_TRUE(preferences.isKey("names0"));
+  TEST_ASSERT_FALSE(preferences.isKey("3"));
+  TEST_ASSERT_FALSE(preferences.isKey("14"));
+  preferences.end();
+}
+
+void test_differences_are_reported_and_repaired() {
+  fixture->enroll(1, 0x11, "Alice");
+  fixture->enroll(2, 0x22, NULL); // template without name
+  fixture->nameFinger(5, "Ghost"); // name without template
+
+  String report = connectAndReconcile();
+  TEST_ASSERT_TRUE(report.indexOf("\"state\":\"done\"") >= 0);
+  TEST_ASSERT_TRUE(report.indexOf("\"templatesOnSensor\":2") >= 0);
+  TEST_ASSERT_TRUE(report.indexOf("\"unnamed\":[2],\"ghosts\":[5],\"repaired\":false") >= 0);
+  TEST_ASSERT_TRUE(wasNotified("differs from sensor"));
+
+  fixture->manager.startReconciliation(true);
+  waitFor([&] { report = fixture->manager.getReconcileReport(); return report.indexOf("\"state\":\"done\"") >= 0; }, 3000);
+  TEST_ASSERT_TRUE(report.indexOf("\"repaired\":true") >= 0);
+
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL(2, names.size());
+  TEST_ASSERT_EQUAL_STRING("Alice", names.find(1));
+  TEST_ASSERT_EQUAL_STRING("#2", names.find(2));
+  TEST_ASSERT_NULL(names.find(5));
+}
+
+void test_all_index_pages_of_large_sensor_are_read() {
+  delete fixture;
+  fixture = new SensorFixture(1000);
+  fixture->enroll(1, 0x11, "Alice");
+  fixture->enroll(900, 0x99, NULL);
+
+  String report = connectAndReconcile();
+  TEST_ASSERT_TRUE(report.indexOf("\"capacity\":1000") >= 0);
+  TEST_ASSERT_TRUE(report.indexOf("\"unnamed\":[900]") >= 0);
+  TEST_ASSERT_EQUAL_UINT32(4, fixture->sensor.getCommandCount(R503Emulator::cmdReadIndexTable));
+}
+
+void test_index_table_read_error_fails_reconciliation() {
+  fixture->enroll(1, 0x11, "Alice");
+  fixture->sensor.injectReturnCode(R503Emulator::cmdReadIndexTable, FINGERPRINT_PACKETRESPONSEFAIL);
+
+  String report = connectAndReconcile();
+  TEST_ASSERT_TRUE(report.indexOf("\"state\":\"failed\"") >= 0);
+  TEST_ASSERT_TRUE(report.indexOf("\"returnCode\":14") >= 0);
+  TEST_ASSERT_TRUE(wasNotified("Reading the index table of the sensor failed"));
+  TEST_ASSERT_EQUAL(1, fixture->manager.getFingerCount()); // names are left alone
+}
+
+void test_update_of_empty_slot_is_not_enrolled() {
+  fixture->enroll(1, 0x11, "Alice");
+  connectAndReconcile();
+  TEST_ASSERT_TRUE(fixture->manager.renameFinger(7, "Ghost") == FingerUpdateResult::notEnrolled);
+  TEST_ASSERT_TRUE(fixture->manager.deleteFinger(7) == FingerUpdateResult::notEnrolled);
+  TEST_ASSERT_TRUE(fixture->manager.deleteFinger(0) == FingerUpdateResult::notEnrolled);
+
+  FingerNameTable names;
+  names.loadFromPrefs("fingerList");
+  TEST_ASSERT_EQUAL(1, names.size()); // no ghost name created
+
+  TEST_ASSERT_TRUE(fixture->manager.renameFinger(1, "Alicia") == FingerUpdateResult::ok);
+  TEST_ASSERT_TRUE(fixture->manager.deleteFinger(1) == FingerUpdateResult::ok);
+  TEST_ASSERT_FALSE(fixture->sensor.hasTemplate(1));
+  TEST_ASSERT_TRUE(fixture->manager.deleteFinger(1) == FingerUpdateResult::notEnrolled);
+}
+
+void test_ghost_name_can_be_deleted_but_not_renamed() {
+  fixture->nameFinger(5, "Ghost");
+  connectAndReconcile();
+  TEST_ASSERT_TRUE(fixture->manager.renameFinger(5, "Still a ghost") == FingerUpdateResult::notEnrolled);
+  TEST_ASSERT_TRUE(fixture->manager.deleteFinger(5) == FingerUpdateResult::ok);
+  TEST_ASSERT_EQUAL(0, fixture->manager.getFingerCount());
+}
+
+void test_update_with_sensor_error_fails() {
+  fixture->enroll(1, 0x11, "Alice");
+  connectAndReconcile();
+  fixture->sensor.injectReturnCode(R503Emulator::cmdReadIndexTable, FINGERPRINT_PACKETRESPONSEFAIL);
+  TEST_ASSERT_TRUE(fixture->manager.renameFinger(1, "Alicia") == FingerUpdateResult::sensorError);
+  fixture->sensor.injectReturnCode(R503Emulator::cmdReadIndexTable, FINGERPRINT_PACKETRESPONSEFAIL);
+  TEST_ASSERT_TRUE(fixture->manager.deleteFinger(1) == FingerUpdateResult::sensorError);
+  TEST_ASSERT_TRUE(wasNotified("reading the index table of the sensor failed"));
+  TEST_ASSERT_TRUE(fixture->sensor.hasTemplate(1));
+  TEST_ASSERT_EQUAL(1, fixture->manager.getFingerCount());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_legacy_names_are_migrated);
+  RUN_TEST(test_differences_are_reported_and_repaired);
+  RUN_TEST(test_all_index_pages_of_large_sensor_are_read);
+  RUN_TEST(test_index_table_read_error_fails_reconciliation);
+  RUN_TEST(test_update_of_empty_slot_is_not_enrolled);
+  RUN_TEST(test_ghost_name_can_be_deleted_but_not_renamed);
+  RUN_TEST(test_update_with_sensor_error_fails);
+  return UNITY_END();
+}
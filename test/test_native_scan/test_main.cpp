@@ -0,0 +1,158 @@
+/*
+  Scanning against the emulated sensor: baud rate negotiation on connect, match/no match/errors of scanFingerprint(),
+  the search of recently matched fingers and the hand over of scan results from the sensor task to loop().
+*/
+
+#include "SensorFixture.h"
+
+SensorFixture *fixture = NULL;
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+}
+
+void tearDown() {
+  hostDeleteTasks(); // sensor task first, it uses the fixture
+  delete fixture;
+  fixture = NULL;
+}
+
+void test_connect_switches_sensor_to_fastest_baud_rate() {
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  TEST_ASSERT_EQUAL_UINT32(115200, fixture->sensor.getBaudRate());
+  TEST_ASSERT_EQUAL_UINT32(115200, Serial2.baudRate());
+  Preferences preferences;
+  preferences.begin("sensor", true);
+  TEST_ASSERT_EQUAL_UINT32(115200, preferences.getUInt("baudRate", 0)); // next boot starts at the negotiated rate
+  preferences.end();
+  TEST_ASSERT_EQUAL_UINT16(200, fixture->manager.getCapacity());
+}
+
+void test_connect_finds_sensor_at_other_baud_rate() {
+  delete fixture;
+  fixture = new SensorFixture(200, 19200);
+  fixture->sensor.setIgnoreBaudRateChange(true); // module that applies a new rate only after power cycle
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  TEST_ASSERT_EQUAL_UINT32(19200, fixture->sensor.getBaudRate());
+  TEST_ASSERT_EQUAL_UINT32(19200, Serial2.baudRate()); // fell back to the rate the sensor still uses
+  Preferences preferences;
+  preferences.begin("sensor", true);
+  TEST_ASSERT_EQUAL_UINT32(19200, preferences.getUInt("baudRate", 0));
+  preferences.end();
+}
+
+void test_untouched_ring_does_not_talk_to_sensor() {
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.scanFingerprint(); // first scan turns the touch indicator off
+  fixture->sensor.resetCommandCounts();
+  Match match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noFinger);
+  TEST_ASSERT_EQUAL_UINT32(0, fixture->sensor.getTotalCommandCount());
+}
+
+void test_match_returns_name_and_searches_recent_finger_first() {
+  fixture->enroll(7, 0x1234, "Alice");
+  fixture->enroll(120, 0x5678, "Bob");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+
+  fixture->touch(0x1234);
+  Match match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_UINT16(7, match.matchId);
+  TEST_ASSERT_EQUAL_STRING("Alice", match.matchName.c_str());
+  TEST_ASSERT_GREATER_THAN(0, match.matchConfidence);
+
+  fixture->sensor.resetCommandCounts();
+  match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  std::vector<R503Emulator::Search> searches = fixture->sensor.getSearches();
+  TEST_ASSERT_EQUAL(1, searches.size()); // found in the range of recent fingers, no full search
+  TEST_ASSERT_EQUAL_UINT16(7, searches[0].start);
+  TEST_ASSERT_EQUAL_UINT16(1, searches[0].count);
+
+  // other finger: one miss in the recent range, then the full search
+  fixture->touch(0x5678);
+  fixture->sensor.resetCommandCounts();
+  match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_STRING("Bob", match.matchName.c_str());
+  searches = fixture->sensor.getSearches();
+  TEST_ASSERT_EQUAL(2, searches.size());
+  TEST_ASSERT_EQUAL_UINT16(0, searches[1].start);
+  TEST_ASSERT_EQUAL_UINT16(200, searches[1].count);
+}
+
+void test_unknown_finger_is_no_match_after_five_scans() {
+  fixture->enroll(1, 0x1234, "Alice");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->touch(0x9999);
+  fixture->sensor.resetCommandCounts();
+  Match match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::noMatchFound);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_NOTFOUND, match.returnCode);
+  TEST_ASSERT_EQUAL_UINT32(5, fixture->sensor.getCommandCount(FINGERPRINT_GETIMAGE));
+  TEST_ASSERT_EQUAL_UINT32(5, fixture->sensor.getCommandCount(FINGERPRINT_SEARCH));
+}
+
+void test_messy_image_is_an_error() {
+  fixture->enroll(1, 0x1234, "Alice");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->touch(0x1234);
+  fixture->sensor.injectReturnCode(FINGERPRINT_IMAGE2TZ, FINGERPRINT_IMAGEMESS);
+  Match match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::error);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_IMAGEMESS, match.returnCode);
+  TEST_ASSERT_EQUAL_UINT32(0, fixture->sensor.getCommandCount(FINGERPRINT_SEARCH));
+}
+
+void test_lost_and_corrupt_replies_are_communication_errors() {
+  fixture->enroll(1, 0x1234, "Alice");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->touch(0x1234);
+
+  fixture->sensor.injectFault(FINGERPRINT_SEARCH, R503Emulator::FaultType::noReply);
+  Match match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::error);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, match.returnCode);
+
+  fixture->sensor.injectFault(FINGERPRINT_IMAGE2TZ, R503Emulator::FaultType::badChecksum);
+  match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::error);
+  TEST_ASSERT_EQUAL_UINT8(FINGERPRINT_PACKETRECIEVEERR, match.returnCode);
+  TEST_ASSERT_TRUE(fixture->manager.getMetrics().toJson().indexOf("\"sensorTimeouts\":2") >= 0);
+
+  // the next scan is not disturbed by leftovers of the failed commands
+  match = fixture->manager.scanFingerprint();
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+}
+
+void test_sensor_task_queues_match_for_loop() {
+  fixture->enroll(3, 0x4242, "Carol");
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  fixture->manager.startSensorTask(TouchWakeup::interrupt);
+
+  fixture->sensor.placeFinger(0x4242);
+  hostGpio().drive(defaultTouchRingPin, LOW); // falling edge wakes the sensor task
+  Match match;
+  TEST_ASSERT_TRUE(waitFor([&] { return fixture->manager.getNextMatch(match); }, 2000));
+  TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  TEST_ASSERT_EQUAL_STRING("Carol", match.matchName.c_str());
+  TEST_ASSERT_GREATER_OR_EQUAL(0, fixture->manager.getTouchLatencyMicros());
+
+  // commands of other tasks are executed by the sensor task in between
+  TEST_ASSERT_EQUAL_STRING("", fixture->manager.getPairingCode().c_str());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_switches_sensor_to_fastest_baud_rate);
+  RUN_TEST(test_connect_finds_sensor_at_other_baud_rate);
+  RUN_TEST(test_untouched_ring_does_not_talk_to_sensor);
+  RUN_TEST(test_match_returns_name_and_searches_recent_finger_first);
+  RUN_TEST(test_unknown_finger_is_no_match_after_five_scans);
+  RUN_TEST(test_messy_image_is_an_error);
+  RUN_TEST(test_lost_and_corrupt_replies_are_communication_errors);
+  RUN_TEST(test_sensor_task_queues_match_for_loop);
+  return UNITY_END();
+}
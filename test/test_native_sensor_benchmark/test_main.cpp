@@ -0,0 +1,158 @@
+/*
+  Host benchmark of scan and enroll throughput/latency against the emulated sensor with typical R503 processing times and
+  real UART transfer times at the negotiated baud rate. Absolute numbers depend on the timings of the emulator, so the
+  results are reported as messages and only compared relative to each other and to generous upper bounds.
+*/
+
+#include "SensorFixture.h"
+#include <algorithm>
+#include <atomic>
+#include <time.h>
+
+SensorFixture *fixture = NULL;
+const int fingerCount = 20; // search time depends on the capacity (200), not on the number of fingers
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+  for (int id=1; id<=fingerCount; id++)
+    fixture->enroll(id, 0x1000 + id, (String("Finger ") + id).c_str());
+  fixture->sensor.useR503Timings();
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+}
+
+void tearDown() {
+  hostDeleteTasks();
+  delete fixture;
+  fixture = NULL;
+}
+
+struct LatencyStats {
+  int64_t mean;
+  int64_t p95;
+  int64_t max;
+};
+
+LatencyStats getStats(std::vector<int64_t> samples) {
+  std::sort(samples.begin(), samples.end());
+  int64_t sum = 0;
+  for (int64_t sample : samples)
+    sum += sample;
+  return { sum / (int64_t)samples.size(), samples[samples.size() * 95 / 100], samples.back() };
+}
+
+void report(const char *name, const LatencyStats &stats) {
+  char message[160];
+  snprintf(message, sizeof(message), "%s: mean %u ms, p95 %u ms, max %u ms, %.1f scans/s", name, (unsigned int)(stats.mean / 1000),
+    (unsigned int)(stats.p95 / 1000), (unsigned int)(stats.max / 1000), 1e6 / stats.mean);
+  TEST_MESSAGE(message);
+}
+
+/* touch to result of scans of the given fingers, one scan per finger */
+LatencyStats benchmarkScans(const std::vector<int> &ids) {
+  std::vector<int64_t> samples;
+  for (int id : ids) {
+    fixture->touch(0x1000 + id);
+    int64_t start = esp_timer_get_time();
+    Match match = fixture->manager.scanFingerprint();
+    samples.push_back(esp_timer_get_time() - start);
+    TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+    TEST_ASSERT_EQUAL_UINT16(id, match.matchId);
+  }
+  return getStats(samples);
+}
+
+void test_benchmark_scan_latency() {
+  std::vector<int> household; // the same few fingers over and over again, like at a front door
+  for (int i=0; i<20; i++)
+    household.push_back(1 + (i * 7) % 3 * 5);
+  benchmarkScans({ 1, 6, 11 }); // make them the recently matched fingers
+  LatencyStats recent = benchmarkScans(household);
+  report("scan, recently matched fingers", recent);
+
+  std::vector<int> everybody;
+  for (int i=0; i<20; i++)
+    everybody.push_back(12 + i % (fingerCount - 11)); // never matched before
+  LatencyStats full = benchmarkScans(everybody);
+  report("scan, rarely matched fingers", full);
+
+  TEST_ASSERT_LESS_THAN(full.mean, recent.mean);
+  TEST_ASSERT_LESS_THAN(1000000, full.p95); // touch to result below one second
+}
+
+/* CPU time of the calling thread, the time spent waiting for the sensor is not included */
+int64_t threadCpuMicros() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* the scan task should sleep while the sensor processes and the UART transfers, not poll for the reply */
+void test_benchmark_scan_cpu_time() {
+  const int scans = 20;
+  int64_t cpuMicros = 0;
+  int64_t wallMicros = 0;
+  for (int i=0; i<scans; i++) {
+    fixture->touch(0x1000 + 1 + i % fingerCount);
+    int64_t cpuStart = threadCpuMicros();
+    int64_t wallStart = esp_timer_get_time();
+    Match match = fixture->manager.scanFingerprint();
+    wallMicros += esp_timer_get_time() - wallStart;
+    cpuMicros += threadCpuMicros() - cpuStart;
+    TEST_ASSERT_TRUE(match.scanResult == ScanResult::matchFound);
+  }
+
+  char message[160];
+  snprintf(message, sizeof(message), "scan CPU time: %u us per scan (%u ms touch to result)", (unsigned int)(cpuMicros / scans),
+    (unsigned int)(wallMicros / scans / 1000));
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(wallMicros / 20, cpuMicros); // below 5% of the scan duration
+}
+
+void test_benchmark_enroll_duration() {
+  std::atomic<bool> done(false);
+  std::atomic<int> result(-1);
+  fixture->manager.setEnrollProgressCallback([](const EnrollProgress &progress) {
+    if (progress.status == EnrollStatus::waitForFinger)
+      fixture->sensor.placeFinger(0x5000);
+    else if (progress.status == EnrollStatus::liftFinger)
+      fixture->sensor.liftFinger();
+  });
+  fixture->manager.startSensorTask(TouchWakeup::polling);
+
+  int64_t start = esp_timer_get_time();
+  fixture->manager.startEnrollment(fingerCount + 1, "New", [&](NewFinger newFinger) {
+    result = (int)newFinger.enrollResult;
+    done = true;
+  });
+  TEST_ASSERT_TRUE(waitFor([&] { return done.load(); }, 10000));
+  int64_t duration = esp_timer_get_time() - start;
+  TEST_ASSERT_EQUAL((int)EnrollResult::ok, result);
+
+  char message[160];
+  snprintf(message, sizeof(message), "enroll (5 samples, finger placed immediately): %u ms, %u sensor commands", (unsigned int)(duration / 1000),
+    (unsigned int)fixture->sensor.getTotalCommandCount());
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(5000000, duration);
+}
+
+void test_benchmark_template_transfer() {
+  int64_t start = esp_timer_get_time();
+  fixture->manager.exportSensorDB();
+  int64_t duration = esp_timer_get_time() - start;
+  TEST_ASSERT_TRUE(wasNotified("Export of 20 fingerprints finished"));
+
+  char message[160];
+  snprintf(message, sizeof(message), "export of %d templates: %u ms, %u ms per template", fingerCount, (unsigned int)(duration / 1000),
+    (unsigned int)(duration / 1000 / fingerCount));
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmark_scan_latency);
+  RUN_TEST(test_benchmark_scan_cpu_time);
+  RUN_TEST(test_benchmark_enroll_duration);
+  RUN_TEST(test_benchmark_template_transfer);
+  return UNITY_END();
+}
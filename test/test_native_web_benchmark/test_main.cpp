@@ -0,0 +1,246 @@
+/*
+  Host benchmark of the web pages: the pages of data/ are rendered by TemplateRenderer with the placeholders resolved like
+  resolvePlaceholder() in main.cpp does, including the finger list of a sensor with 200 named fingers. Render time, time to
+  first byte and heap usage are reported as messages and checked against generous upper bounds, the peak heap includes
+  every allocation made while rendering (see NativeTest.h). The JSON of GET /api/fingers is measured the same way.
+*/
+
+#include "SensorFixture.h"
+#include "TemplateRenderer.h"
+#include "LogBuffer.h"
+#include "JsonWriter.h"
+#include <fstream>
+#include <sstream>
+
+SensorFixture *fixture = NULL;
+const int fingerCount = 200;
+
+// same keys as placeholderKeys in main.cpp, which does not build on the host
+enum class Placeholder { logMessages, logLatest, fingerList, sensorIndex, sensorCapacity, sensorOptions, sensorSelectHidden, hostname, versionInfo,
+  other };
+const char* const placeholderKeys[] = { "LOGMESSAGES", "LOG_LATEST", "FINGERLIST", "SENSOR_INDEX", "SENSOR_CAPACITY", "SENSOR_OPTIONS", "SENSOR_SELECT_HIDDEN", "HOSTNAME", "VERSIONINFO",
+  "WIFI_SSID", "WIFI_PASSWORD", "DHCP_SETTING_", "LOCAL_IP", "GATEWAY_IP", "SUBNET_MASK", "DNS_IP0", "DNS_IP1",
+  "MQTT_SERVER", "MQTT_PORT", "MQTT_USERNAME", "MQTT_PASSWORD", "MQTT_ROOTTOPIC", "NTP_SERVER", "WEBPAGE_USERNAME", "WEBPAGE_PASSWORD",
+  "ACTIVE_COLOR_", "ACTIVE_SEQUENCE_", "SCAN_COLOR_", "SCAN_SEQUENCE_", "MATCH_COLOR_", "MATCH_SEQUENCE_", "ENROLL_COLOR_", "ENROLL_SEQUENCE_",
+  "CONNECT_COLOR_", "CONNECT_SEQUENCE_", "WIFI_COLOR_", "WIFI_SEQUENCE_", "ERROR_COLOR_", "ERROR_SEQUENCE_" };
+
+bool streamFingerList = true; // false: the list as one String, like before it was streamed
+char fingerOptionsPage[1024];
+char apiBuffer[8192]; // same size as in main.cpp
+
+LogBuffer::Entry logSlots[200];
+LogBuffer *logBuffer = NULL;
+TemplateRenderer *renderer = NULL;
+
+/* copies a page of data/ (pio test runs in the project directory) into the LittleFS of the host */
+void installPage(const char *path) {
+  std::ifstream file((std::string("data") + path).c_str(), std::ios::binary);
+  TEST_ASSERT_TRUE_MESSAGE(file.good(), path);
+  std::stringstream content;
+  content << file.rdbuf();
+  LittleFS.writeFile(path, content.str());
+}
+
+void setUp() {
+  resetHost();
+  fixture = new SensorFixture();
+  for (int id=1; id<=fingerCount; id++)
+    fixture->enroll(id, 0x1000 + id, (String("Finger of resident ") + id).c_str());
+  TEST_ASSERT_TRUE(fixture->manager.connect());
+  logBuffer = new LogBuffer(logSlots, 200);
+  for (int i=0; i<50; i++)
+    logBuffer->append((String("Match Found: 7 - Finger of resident 7 with confidence of ") + (100 + i)).c_str());
+  streamFingerList = true;
+  renderer = new TemplateRenderer(placeholderKeys, sizeof(placeholderKeys) / sizeof(placeholderKeys[0]));
+  for (const char *page : { "/index.html", "/settings.html", "/colorSettings.html", "/wifiSettings.html" })
+    installPage(page);
+}
+
+void tearDown() {
+  hostDeleteTasks();
+  delete renderer;
+  delete logBuffer;
+  delete fixture;
+  renderer = NULL;
+  logBuffer = NULL;
+  fixture = NULL;
+}
+
+/* like writeFingerListOptions() in main.cpp */
+void writeFingerListOptions(TemplateOutput &out) {
+  int offset = 0;
+  size_t length;
+  int count;
+  while ((count = fixture->manager.writeFingerListAsHtmlOptions(fingerOptionsPage, sizeof(fingerOptionsPage), offset, length)) > 0) {
+    out.write(fingerOptionsPage, length);
+    offset += count;
+  }
+}
+
+void resolve(int key, uint8_t param, TemplateOutput &out) {
+  switch ((Placeholder)key)
+  {
+  case Placeholder::logMessages: {
+    String html = "";
+    LogBuffer::Entry entry;
+    for (uint32_t seq = logBuffer->getLatestSeq() - 9; seq <= logBuffer->getLatestSeq(); seq++) {
+      if (logBuffer->read(seq, entry))
+        html += logBuffer->format(entry) + "<br>";
+    }
+    out.write(html);
+    break;
+  }
+  case Placeholder::logLatest: out.write(String(logBuffer->getLatestSeq())); break;
+  case Placeholder::fingerList:
+    if (streamFingerList)
+      writeFingerListOptions(out);
+    else
+      out.write(fixture->manager.getFingerListAsHtmlOptionList());
+    break;
+  case Placeholder::sensorIndex: out.write("0"); break;
+  case Placeholder::sensorCapacity: out.write(String(fixture->manager.getCapacity())); break;
+  case Placeholder::sensorOptions: out.write("<option value=\"0\" selected>Door</option>"); break;
+  case Placeholder::sensorSelectHidden: out.write("hidden"); break;
+  case Placeholder::hostname: out.write("FingerprintDoorbell"); break;
+  case Placeholder::versionInfo: out.write("1.0.0"); break;
+  default:
+    if (param == 0)
+      out.write("selected"); // settings values and the option selected of each color/sequence group
+    break;
+  }
+}
+
+struct RenderStats {
+  int64_t micros;
+  int64_t firstByteMicros;
+  int64_t peakHeap;
+  size_t bytes;
+  int chunks;
+};
+
+RenderStats renderPage(const char *path, std::string *body = NULL) {
+  PsychicRequest request;
+  request.body.reserve(65536); // the recorded response is not part of the measurement
+  int64_t heapBefore = hostHeapUsed();
+  resetHeapPeak();
+  int64_t start = esp_timer_get_time();
+  esp_err_t result = renderer->render(&request, path, 200, resolve);
+  int64_t duration = esp_timer_get_time() - start;
+  TEST_ASSERT_EQUAL(ESP_OK, result);
+  TEST_ASSERT_TRUE(request.finished);
+  TEST_ASSERT_TRUE(request.body.find("%HOSTNAME%") == std::string::npos);
+  RenderStats stats = { duration, request.firstChunkMicros - start, hostHeapPeak() - heapBefore, request.body.size(), request.chunks };
+  if (body != NULL)
+    *body = request.body;
+  return stats;
+}
+
+void report(const char *name, const RenderStats &stats) {
+  char message[200];
+  snprintf(message, sizeof(message), "%s: %u bytes in %d chunks, %u us, first byte after %u us, peak heap %u bytes", name,
+    (unsigned int)stats.bytes, stats.chunks, (unsigned int)stats.micros, (unsigned int)stats.firstByteMicros, (unsigned int)stats.peakHeap);
+  TEST_MESSAGE(message);
+}
+
+void test_benchmark_render_pages() {
+  for (const char *path : { "/index.html", "/settings.html", "/colorSettings.html", "/wifiSettings.html" }) {
+    RenderStats first = renderPage(path); // includes parsing the page
+    RenderStats cached = renderPage(path);
+    report((String(path) + " (first)").c_str(), first);
+    report(path, cached);
+    TEST_ASSERT_LESS_THAN(100000, cached.micros);
+  }
+  TEST_MESSAGE(renderer->getStatsJson().c_str());
+}
+
+void test_render_heap_does_not_grow_with_page_size() {
+  renderPage("/settings.html");
+  RenderStats settings = renderPage("/settings.html");
+  renderPage("/colorSettings.html");
+  RenderStats colorSettings = renderPage("/colorSettings.html"); // larger page, same placeholders resolved to short texts
+  TEST_ASSERT_LESS_OR_EQUAL(settings.peakHeap + 256, colorSettings.peakHeap);
+  TEST_ASSERT_LESS_OR_EQUAL(4096, settings.peakHeap); // log messages of the page
+  TEST_ASSERT_GREATER_THAN(settings.bytes, colorSettings.bytes);
+}
+
+/* index page with the finger list fetched from the running sensor task, as one String and streamed page by page */
+void test_benchmark_finger_list_time_to_first_byte() {
+  fixture->manager.startSensorTask(TouchWakeup::interrupt);
+  renderPage("/index.html"); // parse
+
+  streamFingerList = false;
+  std::string wholeBody;
+  RenderStats whole = renderPage("/index.html", &wholeBody);
+  report("/index.html, finger list as one String", whole);
+  streamFingerList = true;
+  std::string streamedBody;
+  RenderStats streamed = renderPage("/index.html", &streamedBody);
+  report("/index.html, finger list streamed", streamed);
+
+  TEST_ASSERT_TRUE(streamedBody == wholeBody);
+  TEST_ASSERT_TRUE(streamedBody.find("<option value=\"200\">200 - Finger of resident 200</option>") != std::string::npos);
+  TEST_ASSERT_LESS_THAN(whole.peakHeap / 2, streamed.peakHeap);
+  TEST_ASSERT_LESS_THAN(100000, streamed.firstByteMicros);
+}
+
+/* like writeFingersJson() in main.cpp, returns the offset of the next page or -1 */
+int writeFingersJson(JsonWriter &json, int offset, int limit) {
+  json.beginObject();
+  json.key("apiVersion"); json.value(1);
+  json.key("sensor"); json.value(0);
+  json.key("capacity"); json.value(fixture->manager.getCapacity());
+  json.key("offset"); json.value(offset);
+  json.key("fingers");
+  json.beginArray();
+  int total = 0;
+  json.reserve(64);
+  int count = fixture->manager.writeFingerList(json, offset, limit, total);
+  json.reserve(0);
+  json.endArray();
+  json.key("total"); json.value(total);
+  json.key("next");
+  int next = offset + count < total ? offset + count : -1;
+  if (next >= 0)
+    json.value(next);
+  else
+    json.valueNull();
+  json.endObject();
+  return next;
+}
+
+/* all 200 fingers with the maximum page size of GET /api/fingers, on the running sensor task */
+void test_benchmark_api_finger_list() {
+  fixture->manager.startSensorTask(TouchWakeup::interrupt);
+  int64_t heapBefore = hostHeapUsed();
+  resetHeapPeak();
+  int64_t start = esp_timer_get_time();
+  int pages = 0;
+  size_t bytes = 0;
+  int offset = 0;
+  while (offset >= 0) {
+    JsonWriter json(apiBuffer, sizeof(apiBuffer));
+    offset = writeFingersJson(json, offset, 200);
+    TEST_ASSERT_FALSE(json.hasOverflow());
+    bytes += json.getLength();
+    pages++;
+  }
+  int64_t duration = esp_timer_get_time() - start;
+  int64_t peakHeap = hostHeapPeak() - heapBefore;
+
+  char message[200];
+  snprintf(message, sizeof(message), "/api/fingers, %d fingers: %u bytes in %d pages, %u us, peak heap %u bytes", fingerCount,
+    (unsigned int)bytes, pages, (unsigned int)duration, (unsigned int)peakHeap);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(strstr(apiBuffer, "{\"id\":200,\"name\":\"Finger of resident 200\"}") != NULL);
+  TEST_ASSERT_LESS_THAN(100000, duration);
+  TEST_ASSERT_LESS_OR_EQUAL(1024, peakHeap); // the names are copied into apiBuffer, no String per finger
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmark_render_pages);
+  RUN_TEST(test_render_heap_does_not_grow_with_page_size);
+  RUN_TEST(test_benchmark_finger_list_time_to_first_byte);
+  RUN_TEST(test_benchmark_api_finger_list);
+  return UNITY_END();
+}